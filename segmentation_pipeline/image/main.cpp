@@ -6,6 +6,7 @@
 
 #include "opencv2/highgui.hpp"
 #include "opencv2/imgproc.hpp"
+#include "parallel.h"
 
 #define DEFAULT_WIDTH 300
 #define END_HEADER "end_header"
@@ -95,14 +96,35 @@ int main(int argc, char** argv) {
   cv::Mat density = cv::Mat_<int>(height, width);
 
   density *= 0;
-  
-  for(unsigned int i=0; i<vx.size(); ++i) {
-    int xindex, yindex;
-    xindex = std::min((int) (width * (vx[i] - xmin) / (xmax - xmin)), (int) width-1);
-    yindex = std::min((int) (height * (vy[i] - ymin) / (ymax - ymin)), (int) height-1);
 
-    int curDensity = density.at<int>(yindex, xindex)++;
-    maxDensity = std::max(curDensity, maxDensity);
+  // bin the points in parallel, each chunk into its own histogram; the
+  // histograms are summed in chunk order
+  long grain = std::max(1L << 16, (long) vx.size() / (2 * parallel_threads()) + 1);
+  std::vector<int> bins = parallel_reduce(0, vx.size(), grain, std::vector<int>(), [&](long first, long last) {
+    std::vector<int> chunk(width * height, 0);
+    for(long i=first; i<last; ++i) {
+      int xindex, yindex;
+      xindex = std::min((int) (width * (vx[i] - xmin) / (xmax - xmin)), (int) width-1);
+      yindex = std::min((int) (height * (vy[i] - ymin) / (ymax - ymin)), (int) height-1);
+      chunk[yindex * width + xindex]++;
+    }
+    return chunk;
+  }, [](std::vector<int> sum, const std::vector<int> &chunk) {
+    if (sum.empty()) {
+      return chunk;
+    }
+    for(unsigned int k=0; k<sum.size(); ++k) {
+      sum[k] += chunk[k];
+    }
+    return sum;
+  });
+
+  for(int i=0; i<height && !bins.empty(); ++i) {
+    for(int j=0; j<width; ++j) {
+      density.at<int>(i, j) = bins[i * width + j];
+      // one less than the fullest bin, as when this was counted serially
+      maxDensity = std::max(bins[i * width + j] - 1, maxDensity);
+    }
   }
 
   printf("Max density: %i\n", maxDensity);
@@ -113,13 +135,15 @@ int main(int argc, char** argv) {
   cv::Mat freespace = cv::Mat_<bool>(height, width);
   cv::Mat freespaceProb = cv::Mat_<int>(height, width);
 
-  for(unsigned int i=0; i<walls.rows; ++i) {
-    for(unsigned int j=0; j<walls.cols; ++j) {
-      walls.at<bool>(i, j) = density.at<int>(i, j) > THRESHOLD * maxDensity ? 1 : 0;
-      freespace.at<bool>(i, j) = density.at<int>(i, j) == 0 ? false : true; //!walls.at<bool>(i, j);
-      freespaceProb.at<int>(i, j) = density.at<int>(i, j) == 0 ? 0 : walls.at<bool>(i, j) ? 0 : THRESHOLD*maxDensity - density.at<int>(i, j);
+  parallel_for(0, walls.rows, 0, [&](long first, long last) {
+    for(unsigned int i=first; i<last; ++i) {
+      for(unsigned int j=0; j<walls.cols; ++j) {
+	walls.at<bool>(i, j) = density.at<int>(i, j) > THRESHOLD * maxDensity ? 1 : 0;
+	freespace.at<bool>(i, j) = density.at<int>(i, j) == 0 ? false : true; //!walls.at<bool>(i, j);
+	freespaceProb.at<int>(i, j) = density.at<int>(i, j) == 0 ? 0 : walls.at<bool>(i, j) ? 0 : THRESHOLD*maxDensity - density.at<int>(i, j);
+      }
     }
-  }
+  });
 
   writePPM(walls, name + "walls");
   writePPM(freespace, name + "freespace");
@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <new>
 #include "BP-S.h"
+#include "vecops.h"
+#include "parallel.h"
 
 #define private public
 #include "typeTruncatedQuadratic2D.h"
@@ -26,30 +28,20 @@
 
 inline void CopyVector(BPS::REAL* to, MRF::CostVal* from, int K)
 {
-    BPS::REAL* to_finish = to + K;
-    do
-	{
-	    *to ++ = *from ++;
-	} while (to < to_finish);
+    VecCopy(to, from, K);
 }
 
 inline void AddVector(BPS::REAL* to, BPS::REAL* from, int K)
 {
-    BPS::REAL* to_finish = to + K;
-    do
-	{
-	    *to ++ += *from ++;
-	} while (to < to_finish);
+    VecAdd(to, from, K);
 }
 
 inline BPS::REAL SubtractMin(BPS::REAL *D, int K)
 {
-    int k;
     BPS::REAL delta;
 	
-    delta = D[0];
-    for (k=1; k<K; k++) TRUNCATE(delta, D[k]);
-    for (k=0; k<K; k++) D[k] -= delta;
+    delta = VecMin(D, K);
+    VecSubtract(D, delta, K);
 
     return delta;
 }
@@ -71,9 +63,15 @@ inline BPS::REAL SubtractMin(BPS::REAL *D, int K)
 
 inline BPS::REAL UpdateMessageL1(BPS::REAL* M, BPS::REAL* Di_hat, int K, BPS::REAL gamma, MRF::CostVal lambda, MRF::CostVal smoothMax)
 {
-    int k;
     BPS::REAL delta;
 
+#ifdef __AVX2__
+    delta = VecDiffMin(M, Di_hat, M, gamma, K);
+    VecDistanceL1(M, (BPS::REAL)lambda, delta, (BPS::REAL)(lambda*smoothMax), K);
+#else
+    /* one pass for the difference, its minimum and the forward scan */
+    int k;
+
     delta = M[0] = gamma*Di_hat[0] - M[0];
     for (k=1; k<K; k++)
 	{
@@ -90,6 +88,7 @@ inline BPS::REAL UpdateMessageL1(BPS::REAL* M, BPS::REAL* Di_hat, int K, BPS::RE
 	    TRUNCATE(M[k], M[k+1] + lambda);
 	    TRUNCATE(M[k], lambda*smoothMax);
 	}
+#endif
 
     return delta;
 }
@@ -112,13 +111,7 @@ inline BPS::REAL UpdateMessageL2(BPS::REAL* M, BPS::REAL* Di_hat, int K, BPS::RE
 
     assert(lambda >= 0);
 
-    Di[0] = gamma*Di_hat[0] - M[0];
-    delta = Di[0];
-    for (k=1; k<K; k++)
-	{
-	    Di[k] = gamma*Di_hat[k] - M[k];
-	    TRUNCATE(delta, Di[k]);
-	}
+    delta = VecDiffMin(Di, Di_hat, M, gamma, K);
 
     if (lambda == 0)
 	{
@@ -130,11 +123,7 @@ inline BPS::REAL UpdateMessageL2(BPS::REAL* M, BPS::REAL* Di_hat, int K, BPS::RE
     tmp->DistanceTransformL2(K, 1, lambda, Di_tmp, M_tmp, parabolas, intersections);
     for (k=0; k<K; k++) M[k] = (BPS::REAL) M_tmp[k];
 
-    for (k=0; k<K; k++)
-	{
-	    M[k] -= delta;
-	    TRUNCATE(M[k], lambda*smoothMax);
-	}
+    VecSubtractTruncate(M, delta, (BPS::REAL)(lambda*smoothMax), K);
 
     return delta;
 }
@@ -147,30 +136,16 @@ inline BPS::REAL UpdateMessageL2(BPS::REAL* M, BPS::REAL* Di_hat, int K, BPS::RE
 inline BPS::REAL UpdateMessageFIXED_MATRIX(BPS::REAL* M, BPS::REAL* Di_hat, int K, BPS::REAL gamma, MRF::CostVal lambda, MRF::CostVal* V, void* buf)
 {
     BPS::REAL* Di = (BPS::REAL*) buf;
-    int ki, kj;
-    BPS::REAL delta;
+    int kj;
 
-    for (ki=0; ki<K; ki++)
-	{
-	    Di[ki] = gamma*Di_hat[ki] - M[ki];
-	}
+    VecDiffMin(Di, Di_hat, M, gamma, K);
 
-    for (kj=0; kj<K; kj++)
+    for (kj=0; kj<K; kj++, V+=K)
 	{
-	    M[kj] = Di[0] + lambda*V[0]; 
-	    V ++;
-	    for (ki=1; ki<K; ki++)
-		{
-		    TRUNCATE(M[kj], Di[ki] + lambda*V[0]);
-		    V ++;
-		}
+	    M[kj] = VecMinSum(Di, V, (BPS::REAL)lambda, K);
 	}
 
-    delta = M[0];
-    for (kj=1; kj<K; kj++) TRUNCATE(delta, M[kj]);
-    for (kj=0; kj<K; kj++) M[kj] -= delta;
-
-    return delta;
+    return SubtractMin(M, K);
 }
 
 /////////////////////////////////////////////
@@ -181,24 +156,14 @@ inline BPS::REAL UpdateMessageGENERAL(BPS::REAL* M, BPS::REAL* Di_hat, int K, BP
 {
     BPS::REAL* Di = (BPS::REAL*) buf;
     int ki, kj;
-    BPS::REAL delta;
 
-    for (ki=0; ki<K; ki++)
-	{
-	    Di[ki] = (gamma*Di_hat[ki] - M[ki]);
-	}
+    VecDiffMin(Di, Di_hat, M, gamma, K);
 
     if (dir == 0)
 	{
-	    for (kj=0; kj<K; kj++)
+	    for (kj=0; kj<K; kj++, V+=K)
 		{
-		    M[kj] = Di[0] + V[0]; 
-		    V ++;
-		    for (ki=1; ki<K; ki++)
-			{
-			    TRUNCATE(M[kj], Di[ki] + V[0]);
-			    V ++;
-			}
+		    M[kj] = VecMinSum(Di, V, (BPS::REAL)1, K);
 		}
 	}
     else
@@ -216,11 +181,7 @@ inline BPS::REAL UpdateMessageGENERAL(BPS::REAL* M, BPS::REAL* Di_hat, int K, BP
 		}
 	}
 
-    delta = M[0];
-    for (kj=1; kj<K; kj++) TRUNCATE(delta, M[kj]);
-    for (kj=0; kj<K; kj++) M[kj] -= delta;
-
-    return delta;
+    return SubtractMin(M, K);
 }
 
 inline BPS::REAL UpdateMessageGENERAL(BPS::REAL* M, BPS::REAL* Di_hat, int K, BPS::REAL gamma, BPS::SmoothCostGeneralFn fn, int i, int j, void* buf)
@@ -293,6 +254,7 @@ void BPS::Allocate()
     m_DBinary = NULL;
     m_messages = NULL;
     m_messageArraySizeInBytes = 0;
+    m_parallel = false;
 
     m_answer = new Label[m_nPixels];
 }
@@ -562,7 +524,11 @@ void BPS::optimizeAlg(int nIterations)
     //          computing solution                //
     ////////////////////////////////////////////////
 
-    if (m_type != BINARY)
+    if (useCheckerboard())
+	{
+	    computeSolutionCheckerboard();
+	}
+    else if (m_type != BINARY)
 	{
 	    int x, y, n, K = m_nLabels;
 	    CostVal* D_ptr;
@@ -690,366 +656,404 @@ void BPS::optimizeAlg(int nIterations)
 	}
 }
 
-void BPS::optimize_GRID_L1(int nIterations)
+/////////////////////////////////////////////////////////////////////////////
+//                  Schedules of the message updates                       //
+/////////////////////////////////////////////////////////////////////////////
+
+bool BPS::useCheckerboard()
 {
-    int x, y, n, K = m_nLabels;
-    CostVal* D_ptr;
-    REAL* M_ptr;
-    REAL* Di;
+    return m_parallel && parallel_threads() > 1;
+}
 
-    Di = new REAL[K];
+void BPS::setParallel(bool PARALLEL)
+{
+    m_parallel = PARALLEL;
+}
 
-    for ( ; nIterations > 0; nIterations --)
-	{
-	    // forward pass
-	    n = 0;
-	    D_ptr = m_D;
-	    M_ptr = m_messages;
+// One iteration. pixel(x, y, n, Di, buf, edges) computes the belief Di of pixel (x,y) and
+// updates its messages selected by edges; Di (K values) and buf (bufSize bytes) are
+// scratch arrays of the calling thread.
+//
+// Sequentially, a forward pass in raster order updates the messages to the right and
+// lower neighbors, and a backward pass in reverse order those to the left and upper ones.
+// On a checkerboard, first all pixels with even x+y and then all with odd x+y update
+// the messages to all 4 neighbors. Pixels of one color are never adjacent, so each color
+// runs in parallel, and afterwards every message goes from a pixel of odd x+y to one
+// of even x+y.
+template <class Pixel> void BPS::iterate(int bufSize, Pixel& pixel)
+{
+    int K = m_nLabels;
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, D_ptr+=K, M_ptr+=2*K, n++)
+    if (useCheckerboard())
+	{
+	    for (int color=0; color<2; color++)
+		parallel_for(0, m_height, 0, [&](long first, long last)
 		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
-
-			if (x < m_width-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n] : m_lambda;
-				UpdateMessageL1(M_ptr, Di, K, 1, lambda, m_smoothMax);
-			    }
-			if (y < m_height-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n] : m_lambda;
-				UpdateMessageL1(M_ptr+K, Di, K, 1, lambda, m_smoothMax);
-			    }
-		    }
+			REAL* Di = new REAL[K];
+			char* buf = new char[(bufSize > 0) ? bufSize : 1];
+			for (int y=(int)first; y<last; y++)
+			    for (int x=(y+color)%2; x<m_width; x+=2)
+				pixel(x, y, x+y*m_width, Di, buf, BPS_FORWARD | BPS_BACKWARD);
+			delete [] Di;
+			delete [] buf;
+		    });
+	    return;
+	}
 
-	    // backward pass
-	    n --;
-	    D_ptr -= K;
-	    M_ptr -= 2*K;
+    REAL* Di = new REAL[K];
+    char* buf = new char[(bufSize > 0) ? bufSize : 1];
+    int x, y;
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, D_ptr-=K, M_ptr-=2*K, n--)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+    // forward pass
+    for (y=0; y<m_height; y++)
+	for (x=0; x<m_width; x++) pixel(x, y, x+y*m_width, Di, buf, BPS_FORWARD);
 
-			SubtractMin(Di, K);
-
-			if (x > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n-1] : m_lambda;
-				UpdateMessageL1(M_ptr-2*K, Di, K, 1, lambda, m_smoothMax);
-			    }
-			if (y > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n-m_width] : m_lambda;
-				UpdateMessageL1(M_ptr-(2*m_width-1)*K, Di, K, 1, lambda, m_smoothMax);
-			    }
-		    }
-	}
+    // backward pass
+    for (y=m_height-1; y>=0; y--)
+	for (x=m_width-1; x>=0; x--) pixel(x, y, x+y*m_width, Di, buf, BPS_BACKWARD);
 
     delete [] Di;
+    delete [] buf;
 }
 
-void BPS::optimize_GRID_L2(int nIterations)
+// Labels after checkerboard iterations. The pixels of even x+y get all their incoming
+// messages and take the minimum of their beliefs; the pixels of odd x+y then take the
+// best label given the labels of their 4 neighbors.
+void BPS::computeSolutionCheckerboard()
 {
-    int x, y, n, K = m_nLabels;
-    CostVal* D_ptr;
-    REAL* M_ptr;
-    REAL* Di;
-    void* buf;
-
-    Di = new REAL[K];
-    buf = new char[2*K*sizeof(TypeTruncatedQuadratic2D::REAL) + (2*K+1)*sizeof(int) + K*sizeof(REAL)];
+    int K = m_nLabels;
 
-    for ( ; nIterations > 0; nIterations --)
+    auto belief = [&](int x, int y, int n, REAL* Di)
 	{
-	    // forward pass
-	    n = 0;
-	    D_ptr = m_D;
-	    M_ptr = m_messages;
+	    int ki;
+	    Label label = 0;
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, D_ptr+=K, M_ptr+=2*K, n++)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+	    if (m_type == BINARY)
+		{
+		    REAL* M_ptr = m_messages + 2*n;
+		    REAL D = m_DBinary[n];
+		    if (x > 0) D += M_ptr[-2]; // message (x-1,y)->(x,y)
+		    if (y > 0) D += M_ptr[-2*m_width+1]; // message (x,y-1)->(x,y)
+		    if (x < m_width-1) D += M_ptr[0]; // message (x+1,y)->(x,y)
+		    if (y < m_height-1) D += M_ptr[1]; // message (x,y+1)->(x,y)
+		    return (Label) ((D >= 0) ? 0 : 1);
+		}
 
-			if (x < m_width-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n] : m_lambda;
-				UpdateMessageL2(M_ptr, Di, K, 1, lambda, m_smoothMax, buf);
-			    }
-			if (y < m_height-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n] : m_lambda;
-				UpdateMessageL2(M_ptr+K, Di, K, 1, lambda, m_smoothMax, buf);
-			    }
-		    }
+	    REAL* M_ptr = m_messages + 2*n*K;
 
-	    // backward pass
-	    n --;
-	    D_ptr -= K;
-	    M_ptr -= 2*K;
+	    CopyVector(Di, m_D + n*K, K);
+	    if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, D_ptr-=K, M_ptr-=2*K, n--)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+	    for (ki=1; ki<K; ki++) if (Di[label] > Di[ki]) label = ki;
+	    return label;
+	};
 
-			SubtractMin(Di, K);
+    auto conditional = [&](int x, int y, int n, REAL* Di)
+	{
+	    int ki;
+	    Label label = 0;
 
-			if (x > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n-1] : m_lambda;
-				UpdateMessageL2(M_ptr-2*K, Di, K, 1, lambda, m_smoothMax, buf);
-			    }
-			if (y > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n-m_width] : m_lambda;
-				UpdateMessageL2(M_ptr-(2*m_width-1)*K, Di, K, 1, lambda, m_smoothMax, buf);
-			    }
-		    }
-	}
+	    if (m_type == BINARY)
+		{
+		    REAL D = m_DBinary[n];
+		    if (x > 0) D += (m_answer[n-1] == 0)       ? m_horzWeightsBinary[n-1]       : -m_horzWeightsBinary[n-1];
+		    if (y > 0) D += (m_answer[n-m_width] == 0) ? m_vertWeightsBinary[n-m_width] : -m_vertWeightsBinary[n-m_width];
+		    if (x < m_width-1)  D += (m_answer[n+1] == 0)       ? m_horzWeightsBinary[n] : -m_horzWeightsBinary[n];
+		    if (y < m_height-1) D += (m_answer[n+m_width] == 0) ? m_vertWeightsBinary[n] : -m_vertWeightsBinary[n];
+		    return (Label) ((D >= 0) ? 0 : 1);
+		}
 
-    delete [] Di;
-    delete [] (REAL *)buf;
-}
+	    // adds the smoothness costs to neighbor m with its label fixed. V_ptr is the
+	    // cost array of the edge if m_type == GENERAL, for which m comes first if before
+	    auto add = [&](int m, CostVal weight, CostVal* V_ptr, bool before)
+		{
+		    int kj = m_answer[m];
+		    for (ki=0; ki<K; ki++)
+			{
+			    if (m_type != GENERAL) Di[ki] += weight*m_V[kj*K + ki];
+			    else if (m_V)          Di[ki] += (before) ? V_ptr[kj + ki*K] : V_ptr[kj*K + ki];
+			    else                   Di[ki] += m_smoothFn(n, m, ki, kj);
+			}
+		};
 
+	    CopyVector(Di, m_D + n*K, K);
+	    if (x > 0)          add(n-1,       (m_varWeights) ? m_horzWeights[n-1] : 1,       m_V + 2*(n-1)*K*K,         true);
+	    if (y > 0)          add(n-m_width, (m_varWeights) ? m_vertWeights[n-m_width] : 1, m_V + (2*(n-m_width)+1)*K*K, true);
+	    if (x < m_width-1)  add(n+1,       (m_varWeights) ? m_horzWeights[n] : 1,         m_V + 2*n*K*K,             false);
+	    if (y < m_height-1) add(n+m_width, (m_varWeights) ? m_vertWeights[n] : 1,         m_V + (2*n+1)*K*K,         false);
 
-void BPS::optimize_GRID_BINARY(int nIterations)
+	    for (ki=1; ki<K; ki++) if (Di[label] > Di[ki]) label = ki;
+	    return label;
+	};
+
+    for (int color=0; color<2; color++)
+	parallel_for(0, m_height, 0, [&](long first, long last)
+	    {
+		REAL* Di = new REAL[K];
+		for (int y=(int)first; y<last; y++)
+		    for (int x=(y+color)%2; x<m_width; x+=2)
+			{
+			    int n = x+y*m_width;
+			    m_answer[n] = (color == 0) ? belief(x, y, n, Di) : conditional(x, y, n, Di);
+			}
+		delete [] Di;
+	    });
+}
+
+void BPS::optimize_GRID_L1(int nIterations)
 {
-    int x, y, n;
-    REAL* M_ptr;
-    REAL Di;
+    int K = m_nLabels;
 
-    for ( ; nIterations > 0; nIterations --)
+    auto pixel = [&](int x, int y, int n, REAL* Di, void* /*buf*/, int edges)
 	{
-	    // forward pass
-	    n = 0;
-	    M_ptr = m_messages;
+	    CostVal* D_ptr = m_D + n*K;
+	    REAL* M_ptr = m_messages + 2*n*K;
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, M_ptr+=2, n++)
-		    {
-			Di = m_DBinary[n];
-			if (x > 0) Di += M_ptr[-2]; // message (x-1,y)->(x,y)
-			if (y > 0) Di += M_ptr[-2*m_width+1]; // message (x,y-1)->(x,y)
-			if (x < m_width-1) Di += M_ptr[0]; // message (x+1,y)->(x,y)
-			if (y < m_height-1) Di += M_ptr[1]; // message (x,y+1)->(x,y)
-
-			REAL DiScaled = Di * 1;
-			if (x < m_width-1) 
-			    {
-				Di = DiScaled - M_ptr[0];
-				CostVal lambda = m_horzWeightsBinary[n];
-				if (lambda < 0) { Di = -Di; lambda = -lambda; }
-				if (Di > lambda) M_ptr[0] = lambda;
-				else             M_ptr[0] = (Di < -lambda) ? -lambda : Di;
-			    }
-			if (y < m_height-1) 
-			    {
-				Di = DiScaled - M_ptr[1];
-				CostVal lambda = m_vertWeightsBinary[n];
-				if (lambda < 0) { Di = -Di; lambda = -lambda; }
-				if (Di > lambda) M_ptr[1] = lambda;
-				else             M_ptr[1] = (Di < -lambda) ? -lambda : Di;
-			    }
-		    }
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
 
-	    // backward pass
-	    n --;
-	    M_ptr -= 2;
+	    if (edges & BPS_BACKWARD) SubtractMin(Di, K);
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, M_ptr-=2, n--)
-		    {
-			Di = m_DBinary[n];
-			if (x > 0) Di += M_ptr[-2]; // message (x-1,y)->(x,y)
-			if (y > 0) Di += M_ptr[-2*m_width+1]; // message (x,y-1)->(x,y)
-			if (x < m_width-1) Di += M_ptr[0]; // message (x+1,y)->(x,y)
-			if (y < m_height-1) Di += M_ptr[1]; // message (x,y+1)->(x,y)
+	    if (edges & BPS_FORWARD)
+		{
+		    if (x < m_width-1) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n] : m_lambda;
+			    UpdateMessageL1(M_ptr, Di, K, 1, lambda, m_smoothMax);
+			}
+		    if (y < m_height-1) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n] : m_lambda;
+			    UpdateMessageL1(M_ptr+K, Di, K, 1, lambda, m_smoothMax);
+			}
+		}
+	    if (edges & BPS_BACKWARD)
+		{
+		    if (x > 0) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n-1] : m_lambda;
+			    UpdateMessageL1(M_ptr-2*K, Di, K, 1, lambda, m_smoothMax);
+			}
+		    if (y > 0) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n-m_width] : m_lambda;
+			    UpdateMessageL1(M_ptr-(2*m_width-1)*K, Di, K, 1, lambda, m_smoothMax);
+			}
+		}
+	};
 
-			REAL DiScaled = Di * 1;
-			if (x > 0) 
-			    {
-				Di = DiScaled - M_ptr[-2];
-				CostVal lambda = m_horzWeightsBinary[n-1];
-				if (lambda < 0) { Di = -Di; lambda = -lambda; }
-				if (Di > lambda) M_ptr[-2] = lambda;
-				else             M_ptr[-2] = (Di < -lambda) ? -lambda : Di;
-			    }
-			if (y > 0) 
-			    {
-				Di = DiScaled - M_ptr[-2*m_width+1];
-				CostVal lambda = m_vertWeightsBinary[n-m_width];
-				if (lambda < 0) { Di = -Di; lambda = -lambda; }
-				if (Di > lambda) M_ptr[-2*m_width+1] = lambda;
-				else             M_ptr[-2*m_width+1] = (Di < -lambda) ? -lambda : Di;
-			    }
-		    }
-	}
+    for ( ; nIterations > 0; nIterations --) iterate(0, pixel);
 }
 
-void BPS::optimize_GRID_FIXED_MATRIX(int nIterations)
+void BPS::optimize_GRID_L2(int nIterations)
 {
-    int x, y, n, K = m_nLabels;
-    CostVal* D_ptr;
-    REAL* M_ptr;
-    REAL* Di;
-    void* buf;
+    int K = m_nLabels;
+    int bufSize = 2*K*sizeof(TypeTruncatedQuadratic2D::REAL) + (2*K+1)*sizeof(int) + K*sizeof(REAL);
 
-    Di = new REAL[K];
-    buf = new REAL[K];
-
-    for ( ; nIterations > 0; nIterations --)
+    auto pixel = [&](int x, int y, int n, REAL* Di, void* buf, int edges)
 	{
-	    // forward pass
-	    n = 0;
-	    D_ptr = m_D;
-	    M_ptr = m_messages;
+	    CostVal* D_ptr = m_D + n*K;
+	    REAL* M_ptr = m_messages + 2*n*K;
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, D_ptr+=K, M_ptr+=2*K, n++)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
 
-			if (x < m_width-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_horzWeights[n] : 1;
-				UpdateMessageFIXED_MATRIX(M_ptr, Di, K, 1, lambda, m_V, buf);
-			    }
-			if (y < m_height-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_vertWeights[n] : 1;
-				UpdateMessageFIXED_MATRIX(M_ptr+K, Di, K, 1, lambda, m_V, buf);
-			    }
-		    }
+	    if (edges & BPS_BACKWARD) SubtractMin(Di, K);
 
-	    // backward pass
-	    n --;
-	    D_ptr -= K;
-	    M_ptr -= 2*K;
+	    if (edges & BPS_FORWARD)
+		{
+		    if (x < m_width-1) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n] : m_lambda;
+			    UpdateMessageL2(M_ptr, Di, K, 1, lambda, m_smoothMax, buf);
+			}
+		    if (y < m_height-1) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n] : m_lambda;
+			    UpdateMessageL2(M_ptr+K, Di, K, 1, lambda, m_smoothMax, buf);
+			}
+		}
+	    if (edges & BPS_BACKWARD)
+		{
+		    if (x > 0) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n-1] : m_lambda;
+			    UpdateMessageL2(M_ptr-2*K, Di, K, 1, lambda, m_smoothMax, buf);
+			}
+		    if (y > 0) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n-m_width] : m_lambda;
+			    UpdateMessageL2(M_ptr-(2*m_width-1)*K, Di, K, 1, lambda, m_smoothMax, buf);
+			}
+		}
+	};
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, D_ptr-=K, M_ptr-=2*K, n--)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+    for ( ; nIterations > 0; nIterations --) iterate(bufSize, pixel);
+}
 
-			SubtractMin(Di, K);
 
-			if (x > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_horzWeights[n-1] : 1;
-				UpdateMessageFIXED_MATRIX(M_ptr-2*K, Di, K, 1, lambda, m_V, buf);
-			    }
-			if (y > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_vertWeights[n-m_width] : 1;
-				UpdateMessageFIXED_MATRIX(M_ptr-(2*m_width-1)*K, Di, K, 1, lambda, m_V, buf);
-			    }
-		    }
-	}
+void BPS::optimize_GRID_BINARY(int nIterations)
+{
+    auto pixel = [&](int x, int y, int n, REAL* /*Di*/, void* /*buf*/, int edges)
+	{
+	    REAL* M_ptr = m_messages + 2*n;
+	    REAL Di;
 
-    delete [] Di;
-    delete [] (REAL *)buf;
+	    Di = m_DBinary[n];
+	    if (x > 0) Di += M_ptr[-2]; // message (x-1,y)->(x,y)
+	    if (y > 0) Di += M_ptr[-2*m_width+1]; // message (x,y-1)->(x,y)
+	    if (x < m_width-1) Di += M_ptr[0]; // message (x+1,y)->(x,y)
+	    if (y < m_height-1) Di += M_ptr[1]; // message (x,y+1)->(x,y)
+
+	    REAL DiScaled = Di * 1;
+	    if (edges & BPS_FORWARD)
+		{
+		    if (x < m_width-1) 
+			{
+			    Di = DiScaled - M_ptr[0];
+			    CostVal lambda = m_horzWeightsBinary[n];
+			    if (lambda < 0) { Di = -Di; lambda = -lambda; }
+			    if (Di > lambda) M_ptr[0] = lambda;
+			    else             M_ptr[0] = (Di < -lambda) ? -lambda : Di;
+			}
+		    if (y < m_height-1) 
+			{
+			    Di = DiScaled - M_ptr[1];
+			    CostVal lambda = m_vertWeightsBinary[n];
+			    if (lambda < 0) { Di = -Di; lambda = -lambda; }
+			    if (Di > lambda) M_ptr[1] = lambda;
+			    else             M_ptr[1] = (Di < -lambda) ? -lambda : Di;
+			}
+		}
+	    if (edges & BPS_BACKWARD)
+		{
+		    if (x > 0) 
+			{
+			    Di = DiScaled - M_ptr[-2];
+			    CostVal lambda = m_horzWeightsBinary[n-1];
+			    if (lambda < 0) { Di = -Di; lambda = -lambda; }
+			    if (Di > lambda) M_ptr[-2] = lambda;
+			    else             M_ptr[-2] = (Di < -lambda) ? -lambda : Di;
+			}
+		    if (y > 0) 
+			{
+			    Di = DiScaled - M_ptr[-2*m_width+1];
+			    CostVal lambda = m_vertWeightsBinary[n-m_width];
+			    if (lambda < 0) { Di = -Di; lambda = -lambda; }
+			    if (Di > lambda) M_ptr[-2*m_width+1] = lambda;
+			    else             M_ptr[-2*m_width+1] = (Di < -lambda) ? -lambda : Di;
+			}
+		}
+	};
+
+    for ( ; nIterations > 0; nIterations --) iterate(0, pixel);
 }
 
-void BPS::optimize_GRID_GENERAL(int nIterations)
+void BPS::optimize_GRID_FIXED_MATRIX(int nIterations)
 {
-    int x, y, n, K = m_nLabels;
-    CostVal* D_ptr;
-    REAL* M_ptr;
-    REAL* Di;
-    void* buf;
+    int K = m_nLabels;
+    int bufSize = K*sizeof(REAL);
 
-    Di = new REAL[K];
-    buf = new REAL[K];
-
-    for ( ; nIterations > 0; nIterations --)
+    auto pixel = [&](int x, int y, int n, REAL* Di, void* buf, int edges)
 	{
-	    // forward pass
-	    n = 0;
-	    D_ptr = m_D;
-	    M_ptr = m_messages;
-	    CostVal* V_ptr = m_V;
+	    CostVal* D_ptr = m_D + n*K;
+	    REAL* M_ptr = m_messages + 2*n*K;
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, D_ptr+=K, M_ptr+=2*K, V_ptr+=2*K*K, n++)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
 
-			if (x < m_width-1) 
-			    {
-				if (m_V) UpdateMessageGENERAL(M_ptr, Di, K, 1, /* forward dir*/ 0, V_ptr, buf);
-				else     UpdateMessageGENERAL(M_ptr, Di, K, 1,   m_smoothFn, n, n+1,      buf);
-			    }
-			if (y < m_height-1) 
-			    {
-				if (m_V) UpdateMessageGENERAL(M_ptr+K, Di, K, 1, /* forward dir*/ 0, V_ptr+K*K, buf);
-				else     UpdateMessageGENERAL(M_ptr+K, Di, K, 1,   m_smoothFn, n, n+m_width,    buf);
-			    }
-		    }
+	    if (edges & BPS_BACKWARD) SubtractMin(Di, K);
+
+	    if (edges & BPS_FORWARD)
+		{
+		    if (x < m_width-1) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_horzWeights[n] : 1;
+			    UpdateMessageFIXED_MATRIX(M_ptr, Di, K, 1, lambda, m_V, buf);
+			}
+		    if (y < m_height-1) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_vertWeights[n] : 1;
+			    UpdateMessageFIXED_MATRIX(M_ptr+K, Di, K, 1, lambda, m_V, buf);
+			}
+		}
+	    if (edges & BPS_BACKWARD)
+		{
+		    if (x > 0) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_horzWeights[n-1] : 1;
+			    UpdateMessageFIXED_MATRIX(M_ptr-2*K, Di, K, 1, lambda, m_V, buf);
+			}
+		    if (y > 0) 
+			{
+			    CostVal lambda = (m_varWeights) ? m_vertWeights[n-m_width] : 1;
+			    UpdateMessageFIXED_MATRIX(M_ptr-(2*m_width-1)*K, Di, K, 1, lambda, m_V, buf);
+			}
+		}
+	};
 
-	    // backward pass
-	    n --;
-	    D_ptr -= K;
-	    M_ptr -= 2*K;
-	    V_ptr -= 2*K*K;
+    for ( ; nIterations > 0; nIterations --) iterate(bufSize, pixel);
+}
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, D_ptr-=K, M_ptr-=2*K, V_ptr-=2*K*K, n--)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+void BPS::optimize_GRID_GENERAL(int nIterations)
+{
+    int K = m_nLabels;
+    int bufSize = K*sizeof(REAL);
 
-			// normalize Di, update lower bound
-			SubtractMin(Di, K);
+    auto pixel = [&](int x, int y, int n, REAL* Di, void* buf, int edges)
+	{
+	    CostVal* D_ptr = m_D + n*K;
+	    REAL* M_ptr = m_messages + 2*n*K;
+	    CostVal* V_ptr = m_V + 2*n*K*K;
 
-			if (x > 0) 
-			    {
-				if (m_V) UpdateMessageGENERAL(M_ptr-2*K, Di, K, 1, /* backward dir */ 1, V_ptr-2*K*K, buf);
-				else     UpdateMessageGENERAL(M_ptr-2*K, Di, K, 1,   m_smoothFn, n, n-1,              buf);
-			    }
-			if (y > 0)
-			    {
-				if (m_V) UpdateMessageGENERAL(M_ptr-(2*m_width-1)*K, Di, K, 1, /* backward dir */ 1, V_ptr-(2*m_width-1)*K*K, buf);
-				else     UpdateMessageGENERAL(M_ptr-(2*m_width-1)*K, Di, K, 1,   m_smoothFn, n, n-m_width,                    buf);
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
 
-			    }
-		    }
-	}
+	    // normalize Di
+	    if (edges & BPS_BACKWARD) SubtractMin(Di, K);
 
-    delete [] Di;
-    delete [] (REAL *)buf;
+	    if (edges & BPS_FORWARD)
+		{
+		    if (x < m_width-1) 
+			{
+			    if (m_V) UpdateMessageGENERAL(M_ptr, Di, K, 1, /* forward dir*/ 0, V_ptr, buf);
+			    else     UpdateMessageGENERAL(M_ptr, Di, K, 1,   m_smoothFn, n, n+1,      buf);
+			}
+		    if (y < m_height-1) 
+			{
+			    if (m_V) UpdateMessageGENERAL(M_ptr+K, Di, K, 1, /* forward dir*/ 0, V_ptr+K*K, buf);
+			    else     UpdateMessageGENERAL(M_ptr+K, Di, K, 1,   m_smoothFn, n, n+m_width,    buf);
+			}
+		}
+	    if (edges & BPS_BACKWARD)
+		{
+		    if (x > 0) 
+			{
+			    if (m_V) UpdateMessageGENERAL(M_ptr-2*K, Di, K, 1, /* backward dir */ 1, V_ptr-2*K*K, buf);
+			    else     UpdateMessageGENERAL(M_ptr-2*K, Di, K, 1,   m_smoothFn, n, n-1,              buf);
+			}
+		    if (y > 0)
+			{
+			    if (m_V) UpdateMessageGENERAL(M_ptr-(2*m_width-1)*K, Di, K, 1, /* backward dir */ 1, V_ptr-(2*m_width-1)*K*K, buf);
+			    else     UpdateMessageGENERAL(M_ptr-(2*m_width-1)*K, Di, K, 1,   m_smoothFn, n, n-m_width,                    buf);
+			}
+		}
+	};
+
+    for ( ; nIterations > 0; nIterations --) iterate(bufSize, pixel);
 }
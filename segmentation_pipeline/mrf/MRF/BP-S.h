@@ -7,6 +7,8 @@
 #include <assert.h>
 #include "mrf.h"
 
+#define BPS_FORWARD  1 /* a pixel updates its messages to the right and lower neighbors */
+#define BPS_BACKWARD 2 /* a pixel updates its messages to the left and upper neighbors */
 
 class BPS : public MRF{
  public:
@@ -24,6 +26,13 @@ class BPS : public MRF{
     EnergyVal smoothnessEnergy();
     EnergyVal dataEnergy();
 
+    // Call this function with argument 1 to replace the sequential forward and backward
+    // passes on a grid by checkerboard iterations on the threads of the pipeline's pool
+    // (parallel.h): all pixels with even x+y update their messages at once, then all pixels
+    // with odd x+y. Messages then spread more slowly than with sequential passes, so more
+    // iterations may be needed. Has no effect with only one thread.
+    void setParallel(bool PARALLEL);
+
  protected:
     void setData(DataCostFn dcost); 
     void setData(CostVal* data);    
@@ -74,6 +83,11 @@ class BPS : public MRF{
     void optimize_GRID_FIXED_MATRIX(int nIterations);
     void optimize_GRID_GENERAL(int nIterations);
     void optimize_GRID_BINARY(int nIterations);
+
+    bool m_parallel;
+    bool useCheckerboard();
+    template <class Pixel> void iterate(int bufSize, Pixel& pixel);
+    void computeSolutionCheckerboard();
 };
 
 #endif /*  __BPS_H__ */
@@ -1,10 +1,14 @@
 #include "energy.h"
 #include "graph.h"
 #include "GCoptimization.h"
+#include "parallel.h"
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
 #include "string.h"
+#include <math.h>
+#include <algorithm>
+#include <vector>
 #define MAX_INTT 1000000000
 
 
@@ -16,11 +20,15 @@ void GCoptimization::initialize_memory()
 
     m_lookupPixVar = (PixelType *) new PixelType[m_nPixels];
     m_labelTable   = (LabelType *) new LabelType[m_nLabels];
+    m_labelActive  = new char[m_nLabels];
 
-    terminateOnError( !m_lookupPixVar || !m_labelTable ,"Not enough memory");
+    terminateOnError( !m_lookupPixVar || !m_labelTable || !m_labelActive ,"Not enough memory");
 
     for ( int i = 0; i < m_nLabels; i++ )
+    {
         m_labelTable[i] = i;
+        m_labelActive[i] = 1;
+    }
 }
 
 /**************************************************************************************/
@@ -60,7 +68,7 @@ void GCoptimization::commonNonGridInitialization(PixelType nupixels, int num_lab
     m_nPixels        = nupixels;
     m_grid_graph         = 0;
 
-    m_neighbors = (LinkedBlockList *) new LinkedBlockList[nupixels];
+    m_neighbors = new NeighborSystem<EnergyTermType>(nupixels);
 
     terminateOnError(!m_neighbors,"Not enough memory");
 
@@ -72,6 +80,17 @@ void GCoptimization::commonInitialization()
 {
     m_needToFreeV        = 0;
     m_random_label_order = 1;
+    m_grid_graph_cut     = 1;
+    m_energyValid        = false;
+    m_relativeDecrease   = 0;
+    m_maxSeconds         = 0;
+    m_startTime          = 0;
+    m_converged          = false;
+    m_activeLabels       = 0;
+    m_labelsSkipped      = false;
+    m_smoothModel        = SMOOTH_ARRAY;
+    m_smoothLambda       = 0;
+    m_smoothMax          = 0;
     initialize_memory();
 }
 
@@ -146,6 +165,35 @@ void GCoptimization::setSmoothness(int smoothExp,CostVal smoothMax, CostVal lamb
             m_smoothcost[i*m_nLabels + j] = m_smoothcost[j*m_nLabels + i] = cost*lambda;
         }
 
+    m_smoothModel  = (smoothExp == 1) ? SMOOTH_TRUNCATED_LINEAR : SMOOTH_TRUNCATED_QUADRATIC;
+    m_smoothLambda = lambda;
+    m_smoothMax    = smoothMax;
+}
+
+/**************************************************************************************/
+/* Picks the smoothness model of setSmoothness() that the moves are built with, see   */
+/* smoothness.h. Any smoothness array that is Potts, including a truncated one with   */
+/* smoothMax 1, is built as Potts                                                     */
+
+void GCoptimization::initializeAlg()
+{
+    if ( m_smoothType == FUNCTION ) { m_smoothModel = SMOOTH_FUNCTION; return; }
+    if ( m_smoothType == ARRAY ) m_smoothModel = SMOOTH_ARRAY;
+
+    if ( m_nLabels < 2 ) return;
+
+    EnergyTermType lambda = m_smoothcost(0,1);
+    bool potts = lambda >= 0;
+
+    for ( int i = 0; i < m_nLabels && potts; i++ )
+        for ( int j = 0; j < m_nLabels; j++ )
+            if ( m_smoothcost(i,j) != ((i == j) ? 0 : lambda) ) { potts = false; break; }
+
+    if ( potts )
+    {
+        m_smoothModel  = SMOOTH_POTTS;
+        m_smoothLambda = lambda;
+    }
 }
 
 /**************************************************************************************/
@@ -228,6 +276,91 @@ GCoptimization::EnergyType GCoptimization::smoothnessEnergy()
 
 /**************************************************************************************/
 
+GCoptimization::EnergyType GCoptimization::compute_energy()
+{
+    if ( m_energyValid ) return(m_energy);
+
+    double start = wallClock();
+    m_energy = dataEnergy()+smoothnessEnergy();
+    m_energyValid = true;
+
+    addEnergyStats(wallClock()-start);
+    return(m_energy);
+}
+
+/**************************************************************************************/
+
+GCoptimization::EnergyVal GCoptimization::totalEnergy()
+{
+    if (!isValid()) { fprintf(stderr, "totalEnergy() cannot be called for invalid energy!\n"); exit(1); }
+    if (!m_initialized) { fprintf(stderr, "Call initialize() first!\n"); exit(1); }
+
+    return(compute_energy());
+}
+
+/**************************************************************************************/
+/* The pairs of pixels are passed to pair_cost() in the order of the smoothnessEnergy() */
+/* functions, so the change is exact for smoothness functions that are not symmetric    */
+
+GCoptimization::EnergyType GCoptimization::relabel(PixelType pix,LabelType label)
+{
+    LabelType old_label = m_labeling[pix];
+    EnergyType delta;
+    Neighbor *n;
+    PixelType nPix;
+    EnergyTermType weight;
+
+    m_labeling[pix] = label;
+    if ( !m_energyValid || label == old_label ) return(0);
+
+    if ( m_dataType == ARRAY ) delta = m_datacost(pix,label) - m_datacost(pix,old_label);
+    else delta = m_dataFnPix(pix,label) - m_dataFnPix(pix,old_label);
+
+    if ( m_grid_graph )
+    {
+        int x = pix % m_width, y = pix / m_width;
+
+        if ( x > 0 )
+        {
+            nPix = pix - 1;
+            weight = m_varWeights ? m_horizWeights[nPix] : 1;
+            delta += pair_cost(pix,nPix,label,m_labeling[nPix],weight) - pair_cost(pix,nPix,old_label,m_labeling[nPix],weight);
+        }
+        if ( x < m_width - 1 )
+        {
+            nPix = pix + 1;
+            weight = m_varWeights ? m_horizWeights[pix] : 1;
+            delta += pair_cost(nPix,pix,m_labeling[nPix],label,weight) - pair_cost(nPix,pix,m_labeling[nPix],old_label,weight);
+        }
+        if ( y > 0 )
+        {
+            nPix = pix - m_width;
+            weight = m_varWeights ? m_vertWeights[nPix] : 1;
+            delta += pair_cost(pix,nPix,label,m_labeling[nPix],weight) - pair_cost(pix,nPix,old_label,m_labeling[nPix],weight);
+        }
+        if ( y < m_height - 1 )
+        {
+            nPix = pix + m_width;
+            weight = m_varWeights ? m_vertWeights[pix] : 1;
+            delta += pair_cost(nPix,pix,m_labeling[nPix],label,weight) - pair_cost(nPix,pix,m_labeling[nPix],old_label,weight);
+        }
+    }
+    else
+    {
+        for ( n = m_neighbors->begin(pix); n < m_neighbors->end(pix); n++ )
+        {
+            nPix = n -> to_node;
+            if ( pix < nPix )
+                delta += pair_cost(pix,nPix,label,m_labeling[nPix],n->weight) - pair_cost(pix,nPix,old_label,m_labeling[nPix],n->weight);
+            else delta += pair_cost(nPix,pix,m_labeling[nPix],label,n->weight) - pair_cost(nPix,pix,m_labeling[nPix],old_label,n->weight);
+        }
+    }
+
+    return(delta);
+}
+
+/**************************************************************************************/
+
 GCoptimization::EnergyType GCoptimization::giveSmoothEnergy_NG_FnPix()
 {
 
@@ -235,16 +368,13 @@ GCoptimization::EnergyType GCoptimization::giveSmoothEnergy_NG_FnPix()
     int i;
     Neighbor *temp; 
 
+    m_neighbors->build();
+
     for ( i = 0; i < m_nPixels; i++ )
-        if ( !m_neighbors[i].isEmpty() )
+        for ( temp = m_neighbors->begin(i); temp < m_neighbors->end(i); temp++ )
         {
-            m_neighbors[i].setCursorFront();
-            while ( m_neighbors[i].hasNext() )
-            {
-                temp = (Neighbor *) m_neighbors[i].next();
-                if ( i < temp->to_node )
-                    eng = eng + m_smoothFnPix(i,temp->to_node, m_labeling[i],m_labeling[temp->to_node]);
-            }
+            if ( i < temp->to_node )
+                eng = eng + m_smoothFnPix(i,temp->to_node, m_labeling[i],m_labeling[temp->to_node]);
         }
         
     return(eng);
@@ -259,18 +389,13 @@ GCoptimization::EnergyType GCoptimization::giveSmoothEnergy_NG_ARRAY()
     int i;
     Neighbor *temp; 
 
+    m_neighbors->build();
+
     for ( i = 0; i < m_nPixels; i++ )
-        if ( !m_neighbors[i].isEmpty() )
+        for ( temp = m_neighbors->begin(i); temp < m_neighbors->end(i); temp++ )
         {
-            m_neighbors[i].setCursorFront();
-            while ( m_neighbors[i].hasNext() )
-            {
-                temp = (Neighbor *) m_neighbors[i].next();
-
-                if ( i < temp->to_node )
-                    eng = eng + m_smoothcost(m_labeling[i],m_labeling[temp->to_node])*(temp->weight);
-
-            }
+            if ( i < temp->to_node )
+                eng = eng + m_smoothcost(m_labeling[i],m_labeling[temp->to_node])*(temp->weight);
         }
 
     return(eng);
@@ -359,6 +484,53 @@ GCoptimization::EnergyType GCoptimization::giveSmoothEnergy_G_FnPix()
 
 
 
+/**************************************************************************************/
+
+void GCoptimization::setConvergence(double relative_decrease, double max_seconds)
+{
+    m_relativeDecrease = relative_decrease;
+    m_maxSeconds       = max_seconds;
+}
+
+/**************************************************************************************/
+
+void GCoptimization::setActiveLabels(bool ACTIVE_LABELS)
+{
+    m_activeLabels = ACTIVE_LABELS;
+}
+
+/**************************************************************************************/
+
+void GCoptimization::start_iterations()
+{
+    m_startTime = wallClock();
+    m_converged = false;
+    m_labelsSkipped = false;
+    for ( int i = 0; i < m_nLabels; i++ ) m_labelActive[i] = 1;
+}
+
+/**************************************************************************************/
+/* The energy has converged if an iteration lowers it by no more than m_relativeDecrease */
+/* times its value. If labels were skipped, every label gets one more chance first       */
+
+bool GCoptimization::stop_iterations(EnergyType old_energy,EnergyType new_energy)
+{
+    bool lowered = old_energy > new_energy &&
+                   (double) (old_energy - new_energy) > m_relativeDecrease*fabs((double) old_energy);
+
+    if ( !lowered && !m_labelsSkipped )
+    {
+        m_converged = true;
+        return(true);
+    }
+
+    if ( !lowered )
+        for ( int i = 0; i < m_nLabels; i++ ) m_labelActive[i] = 1;
+    m_labelsSkipped = false;
+
+    return(out_of_time());
+}
+
 /**************************************************************************************/
 
 void GCoptimization::setLabelOrder(bool RANDOM_LABEL_ORDER)
@@ -366,6 +538,22 @@ void GCoptimization::setLabelOrder(bool RANDOM_LABEL_ORDER)
     m_random_label_order = RANDOM_LABEL_ORDER;
 }
 
+/**************************************************************************************/
+
+void GCoptimization::setGridGraph(bool USE_GRID_GRAPH)
+{
+    m_grid_graph_cut = USE_GRID_GRAPH;
+}
+
+/**************************************************************************************/
+
+GCoptimization::EnergyTermType GCoptimization::pair_cost(PixelType pix,PixelType nPix,LabelType label1,
+                                                         LabelType label2,EnergyTermType weight)
+{
+    if ( m_smoothType == FUNCTION ) return(m_smoothFnPix(pix,nPix,label1,label2));
+    return(m_smoothcost(label1,label2)*weight);
+}
+
 /****************************************************************************/
 /* This procedure checks if an error has occured, terminates program if yes */
 
@@ -385,6 +573,7 @@ void GCoptimization::clearAnswer()
 {
     if (!m_labeling ) {printf("First initialize algorithm" );exit(0);}
     memset(m_labeling, 0, m_nPixels*sizeof(Label));
+    m_energyValid = false;
 }
 
 /****************************************************************************/
@@ -435,18 +624,21 @@ void GCoptimization::setNeighbors(PixelType pixel1, int pixel2, EnergyTermType w
     assert(pixel1 < m_nPixels && pixel1 >= 0 && pixel2 < m_nPixels && pixel2 >= 0);
     assert(m_grid_graph == 0);
 
-    Neighbor *temp1 = (Neighbor *) new Neighbor;
-    Neighbor *temp2 = (Neighbor *) new Neighbor;
+    m_neighbors->add(pixel1,pixel2,weight);
+    m_energyValid = false;
+}
 
-    temp1->weight  = weight;
-    temp1->to_node = pixel2;
+/**************************************************************************************/
 
-    temp2->weight  = weight;
-    temp2->to_node = pixel1;
+void GCoptimization::setNeighbors(PixelType numEdges, PixelType *pixel1, PixelType *pixel2, EnergyTermType *weights)
+{
+    assert(m_grid_graph == 0);
 
-    m_neighbors[pixel1].addFront(temp1);
-    m_neighbors[pixel2].addFront(temp2);
-    
+    for ( int i = 0; i < numEdges; i++ )
+        assert(pixel1[i] < m_nPixels && pixel1[i] >= 0 && pixel2[i] < m_nPixels && pixel2[i] >= 0);
+
+    m_neighbors->add(numEdges,pixel1,pixel2,weights);
+    m_energyValid = false;
 }
 
 /**************************************************************************************/
@@ -456,8 +648,9 @@ GCoptimization::~GCoptimization()
 
 
     delete [] m_labeling;
-    if ( ! m_grid_graph ) delete [] m_neighbors;            
+    if ( ! m_grid_graph ) delete m_neighbors;
     delete [] m_labelTable;
+    delete [] m_labelActive;
     delete [] m_lookupPixVar;
     if (m_needToFreeV) delete [] m_smoothcost;
 }
@@ -510,18 +703,19 @@ GCoptimization::EnergyType Swap::start_swap(int max_num_iterations )
     EnergyType new_energy,old_energy;
     
 
-    new_energy = dataEnergy()+smoothnessEnergy();
-
-    //old_energy = new_energy+1; // this doesn't work for large float energies
-    old_energy = -1;
+    start_iterations();
+    new_energy = compute_energy();
 
-    while (old_energy < 0 || (old_energy > new_energy  && curr_cycle <= max_num_iterations))
+    do
     {
         old_energy = new_energy;
         new_energy = oneSwapIteration();
         
         curr_cycle++;   
     }
+    while (!stop_iterations(old_energy,new_energy) && curr_cycle <= max_num_iterations);
+
+    m_iterations = curr_cycle - 1;
     //printf(" swap energy %d",new_energy);
     return(new_energy);
 }
@@ -531,18 +725,35 @@ GCoptimization::EnergyType Swap::start_swap(int max_num_iterations )
 GCoptimization::EnergyType Swap::oneSwapIteration()
 {
     int next,next1;
+    LabelType alpha_label,beta_label;
+    EnergyType energy;
+    std::vector<char> lowered(m_nLabels,0);
    
     if (m_random_label_order) scramble_label_table();
+    compute_energy();
         
 
     for (next = 0;  next < m_nLabels;  next++ )
         for (next1 = m_nLabels - 1;  next1 >= 0;  next1-- )
             if ( m_labelTable[next] < m_labelTable[next1] )
             {
-                perform_alpha_beta_swap(m_labelTable[next],m_labelTable[next1]);
+                alpha_label = m_labelTable[next];
+                beta_label  = m_labelTable[next1];
+                if ( m_activeLabels && !m_labelActive[alpha_label] && !m_labelActive[beta_label] )
+                {
+                    m_labelsSkipped = true;
+                    continue;
+                }
+                if ( out_of_time() ) return(compute_energy());
+
+                energy = m_energy;
+                perform_alpha_beta_swap(alpha_label,beta_label);
+                if ( m_energy < energy ) lowered[alpha_label] = lowered[beta_label] = 1;
             }
 
-    return(dataEnergy()+smoothnessEnergy());
+    for (next = 0; next < m_nLabels; next++ ) m_labelActive[next] = lowered[next];
+
+    return(compute_energy());
 }
 
 /**************************************************************************************/
@@ -552,7 +763,7 @@ GCoptimization::EnergyType Swap::alpha_beta_swap(LabelType alpha_label, LabelTyp
     terminateOnError( alpha_label < 0 || alpha_label >= m_nLabels || beta_label < 0 || beta_label >= m_nLabels,
         "Illegal Label to Expand On");
     perform_alpha_beta_swap(alpha_label,beta_label);
-    return(dataEnergy()+smoothnessEnergy());
+    return(compute_energy());
 }
 /**************************************************************************************/
 
@@ -585,7 +796,7 @@ void Swap::add_t_links_FnPix_swap(Energy *e,Energy::Var *variables,int size,
 void Swap::perform_alpha_beta_swap(LabelType alpha_label, LabelType beta_label)
 {
     PixelType i,size = 0;
-    Energy *e = new Energy();
+    double start = wallClock();
 
 
     for ( i = 0; i < m_nPixels; i++ )
@@ -600,6 +811,8 @@ void Swap::perform_alpha_beta_swap(LabelType alpha_label, LabelType beta_label)
 
     if ( size == 0 ) return;
 
+    Energy *e = new Energy(NULL,&m_graphArena);
+
 
     Energy::Var *variables = (Energy::Var *) new Energy::Var[size];
     if (!variables) { fprintf(stderr, "Not enough memory!\n"); exit(1); }
@@ -628,16 +841,18 @@ void Swap::perform_alpha_beta_swap(LabelType alpha_label, LabelType beta_label)
     }
         
 
+    double built = wallClock();
     e -> minimize();
+    addMoveStats(alpha_label,beta_label,built-start,wallClock()-built,
+                 e->num_augmentations(),e->num_terms(),e->num_truncations());
 
     for ( i = 0; i < size; i++ )
-        if ( e->get_var(variables[i]) == 0 )
-            m_labeling[m_pixels[i]] = alpha_label;
-        else m_labeling[m_pixels[i]] = beta_label;
+        m_energy += relabel(m_pixels[i],e->get_var(variables[i]) == 0 ? alpha_label : beta_label);
 
 
     delete [] variables;
     delete e;
+    m_graphArena.reset();
 
 }
 
@@ -652,32 +867,28 @@ void Swap::set_up_swap_energy_NG_ARRAY(int size,LabelType alpha_label,LabelType
     
 
 
+    m_neighbors->build();
+
     for ( i = 0; i < size; i++ )
     {
         pix = pixels[i];
-        if ( !m_neighbors[pix].isEmpty() )
+        for ( tmp = m_neighbors->begin(pix); tmp < m_neighbors->end(pix); tmp++ )
         {
-            m_neighbors[pix].setCursorFront();
+            nPix   = tmp->to_node;
+            weight = tmp->weight;
             
-            while ( m_neighbors[pix].hasNext() )
+            if ( m_labeling[nPix] == alpha_label || m_labeling[nPix] == beta_label)
             {
-                tmp = (Neighbor *) (m_neighbors[pix].next());
-                nPix   = tmp->to_node;
-                weight = tmp->weight;
-                
-                if ( m_labeling[nPix] == alpha_label || m_labeling[nPix] == beta_label)
-                {
-                    if ( pix < nPix )
-                        e ->add_term2(variables[i],variables[m_lookupPixVar[nPix]],
-                                      m_smoothcost(alpha_label,alpha_label)*weight,
-                                      m_smoothcost(alpha_label,beta_label)*weight,
-                                      m_smoothcost(beta_label,alpha_label)*weight,
-                                      m_smoothcost(beta_label,beta_label)*weight);
-                }
-                else
-                    e ->add_term1(variables[i],m_smoothcost(alpha_label,m_labeling[nPix])*weight,
-                                               m_smoothcost(beta_label,m_labeling[nPix])*weight);
+                if ( pix < nPix )
+                    e ->add_term2(variables[i],variables[m_lookupPixVar[nPix]],
+                                  m_smoothcost(alpha_label,alpha_label)*weight,
+                                  m_smoothcost(alpha_label,beta_label)*weight,
+                                  m_smoothcost(beta_label,alpha_label)*weight,
+                                  m_smoothcost(beta_label,beta_label)*weight);
             }
+            else
+                e ->add_term1(variables[i],m_smoothcost(alpha_label,m_labeling[nPix])*weight,
+                                           m_smoothcost(beta_label,m_labeling[nPix])*weight);
         }
     }
 }
@@ -691,31 +902,27 @@ void Swap::set_up_swap_energy_NG_FnPix(int size,LabelType alpha_label,LabelType
     Neighbor *tmp;
     
 
+    m_neighbors->build();
+
     for ( i = 0; i < size; i++ )
     {
         pix = pixels[i];
-        if ( !m_neighbors[pix].isEmpty() )
+        for ( tmp = m_neighbors->begin(pix); tmp < m_neighbors->end(pix); tmp++ )
         {
-            m_neighbors[pix].setCursorFront();
+            nPix   = tmp->to_node;
             
-            while ( m_neighbors[pix].hasNext() )
+            if ( m_labeling[nPix] == alpha_label || m_labeling[nPix] == beta_label)
             {
-                tmp = (Neighbor *) (m_neighbors[pix].next());
-                nPix   = tmp->to_node;
-                
-                if ( m_labeling[nPix] == alpha_label || m_labeling[nPix] == beta_label)
-                {
-                    if ( pix < nPix )
-                        e ->add_term2(variables[i],variables[m_lookupPixVar[nPix]],
-                                      m_smoothFnPix(pix,nPix,alpha_label,alpha_label),
-                                      m_smoothFnPix(pix,nPix,alpha_label,beta_label),
-                                      m_smoothFnPix(pix,nPix,beta_label,alpha_label),
-                                      m_smoothFnPix(pix,nPix,beta_label,beta_label) );
-                }
-                else
-                    e ->add_term1(variables[i],m_smoothFnPix(pix,nPix,alpha_label,m_labeling[nPix]),
-                                               m_smoothFnPix(pix,nPix,beta_label,m_labeling[nPix]));
+                if ( pix < nPix )
+                    e ->add_term2(variables[i],variables[m_lookupPixVar[nPix]],
+                                  m_smoothFnPix(pix,nPix,alpha_label,alpha_label),
+                                  m_smoothFnPix(pix,nPix,alpha_label,beta_label),
+                                  m_smoothFnPix(pix,nPix,beta_label,alpha_label),
+                                  m_smoothFnPix(pix,nPix,beta_label,beta_label) );
             }
+            else
+                e ->add_term1(variables[i],m_smoothFnPix(pix,nPix,alpha_label,m_labeling[nPix]),
+                                           m_smoothFnPix(pix,nPix,beta_label,m_labeling[nPix]));
         }
     }
 }
@@ -938,6 +1145,102 @@ void Swap::optimizeAlg(int nIterations)
 /**************************************************************************************/
 
 
+Expansion::Expansion(PixelType width,PixelType height,int num_labels,EnergyFunction *eng):GCoptimization(width,height,num_labels,eng)
+{
+    initializeExpansion();
+}
+
+/**************************************************************************************/
+
+Expansion::Expansion(PixelType nPixels, int num_labels,EnergyFunction *eng):GCoptimization(nPixels,num_labels,eng)
+{
+    initializeExpansion();
+}
+
+/**************************************************************************************/
+
+void Expansion::initializeExpansion()
+{
+    m_gridEnergy  = NULL;
+    m_labelEnergy = NULL;
+    m_reuse_flow  = 0;
+    m_variables   = NULL;
+    m_stripEnergy = NULL;
+    m_numStrips   = 0;
+    m_stripShift  = 0;
+    m_parallel_stalled = 0;
+}
+
+/**************************************************************************************/
+
+Expansion::~Expansion()
+{
+    delete m_gridEnergy;
+    deleteLabelEnergies();
+    deleteStripEnergies();
+    delete [] m_variables;
+}
+
+/**************************************************************************************/
+
+void Expansion::deleteLabelEnergies()
+{
+    if ( !m_labelEnergy ) return;
+
+    for ( int i = 0; i < m_nLabels; i++ )
+        delete m_labelEnergy[i];
+    delete [] m_labelEnergy;
+    m_labelEnergy = NULL;
+}
+
+/**************************************************************************************/
+
+void Expansion::deleteStripEnergies()
+{
+    if ( !m_stripEnergy ) return;
+
+    for ( int i = 0; i <= m_numStrips; i++ )
+        delete m_stripEnergy[i];
+    delete [] m_stripEnergy;
+    m_stripEnergy = NULL;
+}
+
+/**************************************************************************************/
+
+void Expansion::setParallel(bool PARALLEL)
+{
+    deleteStripEnergies();
+    m_numStrips = 0;
+    m_stripShift = 0;
+    m_parallel_stalled = 0;
+
+    if ( !PARALLEL || !m_grid_graph || parallel_threads() < 2 ) return;
+
+    /* two rounds of strips, each with a strip per thread */
+    m_numStrips = std::min(2*parallel_threads(),m_height/MIN_STRIP_ROWS);
+    if ( m_numStrips < 2 )
+    {
+        m_numStrips = 0;
+        return;
+    }
+
+    /* shifting the boundaries adds a strip at the end */
+    int stripRows = (m_height + m_numStrips - 1)/m_numStrips;
+    m_stripEnergy = new GridEnergy *[m_numStrips+1];
+    for ( int i = 0; i <= m_numStrips; i++ )
+        m_stripEnergy[i] = new GridEnergy(m_width,stripRows);
+}
+
+/**************************************************************************************/
+
+void Expansion::setReuseFlow(bool REUSE_FLOW)
+{
+    m_reuse_flow = REUSE_FLOW;
+    if ( !m_reuse_flow ) deleteLabelEnergies();
+}
+
+/**************************************************************************************/
+
 GCoptimization::EnergyType Expansion::expansion(int max_num_iterations)
 {
     return(start_expansion(max_num_iterations)); 
@@ -961,19 +1264,19 @@ GCoptimization::EnergyType Expansion::start_expansion(int max_num_iterations )
     EnergyType new_energy,old_energy;
     
 
-    new_energy = dataEnergy()+smoothnessEnergy();
-
-
-    //old_energy = new_energy+1; // this doesn't work for large float energies
-    old_energy = -1;
+    start_iterations();
+    new_energy = compute_energy();
 
-    while (old_energy < 0 || (old_energy > new_energy  && curr_cycle <= max_num_iterations))
+    do
     {
         old_energy = new_energy;
         new_energy = oneExpansionIteration();
         
         curr_cycle++;   
     }
+    while (!stop_iterations(old_energy,new_energy) && curr_cycle <= max_num_iterations);
+
+    m_iterations = curr_cycle - 1;
 
     //printf(" Exp energy %d",new_energy);
     return(new_energy);
@@ -987,7 +1290,7 @@ GCoptimization::EnergyType Expansion::alpha_expansion(LabelType label)
     terminateOnError( label < 0 || label >= m_nLabels,"Illegal Label to Expand On");
 
     perform_alpha_expansion(label);
-    return(dataEnergy()+smoothnessEnergy());
+    return(compute_energy());
 }
 
 
@@ -995,8 +1298,15 @@ GCoptimization::EnergyType Expansion::alpha_expansion(LabelType label)
 
 void Expansion::perform_alpha_expansion(LabelType alpha_label)
 {
+    if ( m_grid_graph && m_grid_graph_cut )
+    {
+        perform_alpha_expansion_grid(alpha_label);
+        return;
+    }
+
     PixelType i,size = 0; 
-    Energy *e = new Energy();
+    double start = wallClock();
+    Energy *e = new Energy(NULL,&m_graphArena);
     
 
     
@@ -1012,8 +1322,9 @@ void Expansion::perform_alpha_expansion(LabelType alpha_label)
         
     if ( size > 0 ) 
     {
-        Energy::Var *variables = (Energy::Var *) new Energy::Var[size];
-        if ( !variables) {printf("\nOut of memory, exiting");exit(1);}
+        if ( !m_variables ) m_variables = (Energy::Var *) new Energy::Var[m_nPixels];
+        if ( !m_variables) {printf("\nOut of memory, exiting");exit(1);}
+        Energy::Var *variables = m_variables;
 
         for ( i = 0; i < size; i++ )
             variables[i] = e ->add_variable();
@@ -1038,23 +1349,225 @@ void Expansion::perform_alpha_expansion(LabelType alpha_label)
             else if ( m_smoothType == FUNCTION) set_up_expansion_energy_NG_FnPix(size,alpha_label,e,variables);
         }
         
+        double built = wallClock();
         e -> minimize();
+        addMoveStats(alpha_label,-1,built-start,wallClock()-built,
+                     e->num_augmentations(),e->num_terms(),e->num_truncations());
     
         for ( i = 0,size = 0; i < m_nPixels; i++ )
         {
             if ( m_labeling[i] != alpha_label )
             {
                 if ( e->get_var(variables[size]) == 0 )
-                    m_labeling[i] = alpha_label;
+                    m_energy += relabel(i,alpha_label);
 
                 size++;
             }
         }
-
-        delete [] variables;
     }
 
     delete e;
+    m_graphArena.reset();
+}
+
+/**********************************************************************************************/
+/* Performs alpha-expansion on a grid with a GridEnergy                                         */
+/* With reuse of flow, the terms go into the dynamic graph of alpha_label as an update          */
+
+void Expansion::perform_alpha_expansion_grid(LabelType alpha_label)
+{
+    GridEnergy *e;
+    double start = wallClock();
+
+    if ( m_reuse_flow )
+    {
+        if ( !m_labelEnergy )
+        {
+            m_labelEnergy = new GridEnergy *[m_nLabels];
+            for ( int i = 0; i < m_nLabels; i++ ) m_labelEnergy[i] = NULL;
+        }
+        if ( !m_labelEnergy[alpha_label] ) m_labelEnergy[alpha_label] = new GridEnergy(m_width,m_height,1);
+        e = m_labelEnergy[alpha_label];
+        e -> begin_update();
+    }
+    else
+    {
+        if ( !m_gridEnergy ) m_gridEnergy = new GridEnergy(m_width,m_height);
+        else m_gridEnergy -> reset();
+        e = m_gridEnergy;
+    }
+
+    /* the graphs are reused, so their counters are taken as differences */
+    long augmentations = e->num_augmentations(), terms = e->num_terms(), truncations = e->num_truncations();
+
+    set_up_expansion_grid(e,alpha_label,0,m_height);
+
+    /* a new dynamic graph has no trees yet, and reusing them then is the same as starting over */
+    if ( m_reuse_flow ) e -> end_update();
+    double built = wallClock();
+    e -> minimize(m_reuse_flow);
+    addMoveStats(alpha_label,-1,built-start,wallClock()-built,e->num_augmentations()-augmentations,
+                 e->num_terms()-terms,e->num_truncations()-truncations);
+
+    m_energy += apply_expansion_grid(e,alpha_label,0,m_height);
+}
+
+/**********************************************************************************************/
+/* Adds the expansion move of rows y0 to y1-1 to e, with every other pixel keeping its label.  */
+/* Pixel (x,y) is node (x,y-y0), so no lookup table is needed. Pixels already labeled          */
+/* alpha_label are left as isolated nodes, and their terms with the pixels of the move become  */
+/* unary, as do the terms with pixels outside the rows. The terms are the same as in           */
+/* set_up_expansion_energy_G_ARRAY_VW() and _G_FnPix(), with the costs of smooth inlined       */
+
+template <class Smooth>
+void Expansion::set_up_expansion_grid(GridEnergy *e,const Smooth &smooth,LabelType alpha_label,int y0,int y1)
+{
+    int x,y,pix,nPix;
+    LabelType label;
+    EnergyTermType weight;
+    GridEnergy::Var v;
+
+    for ( y = y0; y < y1; y++ )
+        for ( x = 0; x < m_width; x++ )
+        {
+            pix = x+y*m_width;
+            label = m_labeling[pix];
+            if ( label == alpha_label ) continue;
+
+            v = e -> node(x,y-y0);
+
+            if ( m_dataType == ARRAY ) e -> add_term1(v,m_datacost(pix,alpha_label),m_datacost(pix,label));
+            else e -> add_term1(v,m_dataFnPix(pix,alpha_label),m_dataFnPix(pix,label));
+
+            if ( x < m_width - 1 )
+            {
+                nPix = pix + 1;
+                weight = m_varWeights ? m_horizWeights[pix] : 1;
+                if ( m_labeling[nPix] != alpha_label )
+                    e -> add_term2(v,GridEnergy::RIGHT,
+                                   smooth(pix,nPix,alpha_label,alpha_label,weight),
+                                   smooth(pix,nPix,alpha_label,m_labeling[nPix],weight),
+                                   smooth(pix,nPix,label,alpha_label,weight),
+                                   smooth(pix,nPix,label,m_labeling[nPix],weight));
+                else e -> add_term1(v,smooth(pix,nPix,alpha_label,alpha_label,weight),
+                                    smooth(pix,nPix,label,alpha_label,weight));
+            }
+
+            if ( y < m_height - 1 )
+            {
+                nPix = pix + m_width;
+                weight = m_varWeights ? m_vertWeights[pix] : 1;
+                if ( m_labeling[nPix] != alpha_label && y < y1 - 1 )
+                    e -> add_term2(v,GridEnergy::DOWN,
+                                   smooth(pix,nPix,alpha_label,alpha_label,weight),
+                                   smooth(pix,nPix,alpha_label,m_labeling[nPix],weight),
+                                   smooth(pix,nPix,label,alpha_label,weight),
+                                   smooth(pix,nPix,label,m_labeling[nPix],weight));
+                else e -> add_term1(v,smooth(pix,nPix,alpha_label,m_labeling[nPix],weight),
+                                    smooth(pix,nPix,label,m_labeling[nPix],weight));
+            }
+
+            if ( x > 0 && m_labeling[pix-1] == alpha_label )
+            {
+                nPix = pix - 1;
+                weight = m_varWeights ? m_horizWeights[nPix] : 1;
+                e -> add_term1(v,smooth(pix,nPix,alpha_label,alpha_label,weight),
+                               smooth(pix,nPix,label,alpha_label,weight));
+            }
+
+            if ( y > 0 && (m_labeling[pix-m_width] == alpha_label || y == y0) )
+            {
+                nPix = pix - m_width;
+                weight = m_varWeights ? m_vertWeights[nPix] : 1;
+                e -> add_term1(v,smooth(pix,nPix,alpha_label,m_labeling[nPix],weight),
+                               smooth(pix,nPix,label,m_labeling[nPix],weight));
+            }
+        }
+}
+
+/**********************************************************************************************/
+/* Instantiates set_up_expansion_grid() for the smoothness model of initializeAlg()            */
+
+void Expansion::set_up_expansion_grid(GridEnergy *e,LabelType alpha_label,int y0,int y1)
+{
+    switch ( m_smoothModel )
+    {
+        case SMOOTH_POTTS:
+            set_up_expansion_grid(e,PottsSmoothness<EnergyTermType>(m_smoothLambda),alpha_label,y0,y1);
+            break;
+        case SMOOTH_TRUNCATED_LINEAR:
+            set_up_expansion_grid(e,TruncatedLinearSmoothness<EnergyTermType>(m_smoothLambda,m_smoothMax),
+                                  alpha_label,y0,y1);
+            break;
+        case SMOOTH_TRUNCATED_QUADRATIC:
+            set_up_expansion_grid(e,TruncatedQuadraticSmoothness<EnergyTermType>(m_smoothLambda,m_smoothMax),
+                                  alpha_label,y0,y1);
+            break;
+        case SMOOTH_FUNCTION:
+            set_up_expansion_grid(e,FunctionSmoothness<EnergyTermType>(m_smoothFnPix),alpha_label,y0,y1);
+            break;
+        default:
+            set_up_expansion_grid(e,ArraySmoothness<EnergyTermType>(m_smoothcost,m_nLabels),alpha_label,y0,y1);
+    }
+}
+
+/**********************************************************************************************/
+/* Moves the pixels of rows y0 to y1-1 that take the value 0 in the cut of e to alpha_label    */
+/* and returns the change of the energy (see relabel())                                       */
+
+GCoptimization::EnergyType Expansion::apply_expansion_grid(GridEnergy *e,LabelType alpha_label,int y0,int y1)
+{
+    int x,y,pix;
+    EnergyType delta = 0;
+
+    for ( y = y0; y < y1; y++ )
+        for ( x = 0; x < m_width; x++ )
+        {
+            pix = x+y*m_width;
+            if ( m_labeling[pix] != alpha_label && e -> get_var(e -> node(x,y-y0)) == 0 )
+                delta += relabel(pix,alpha_label);
+        }
+
+    return(delta);
+}
+
+/**********************************************************************************************/
+/* Performs alpha-expansion restricted to horizontal strips. The strips are solved in two      */
+/* rounds, even strips and then odd ones, each round in parallel: strips of the same round do  */
+/* not touch, and each one keeps the rest of the grid fixed, so every strip move is exact and  */
+/* the energy never goes up. The strip boundaries move by half a strip every iteration.       */
+/* The energy changes of the strips are summed in strip order, so m_energy is deterministic   */
+
+void Expansion::perform_alpha_expansion_strips(LabelType alpha_label)
+{
+    int stripRows = (m_height + m_numStrips - 1)/m_numStrips;
+    int shift = m_stripShift ? stripRows/2 : 0;
+    std::vector<EnergyType> delta(m_numStrips+1,0);
+
+    for ( int parity = 0; parity < 2; parity++ )
+        parallel_for(0,(m_numStrips + 2 - parity)/2,1,[&](long first, long last)
+        {
+            for ( long k = first; k < last; k++ )
+            {
+                int strip = 2*k + parity;
+                int y0 = std::min(m_height,std::max(0,strip*stripRows - shift));
+                int y1 = std::min(m_height,(strip+1)*stripRows - shift);
+                if ( y0 >= y1 ) continue;
+
+                double start = wallClock();
+                GridEnergy *e = m_stripEnergy[strip];
+                long augmentations = e->num_augmentations(), terms = e->num_terms(), truncations = e->num_truncations();
+                e -> reset();
+                set_up_expansion_grid(e,alpha_label,y0,y1);
+                double built = wallClock();
+                e -> minimize();
+                addMoveStats(alpha_label,-1,built-start,wallClock()-built,e->num_augmentations()-augmentations,
+                             e->num_terms()-terms,e->num_truncations()-truncations);
+                delta[strip] = apply_expansion_grid(e,alpha_label,y0,y1);
+            }
+        });
+
+    for ( int strip = 0; strip <= m_numStrips; strip++ ) m_energy += delta[strip];
 }
 
 /**********************************************************************************************/
@@ -1069,35 +1582,31 @@ void Expansion::set_up_expansion_energy_NG_ARRAY(int size, LabelType alpha_label
 
 
 
+    m_neighbors->build();
+
     for ( i = size - 1; i >= 0; i-- )
     {
         pix = m_lookupPixVar[i];
         m_lookupPixVar[pix] = i;
 
-        if ( !m_neighbors[pix].isEmpty() )
+        for ( tmp = m_neighbors->begin(pix); tmp < m_neighbors->end(pix); tmp++ )
         {
-            m_neighbors[pix].setCursorFront();
+            nPix   = tmp->to_node;
+            weight = tmp->weight;
             
-            while ( m_neighbors[pix].hasNext() )
+            if ( m_labeling[nPix] != alpha_label )
             {
-                tmp = (Neighbor *) (m_neighbors[pix].next());
-                nPix   = tmp->to_node;
-                weight = tmp->weight;
-                
-                if ( m_labeling[nPix] != alpha_label )
-                {
-                    if ( pix < nPix )
-                        e ->add_term2(variables[i],variables[m_lookupPixVar[nPix]],
-                                      m_smoothcost(alpha_label,alpha_label)*weight,
-                                      m_smoothcost(alpha_label,m_labeling[nPix])*weight,
-                                      m_smoothcost(m_labeling[pix],alpha_label)*weight,
-                                      m_smoothcost(m_labeling[pix],m_labeling[nPix])*weight);
-                }
-                else
-                    e ->add_term1(variables[i],m_smoothcost(alpha_label,alpha_label)*weight,
-                                           m_smoothcost(m_labeling[pix],alpha_label)*weight);
-                
+                if ( pix < nPix )
+                    e ->add_term2(variables[i],variables[m_lookupPixVar[nPix]],
+                                  m_smoothcost(alpha_label,alpha_label)*weight,
+                                  m_smoothcost(alpha_label,m_labeling[nPix])*weight,
+                                  m_smoothcost(m_labeling[pix],alpha_label)*weight,
+                                  m_smoothcost(m_labeling[pix],m_labeling[nPix])*weight);
             }
+            else
+                e ->add_term1(variables[i],m_smoothcost(alpha_label,alpha_label)*weight,
+                                       m_smoothcost(m_labeling[pix],alpha_label)*weight);
+            
         }
     }
 
@@ -1115,35 +1624,31 @@ void Expansion::set_up_expansion_energy_NG_FnPix(int size, LabelType alpha_label
     
 
 
+    m_neighbors->build();
+
     for ( i = size - 1; i >= 0; i-- )
     {
         pix = m_lookupPixVar[i];
         m_lookupPixVar[pix] = i;
 
 
-        if ( !m_neighbors[pix].isEmpty() )
+        for ( tmp = m_neighbors->begin(pix); tmp < m_neighbors->end(pix); tmp++ )
         {
-            m_neighbors[pix].setCursorFront();
+            nPix   = tmp->to_node;
             
-            while ( m_neighbors[pix].hasNext() )
+            if ( m_labeling[nPix] != alpha_label )
             {
-                tmp = (Neighbor *) (m_neighbors[pix].next());
-                nPix   = tmp->to_node;
-                
-                if ( m_labeling[nPix] != alpha_label )
-                {
-                    if ( pix < nPix )
-                        e ->add_term2(variables[i],variables[m_lookupPixVar[nPix]],
-                                      m_smoothFnPix(pix,nPix,alpha_label,alpha_label),
-                                      m_smoothFnPix(pix,nPix,alpha_label,m_labeling[nPix]),
-                                      m_smoothFnPix(pix,nPix,m_labeling[pix],alpha_label),
-                                      m_smoothFnPix(pix,nPix,m_labeling[pix],m_labeling[nPix]));
-                }
-                else
-                    e ->add_term1(variables[i],m_smoothFnPix(pix,nPix,alpha_label,m_labeling[nPix]),
-                                               m_smoothFnPix(pix,nPix,m_labeling[pix],alpha_label));
-                
+                if ( pix < nPix )
+                    e ->add_term2(variables[i],variables[m_lookupPixVar[nPix]],
+                                  m_smoothFnPix(pix,nPix,alpha_label,alpha_label),
+                                  m_smoothFnPix(pix,nPix,alpha_label,m_labeling[nPix]),
+                                  m_smoothFnPix(pix,nPix,m_labeling[pix],alpha_label),
+                                  m_smoothFnPix(pix,nPix,m_labeling[pix],m_labeling[nPix]));
             }
+            else
+                e ->add_term1(variables[i],m_smoothFnPix(pix,nPix,alpha_label,m_labeling[nPix]),
+                                           m_smoothFnPix(pix,nPix,m_labeling[pix],alpha_label));
+            
         }
     }
 }
@@ -1360,18 +1865,267 @@ GCoptimization::EnergyType Expansion::oneExpansionIteration()
 
     if (m_random_label_order) scramble_label_table();
     
+    if ( m_numStrips > 0 && m_grid_graph_cut && !m_parallel_stalled )
+    {
+        EnergyType old_energy = compute_energy(),new_energy;
+
+        for (next = 0;  next < m_nLabels;  next++ )
+            if ( expansion_move(m_labelTable[next],true) ) return(compute_energy());
+        m_stripShift = !m_stripShift;
+
+        new_energy = compute_energy();
+        if ( new_energy < old_energy ) return(new_energy);
+
+        /* strip moves are stuck, go on with moves over the whole grid, of all labels */
+        m_parallel_stalled = 1;
+        for (next = 0; next < m_nLabels; next++ ) m_labelActive[next] = 1;
+        m_labelsSkipped = false;
+    }
 
+    compute_energy();
     for (next = 0;  next < m_nLabels;  next++ )
-        perform_alpha_expansion(m_labelTable[next]);
+        if ( expansion_move(m_labelTable[next],false) ) break;
     
     
-    return(dataEnergy()+smoothnessEnergy());
+    return(compute_energy());
 }
 
 
+/**************************************************************************************/
+/* Performs the expansion move of alpha_label in an iteration, over strips or the whole grid, */
+/* unless the label is skipped as inactive. Returns true if the time limit has passed         */
+
+bool Expansion::expansion_move(LabelType alpha_label,bool strips)
+{
+    if ( m_activeLabels && !m_labelActive[alpha_label] )
+    {
+        m_labelsSkipped = true;
+        return(false);
+    }
+    if ( out_of_time() ) return(true);
+
+    EnergyType energy = m_energy;
+    if ( strips ) perform_alpha_expansion_strips(alpha_label);
+    else perform_alpha_expansion(alpha_label);
+    m_labelActive[alpha_label] = m_energy < energy;
+
+    return(false);
+}
+
 /**************************************************************************************/
 
 void Expansion::optimizeAlg(int nIterations)
 {
     expansion(nIterations);
 }
+
+/**************************************************************************************/
+
+BinaryCut::BinaryCut(PixelType width,PixelType height,int num_labels,EnergyFunction *eng):GCoptimization(width,height,num_labels,eng)
+{
+    terminateOnError(num_labels != 2,"BinaryCut works only with 2 labels");
+}
+
+/**************************************************************************************/
+
+BinaryCut::BinaryCut(PixelType nPixels, int num_labels,EnergyFunction *eng):GCoptimization(nPixels,num_labels,eng)
+{
+    terminateOnError(num_labels != 2,"BinaryCut works only with 2 labels");
+}
+
+/**************************************************************************************/
+/* Node i of the graph is pixel i and its value is the pixel's label, so no lookup    */
+/* table is needed and the graph is built in a single pass                            */
+
+GCoptimization::EnergyType BinaryCut::cut()
+{
+    if ( m_grid_graph && m_grid_graph_cut )
+    {
+        cut_grid();
+        return(compute_energy());
+    }
+
+    PixelType i;
+    double start = wallClock();
+    Energy *e = new Energy(NULL,&m_graphArena);
+    Energy::Var *variables = (Energy::Var *) new Energy::Var[m_nPixels];
+    terminateOnError(!variables,"Not enough memory");
+
+    for ( i = 0; i < m_nPixels; i++ )
+        variables[i] = e -> add_variable();
+
+    if ( m_dataType == ARRAY )
+        for ( i = 0; i < m_nPixels; i++ )
+            e -> add_term1(variables[i],m_datacost(i,0),m_datacost(i,1));
+    else
+        for ( i = 0; i < m_nPixels; i++ )
+            e -> add_term1(variables[i],m_dataFnPix(i,0),m_dataFnPix(i,1));
+
+    if ( m_grid_graph ) set_up_binary_energy_G(e,variables);
+    else set_up_binary_energy_NG(e,variables);
+
+    double built = wallClock();
+    e -> minimize();
+    addMoveStats(0,1,built-start,wallClock()-built,
+                 e->num_augmentations(),e->num_terms(),e->num_truncations());
+
+    for ( i = 0; i < m_nPixels; i++ )
+        m_energy += relabel(i,e -> get_var(variables[i]));
+
+    delete [] variables;
+    delete e;
+    m_graphArena.reset();
+
+    return(compute_energy());
+}
+
+/**************************************************************************************/
+
+/* Adds the term of neighbors pix and nPix, nPix in direction d of node v, to a binary cut */
+
+template <class Smooth>
+static inline void add_binary_term(GridEnergy *e,GridEnergy::Var v,int d,const Smooth &smooth,
+                                   int pix,int nPix,GCoptimization::EnergyTermType weight)
+{
+    e -> add_term2(v,d,smooth(pix,nPix,0,0,weight),smooth(pix,nPix,0,1,weight),
+                   smooth(pix,nPix,1,0,weight),smooth(pix,nPix,1,1,weight));
+}
+
+/* A Potts term is a single edge, with no test for truncation */
+
+static inline void add_binary_term(GridEnergy *e,GridEnergy::Var v,int d,
+                                   const PottsSmoothness<GCoptimization::EnergyTermType> &smooth,
+                                   int,int,GCoptimization::EnergyTermType weight)
+{
+    e -> add_potts_term(v,d,smooth.lambda*weight);
+}
+
+/**************************************************************************************/
+
+/* Same as cut() with a GridEnergy, node (x,y) holding the label of pixel (x,y) */
+
+void BinaryCut::cut_grid()
+{
+    switch ( m_smoothModel )
+    {
+        case SMOOTH_POTTS:
+            cut_grid(PottsSmoothness<EnergyTermType>(m_smoothLambda));
+            break;
+        case SMOOTH_TRUNCATED_LINEAR:
+            cut_grid(TruncatedLinearSmoothness<EnergyTermType>(m_smoothLambda,m_smoothMax));
+            break;
+        case SMOOTH_TRUNCATED_QUADRATIC:
+            cut_grid(TruncatedQuadraticSmoothness<EnergyTermType>(m_smoothLambda,m_smoothMax));
+            break;
+        case SMOOTH_FUNCTION:
+            cut_grid(FunctionSmoothness<EnergyTermType>(m_smoothFnPix));
+            break;
+        default:
+            cut_grid(ArraySmoothness<EnergyTermType>(m_smoothcost,m_nLabels));
+    }
+}
+
+/**************************************************************************************/
+
+template <class Smooth>
+void BinaryCut::cut_grid(const Smooth &smooth)
+{
+    int x,y,pix;
+    GridEnergy::Var v;
+    double start = wallClock();
+    GridEnergy *e = new GridEnergy(m_width,m_height);
+
+    for ( y = 0; y < m_height; y++ )
+        for ( x = 0; x < m_width; x++ )
+        {
+            pix = x+y*m_width;
+            v = e -> node(x,y);
+
+            if ( m_dataType == ARRAY ) e -> add_term1(v,m_datacost(pix,0),m_datacost(pix,1));
+            else e -> add_term1(v,m_dataFnPix(pix,0),m_dataFnPix(pix,1));
+
+            if ( x < m_width - 1 )
+                add_binary_term(e,v,GridEnergy::RIGHT,smooth,pix,pix+1,
+                                m_varWeights ? m_horizWeights[pix] : 1);
+
+            if ( y < m_height - 1 )
+                add_binary_term(e,v,GridEnergy::DOWN,smooth,pix,pix+m_width,
+                                m_varWeights ? m_vertWeights[pix] : 1);
+        }
+
+    double built = wallClock();
+    e -> minimize();
+    addMoveStats(0,1,built-start,wallClock()-built,
+                 e->num_augmentations(),e->num_terms(),e->num_truncations());
+
+    for ( y = 0; y < m_height; y++ )
+        for ( x = 0; x < m_width; x++ )
+            m_energy += relabel(x+y*m_width,e -> get_var(e -> node(x,y)));
+
+    delete e;
+}
+
+/**************************************************************************************/
+
+void BinaryCut::optimizeAlg(int /*nIterations*/)
+{
+    cut();
+    m_iterations = 1;
+    m_converged = true;
+}
+
+/**************************************************************************************/
+
+void BinaryCut::set_up_binary_energy_G(Energy *e,Energy::Var *variables)
+{
+    int x,y,pix,nPix;
+    EnergyTermType weight;
+
+    for ( y = 0; y < m_height; y++ )
+        for ( x = 0; x < m_width; x++ )
+        {
+            pix = x+y*m_width;
+
+            if ( x < m_width - 1 )
+            {
+                nPix = pix + 1;
+                weight = m_varWeights ? m_horizWeights[pix] : 1;
+                e ->add_term2(variables[pix],variables[nPix],
+                              pair_cost(pix,nPix,0,0,weight),pair_cost(pix,nPix,0,1,weight),
+                              pair_cost(pix,nPix,1,0,weight),pair_cost(pix,nPix,1,1,weight));
+            }
+
+            if ( y < m_height - 1 )
+            {
+                nPix = pix + m_width;
+                weight = m_varWeights ? m_vertWeights[pix] : 1;
+                e ->add_term2(variables[pix],variables[nPix],
+                              pair_cost(pix,nPix,0,0,weight),pair_cost(pix,nPix,0,1,weight),
+                              pair_cost(pix,nPix,1,0,weight),pair_cost(pix,nPix,1,1,weight));
+            }
+        }
+}
+
+/**************************************************************************************/
+
+void BinaryCut::set_up_binary_energy_NG(Energy *e,Energy::Var *variables)
+{
+    Neighbor *tmp;
+    int pix,nPix;
+
+    m_neighbors->build();
+
+    for ( pix = 0; pix < m_nPixels; pix++ )
+    {
+        for ( tmp = m_neighbors->begin(pix); tmp < m_neighbors->end(pix); tmp++ )
+        {
+            nPix = tmp->to_node;
+
+            /* every edge is stored at both ends */
+            if ( pix < nPix )
+                e ->add_term2(variables[pix],variables[nPix],
+                              pair_cost(pix,nPix,0,0,tmp->weight),pair_cost(pix,nPix,0,1,tmp->weight),
+                              pair_cost(pix,nPix,1,0,tmp->weight),pair_cost(pix,nPix,1,1,tmp->weight));
+        }
+    }
+}
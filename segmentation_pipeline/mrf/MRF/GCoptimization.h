@@ -28,13 +28,17 @@
 #ifndef __GCOPTIMIZATION_H__
 #define __GCOPTIMIZATION_H__
 
-#include "LinkedBlockList.h"
 #include <assert.h>
+#include "arena.h"
 #include "graph.h"
 #include "energy.h"
+#include "gridgraph.h"
+#include "neighbors.h"
+#include "smoothness.h"
 #define m_datacost(pix,lab)     (m_datacost[(pix)*m_nLabels+(lab)] )
 #define m_smoothcost(lab1,lab2) (m_smoothcost[(lab1)+(lab2)*m_nLabels] )
 #define USE_MEMBER_FUNCTION 0
+#define MIN_STRIP_ROWS 16 /* smallest strip of a parallel expansion */
 #define PASS_AS_PARAMETER   1
 
 
@@ -89,8 +93,9 @@ public:
 
     /* Sets data cost of pixel to label */
 
-   /* returns pointer to the answer */
-    Label* getAnswerPtr(){return(m_labeling);}
+   /* returns pointer to the answer. The labeling can then be changed from outside, so the energy */
+    /* of the labeling is evaluated again by the next call of totalEnergy()                         */
+    Label* getAnswerPtr(){m_energyValid = false; return(m_labeling);}
 
     // Sets answer to zeros
     void clearAnswer();
@@ -102,16 +107,44 @@ public:
     /* member function setLabel should be called as: setLabel(pixel1,pixel2,weight)                */
     void setNeighbors(PixelType pixel1, PixelType pixel2, EnergyTermType weight);
 
+    /* Same as calling setNeighbors(pixel1[k],pixel2[k],weights[k]) for k = 0,...,numEdges-1       */
+    /* The neighborhood system is kept in compressed sparse row form (see neighbors.h), which is   */
+    /* built from all edges before the first move or energy evaluation that needs it               */
+    void setNeighbors(PixelType numEdges, PixelType *pixel1, PixelType *pixel2, EnergyTermType *weights);
+
 
     /* This function can be used to change the label of any pixel at any time      */
     inline void setLabel(PixelType pixel, LabelType label){
-        assert(label >= 0 && label < m_nLabels && pixel >= 0 && pixel < m_nPixels);m_labeling[pixel] = label;};
+        assert(label >= 0 && label < m_nLabels && pixel >= 0 && pixel < m_nPixels);m_labeling[pixel] = label;
+        m_energyValid = false;};
     
     /* By default, the labels are visited in random order for both the swap and alpha-expansion moves */
     /* Use this function with boolean argument 0 to fix the order to be not random                    */
     /* Use this function with argumnet 1 to fix the order back to random                              */
     void setLabelOrder(bool RANDOM_LABEL_ORDER);
 
+    /* By default, Expansion and BinaryCut build the graph of a grid as a GridGraph (see gridgraph.h) */
+    /* Use this function with boolean argument 0 to build it with the general Graph instead           */
+    /* Use this function with argument 1 to go back to GridGraph                                      */
+    void setGridGraph(bool USE_GRID_GRAPH);
+
+    /* By default, expansion and swap run until an iteration does not lower the energy, or for the   */
+    /* number of iterations passed to optimize(). This function makes them also stop after an        */
+    /* iteration that lowers the energy by less than relative_decrease times the energy, and once    */
+    /* max_seconds have passed since optimize() started (checked between moves, 0 for no limit)      */
+    void setConvergence(double relative_decrease, double max_seconds = 0);
+
+    /* Returns true if the last optimize() stopped because the energy converged, not because it ran  */
+    /* out of iterations or time. BinaryCut always converges                                          */
+    bool converged() { return m_converged; }
+
+    /* Use this function with boolean argument 1 to skip, in every iteration of expansion or swap,   */
+    /* the moves of labels whose last move did not lower the energy (swap moves are skipped if both  */
+    /* of their labels are). An iteration that then lowers the energy too little is repeated with    */
+    /* all labels before the algorithm stops, so it stops at the same kind of local minimum          */
+    /* Use this function with argument 0 to go back to moves of all labels in every iteration        */
+    void setActiveLabels(bool ACTIVE_LABELS);
+
 
      void setParameters(int numParam, void *param);
 
@@ -121,8 +154,12 @@ public:
     /* Returns Smooth Energy of current labeling */
     EnergyType smoothnessEnergy();
 
+    /* Returns the energy of the current labeling. After the first evaluation it is kept up to date */
+    /* by the moves, from the terms of the pixels they relabel, so it costs no pass over the pixels  */
+    EnergyVal totalEnergy();
+
 protected:
-	void initializeAlg() {};
+	void initializeAlg();
 
 	/* This function is used to set the data term, and it can be used only if dataSetup = PASS_AS_PARAMETER */
     /* DataCost is an array s.t. the data cost for pixel p and  label l is stored at                        */
@@ -165,20 +202,27 @@ protected:
 
     virtual void optimizeAlg(int nIterations) = 0;
 
-    typedef struct NeighborStruct{
-        PixelType  to_node;
-        EnergyTermType weight;
-    } Neighbor;
+    typedef NeighborSystem<EnergyTermType>::Neighbor Neighbor;
 
 
     LabelType *m_labeling;
+    EnergyType m_energy;     /* energy of m_labeling, if m_energyValid */
+    bool m_energyValid;
+    double m_relativeDecrease, m_maxSeconds;  /* see setConvergence() */
+    double m_startTime;      /* wall clock time at which the running optimize() started */
+    bool m_converged;
+    bool m_activeLabels;     /* see setActiveLabels() */
+    char *m_labelActive;     /* if the last move of each label lowered the energy */
+    bool m_labelsSkipped;    /* if the current iteration skipped inactive labels */
     bool m_random_label_order;
+    bool m_grid_graph_cut;
     bool m_needToFreeV;
     EnergyTermType *m_datacost;
     EnergyTermType *m_smoothcost;
     EnergyTermType *m_vertWeights;
     EnergyTermType *m_horizWeights;
-    LinkedBlockList *m_neighbors;
+    NeighborSystem<EnergyTermType> *m_neighbors;
+    Arena m_graphArena;  /* nodes and arcs of the Energy of a move, reset after every move */
 
     LabelType *m_labelTable;
     PixelType *m_lookupPixVar;
@@ -190,12 +234,43 @@ protected:
     DataCostFn m_dataFnPix;
     SmoothCostGeneralFn m_smoothFnPix;
 
+    /* Smoothness model that the graphs of moves are built with, see smoothness.h. Array costs */
+    /* are Potts if all costs off the diagonal are the same lambda >= 0 and the diagonal is 0  */
+    typedef enum
+        {
+            SMOOTH_ARRAY,
+            SMOOTH_POTTS,
+            SMOOTH_TRUNCATED_LINEAR,
+            SMOOTH_TRUNCATED_QUADRATIC,
+            SMOOTH_FUNCTION
+        } SmoothModel;
+    SmoothModel m_smoothModel;
+    EnergyTermType m_smoothLambda, m_smoothMax;
+
     void commonGridInitialization( PixelType width, PixelType height, int nLabels);
     void commonNonGridInitialization(PixelType num_pixels, int num_labels);
     void commonInitialization();    
 
     void scramble_label_table();
 
+    /* dataEnergy()+smoothnessEnergy(), with its time added to the statistics. The result is    */
+    /* kept in m_energy and returned by later calls until the labeling changes from outside      */
+    EnergyType compute_energy();
+
+    /* Starts the iterations of an optimize(): the time limit and convergence of setConvergence() */
+    void start_iterations();
+
+    /* Called after every iteration, which took the energy from old_energy to new_energy. Returns  */
+    /* true if the iterations should stop; sets m_converged if they stop because of the energy     */
+    bool stop_iterations(EnergyType old_energy,EnergyType new_energy);
+
+    /* True once the time limit of setConvergence() has passed */
+    bool out_of_time() { return m_maxSeconds > 0 && wallClock() - m_startTime > m_maxSeconds; }
+
+    /* Sets the label of pix and returns the change of the energy, with all other pixels keeping */
+    /* their labels. Returns 0 without evaluating the change if m_energy is not valid            */
+    EnergyType relabel(PixelType pix,LabelType label);
+
     EnergyType giveDataEnergyArray();
     EnergyType giveDataEnergyFnPix();
 
@@ -205,6 +280,9 @@ protected:
     EnergyType giveSmoothEnergy_NG_ARRAY();
     EnergyType giveSmoothEnergy_NG_FnPix();
 
+    /* Smoothness cost of pix and nPix having labels label1 and label2, weight is unused for FUNCTION */
+    EnergyTermType pair_cost(PixelType pix,PixelType nPix,LabelType label1,LabelType label2,EnergyTermType weight);
+
     void add_t_links_ARRAY(Energy *e,Energy::Var *variables,int size,LabelType alpha_label);
     void add_t_links_FnPix(Energy *e,Energy::Var *variables,int size,LabelType alpha_label);
             
@@ -254,8 +332,9 @@ private:
 class Expansion: public GCoptimization
 {
 public:
-    Expansion(PixelType width,PixelType height,int num_labels,EnergyFunction *eng):GCoptimization(width,height,num_labels,eng){};
-    Expansion(PixelType nPixels, int num_labels,EnergyFunction *eng):GCoptimization(nPixels,num_labels,eng){};
+    Expansion(PixelType width,PixelType height,int num_labels,EnergyFunction *eng);
+    Expansion(PixelType nPixels, int num_labels,EnergyFunction *eng);
+    ~Expansion();
 
 
     /* Peforms expansion algorithm. Runs the number of iterations specified by max_num_iterations */
@@ -271,22 +350,78 @@ public:
 
     /* Peforms  expansion on one label, specified by the input parameter alpha_label */
     EnergyType alpha_expansion(LabelType alpha_label);
+
+    /* By default, every expansion move on a grid rebuilds one graph that is allocated once        */
+    /* Use this function with boolean argument 1 to keep a dynamic graph for each label instead:    */
+    /* a move on alpha then only adds what changed since the last move on alpha to its flow, and    */
+    /* reuses its search trees. This needs the memory of one dynamic GridGraph per label            */
+    /* Use this function with argument 0 to go back to one graph                                    */
+    void setReuseFlow(bool REUSE_FLOW);
+
+    /* Use this function with boolean argument 1 to run the expansion moves of a grid in parallel,   */
+    /* on the threads of the pipeline's pool (parallel.h). Each move is then solved as horizontal    */
+    /* strips, half of them at a time with the other half fixed. Once an iteration of strip moves    */
+    /* does not lower the energy, the iterations go back to moves over the whole grid, so strip      */
+    /* boundaries do not get stuck. Has no effect with only one thread or on non-grid graphs         */
+    /* Use this function with argument 0 to go back to moves over the whole grid                    */
+    void setParallel(bool PARALLEL);
     
 protected:
     void optimizeAlg(int nIterations);
 
 
 private:
+    GridEnergy *m_gridEnergy;      /* graph of all grid moves, without reuse of flow */
+    GridEnergy **m_labelEnergy;    /* dynamic graph of each label, with reuse of flow */
+    bool m_reuse_flow;
+    Energy::Var *m_variables;      /* variables of non-grid moves */
+    GridEnergy **m_stripEnergy;    /* graph of each strip of a parallel expansion */
+    int m_numStrips;               /* 0 unless parallel */
+    bool m_stripShift;             /* if the strip boundaries are shifted by half a strip */
+    bool m_parallel_stalled;       /* if strip moves stopped lowering the energy */
+
+    void initializeExpansion();
+    void deleteLabelEnergies();
+    void deleteStripEnergies();
     void set_up_expansion_energy_G_ARRAY_VW(int size, LabelType alpha_label,Energy* e, Energy::Var *variables);
     void set_up_expansion_energy_G_ARRAY(int size, LabelType alpha_label,Energy* e, Energy::Var *variables);
     void set_up_expansion_energy_G_FnPix(int size, LabelType alpha_label,Energy* e, Energy::Var *variables);
     void set_up_expansion_energy_NG_ARRAY(int size, LabelType alpha_label,Energy* e, Energy::Var *variables);       
     void set_up_expansion_energy_NG_FnPix(int size, LabelType alpha_label,Energy* e, Energy::Var *variables);       
     void perform_alpha_expansion(LabelType label);  
+    void perform_alpha_expansion_grid(LabelType label);
+    void perform_alpha_expansion_strips(LabelType label);
+    bool expansion_move(LabelType alpha_label,bool strips);
+    void set_up_expansion_grid(GridEnergy *e,LabelType alpha_label,int y0,int y1);
+    template <class Smooth> void set_up_expansion_grid(GridEnergy *e,const Smooth &smooth,LabelType alpha_label,int y0,int y1);
+    EnergyType apply_expansion_grid(GridEnergy *e,LabelType alpha_label,int y0,int y1);
     EnergyType start_expansion(int max_iterations);
 
 };
 
+/* Exact solver for energies with exactly 2 labels. If every pairwise term is submodular, */
+/* i.e. V(0,0)+V(1,1) <= V(0,1)+V(1,0) (true for Potts), one s-t min cut over all pixels  */
+/* gives the global minimum regardless of the starting labeling, so one iteration is all  */
+/* optimize() needs. Non-submodular terms are truncated as in energy.h                    */
+class BinaryCut: public GCoptimization
+{
+public:
+    BinaryCut(PixelType width,PixelType height,int num_labels,EnergyFunction *eng);
+    BinaryCut(PixelType nPixels, int num_labels,EnergyFunction *eng);
+
+    /* Computes the minimum cut and stores it as the labeling. Returns the total energy */
+    EnergyType cut();
+
+protected:
+    void optimizeAlg(int nIterations);
+
+private:
+    void cut_grid();
+    template <class Smooth> void cut_grid(const Smooth &smooth);
+    void set_up_binary_energy_G(Energy* e, Energy::Var *variables);
+    void set_up_binary_energy_NG(Energy* e, Energy::Var *variables);
+};
+
 
 
 
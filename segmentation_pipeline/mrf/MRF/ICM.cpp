@@ -3,6 +3,7 @@
 #include <string.h>
 #include <assert.h>
 #include "ICM.h"
+#include "parallel.h"
 
 #define m_D(pix,l)  m_D[(pix)*m_nLabels+(l)]
 #define m_V(l1,l2)  m_V[(l1)*m_nLabels+(l2)]
@@ -14,31 +15,38 @@
 ICM::ICM(int width, int height, int nLabels,EnergyFunction *eng):MRF(width,height,nLabels,eng)
 {
     m_needToFreeV = 0;
-    initializeAlg();
+    initializeICM();
 }
 ICM::ICM(int nPixels, int nLabels,EnergyFunction *eng):MRF(nPixels,nLabels,eng)
 {
     m_needToFreeV = 0;
-    initializeAlg();
+    initializeICM();
 }
 
 ICM::~ICM()
 { 
     delete[] m_answer;
-    if (!m_grid_graph) delete[] m_neighbors;
+    delete[] m_colorOrder;
+    delete[] m_colorStart;
+    if (!m_grid_graph) delete m_neighbors;
     if ( m_needToFreeV ) delete[] m_V;
 }
 
 
-void ICM::initializeAlg()
+// Allocates in the constructors, so that initialize() keeps the neighbors already set
+void ICM::initializeICM()
 {
     m_answer = (Label *) new Label[m_nPixels];
     if ( !m_answer ){printf("\nNot enough memory, exiting");exit(0);}
 
+    m_parallel = false;
+    m_colorOrder = NULL;
+    m_colorStart = NULL;
+    m_numColors = 0;
+
     if (!m_grid_graph)
     {
-        m_neighbors = (LinkedBlockList *) new LinkedBlockList[m_nPixels];
-        if (!m_neighbors) {printf("Not enough memory,exiting");exit(0);};
+        m_neighbors = new NeighborSystem<CostVal>(m_nPixels);
     }
 }
 
@@ -53,19 +61,16 @@ void ICM::setNeighbors(int pixel1, int pixel2, CostVal weight)
     assert(pixel1 < m_nPixels && pixel1 >= 0 && pixel2 < m_nPixels && pixel2 >= 0);
 
 
-    Neighbor *temp1 = (Neighbor *) new Neighbor;
-    Neighbor *temp2 = (Neighbor *) new Neighbor;
-
-    if ( !temp1 || ! temp2 ) {printf("\nNot enough memory, exiting");exit(0);}
-
-    temp1->weight  = weight;
-    temp1->to_node = pixel2;
+    m_neighbors->add(pixel1,pixel2,weight);
+}
 
-    temp2->weight  = weight;
-    temp2->to_node = pixel1;
+void ICM::setNeighbors(int numEdges, int *pixel1, int *pixel2, CostVal *weights)
+{
+    assert(!m_grid_graph);
+    for ( int i = 0; i < numEdges; i++ )
+        assert(pixel1[i] < m_nPixels && pixel1[i] >= 0 && pixel2[i] < m_nPixels && pixel2[i] >= 0);
 
-    m_neighbors[pixel1].addFront(temp1);
-    m_neighbors[pixel2].addFront(temp2);
+    m_neighbors->add(numEdges,pixel1,pixel2,weights);
 }
 
 
@@ -117,34 +122,25 @@ MRF::EnergyVal ICM::smoothnessEnergy()
         
         Neighbor *temp; 
 
+        m_neighbors->build();
+
         if ( m_smoothType != FUNCTION  )
         {
             for ( i = 0; i < m_nPixels; i++ )
-                if ( !m_neighbors[i].isEmpty() )
+                for ( temp = m_neighbors->begin(i); temp < m_neighbors->end(i); temp++ )
                 {
-                    m_neighbors[i].setCursorFront();
-                    while ( m_neighbors[i].hasNext() )
-                    {
-                        temp = (Neighbor *) m_neighbors[i].next();
-
-                        if ( i < temp->to_node )
-                            eng = eng + m_V(m_answer[i],m_answer[temp->to_node])*(temp->weight);
-                    }
+                    if ( i < temp->to_node )
+                        eng = eng + m_V(m_answer[i],m_answer[temp->to_node])*(temp->weight);
                 }
         }
         else
         {
             for ( i = 0; i < m_nPixels; i++ )
-                if ( !m_neighbors[i].isEmpty() )
+                for ( temp = m_neighbors->begin(i); temp < m_neighbors->end(i); temp++ )
                 {
-                    m_neighbors[i].setCursorFront();
-                    while ( m_neighbors[i].hasNext() )
-                    {
-                        temp = (Neighbor *) m_neighbors[i].next();
-                        if ( i < temp->to_node )
-                            eng = eng + m_smoothFn(i,temp->to_node, m_answer[i],m_answer[temp->to_node]);
+                    if ( i < temp->to_node )
+                        eng = eng + m_smoothFn(i,temp->to_node, m_answer[i],m_answer[temp->to_node]);
                 }
-            }
         }
         
     }
@@ -225,98 +221,97 @@ void ICM::setCues(CostVal* hCue, CostVal* vCue)
 }
 
 
-void ICM::optimizeAlg(int nIterations)
+void ICM::setParallel(bool PARALLEL)
 {
-    int x, y, i, j, n;
-    Label* l;
-    CostVal* dataPtr;
+    m_parallel = PARALLEL;
+}
+
+// One sequential sweep over the pixels of a grid in raster order, walking the labels and
+// data costs by pointer. D is allocated here rather than passed in, so the compiler knows
+// that it does not alias the members read in the loop
+void ICM::sweepGrid()
+{
+    int x, y, i, j, n = 0;
+    Label* l = m_answer;
+    CostVal* dataPtr = m_D;
     CostVal *D = (CostVal *) new CostVal[m_nLabels];
     if ( !D ) {printf("\nNot enough memory, exiting");exit(0);}
 
-    if ( !m_grid_graph) {printf("\nICM is not implemented for nongrids yet!");exit(1);}
-
-    for ( ; nIterations > 0; nIterations --)
+    for (y=0; y<m_height; y++)
+    for (x=0; x<m_width; x++, l++, dataPtr+=m_nLabels, n++)
     {
-        n = 0;
-        l = m_answer;
-        dataPtr = m_D;
-
-        for (y=0; y<m_height; y++)
-        for (x=0; x<m_width; x++, l++, dataPtr+=m_nLabels, n++)
+        // set array D
+        if (m_dataType == FUNCTION)
         {
-            // set array D
-            if (m_dataType == FUNCTION)
+            for (i=0; i<m_nLabels; i++)
             {
-                for (i=0; i<m_nLabels; i++)
-                {
-                    D[i] = m_dataFn(x+y*m_width, i);
-                }
+                D[i] = m_dataFn(n, i);
             }
-            else memcpy(D, dataPtr, m_nLabels*sizeof(CostVal));
-            
+        }
+        else memcpy(D, dataPtr, m_nLabels*sizeof(CostVal));
+
 
-            // add smoothness costs
-            if (m_smoothType == FUNCTION)
+        // add smoothness costs
+        if (m_smoothType == FUNCTION)
+        {
+            if (x > 0)
             {
-                if (x > 0)
-                {
-                    j = *(l-1);
-                    for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(x+y*m_width-1, x+y*m_width, j, i);
-                }
-                if (y > 0)
-                {
-                    j = *(l-m_width);
-                    for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(x+y*m_width-m_width,x+y*m_width , j, i);
-                }
-                if (x < m_width-1)
-                {
-                    j = *(l+1);
-                    for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(x+y*m_width+1, x+y*m_width, i, j);
-                }
-                if (y < m_height-1)
-                {
-                    j = *(l+m_width);
-                    for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(x+y*m_width+m_width, x+y*m_width, i, j);
-                }
+                j = *(l-1);
+                for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(n-1, n, j, i);
             }
-            else
+            if (y > 0)
             {
-                if (x > 0)
-                {
-                    j = *(l-1);
-                    CostVal lambda = (m_varWeights) ? m_horizWeights[n-1] : 1;
-                    for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
-                }
-                if (y > 0)
-                {
-                    j = *(l-m_width);
-                    CostVal lambda = (m_varWeights) ? m_vertWeights[n-m_width] : 1;
-                    for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
-                }
-                if (x < m_width-1)
-                {
-                    j = *(l+1);
-                    CostVal lambda = (m_varWeights) ? m_horizWeights[n] : 1;
-                    for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
-                }
-                if (y < m_height-1)
-                {
-                    j = *(l+m_width);
-                    CostVal lambda = (m_varWeights) ? m_vertWeights[n] : 1;
-                    for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
-                }
+                j = *(l-m_width);
+                for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(n-m_width, n, j, i);
             }
+            if (x < m_width-1)
+            {
+                j = *(l+1);
+                for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(n+1, n, i, j);
+            }
+            if (y < m_height-1)
+            {
+                j = *(l+m_width);
+                for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(n+m_width, n, i, j);
+            }
+        }
+        else
+        {
+            if (x > 0)
+            {
+                j = *(l-1);
+                CostVal lambda = (m_varWeights) ? m_horizWeights[n-1] : 1;
+                for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
+            }
+            if (y > 0)
+            {
+                j = *(l-m_width);
+                CostVal lambda = (m_varWeights) ? m_vertWeights[n-m_width] : 1;
+                for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
+            }
+            if (x < m_width-1)
+            {
+                j = *(l+1);
+                CostVal lambda = (m_varWeights) ? m_horizWeights[n] : 1;
+                for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
+            }
+            if (y < m_height-1)
+            {
+                j = *(l+m_width);
+                CostVal lambda = (m_varWeights) ? m_vertWeights[n] : 1;
+                for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
+            }
+        }
 
-            // compute minimum of D, set new label for (x,y)
-            CostVal D_min = D[0];
-            *l = 0;
-            for (i=1; i<m_nLabels; i++)
+        // compute minimum of D, set new label for (x,y)
+        CostVal D_min = D[0];
+        *l = 0;
+        for (i=1; i<m_nLabels; i++)
+        {
+            if (D_min > D[i])
             {
-                if (D_min > D[i])
-                {
-                    D_min = D[i];
-                    *l = i;
-                }
+                D_min = D[i];
+                *l = i;
             }
         }
     }
@@ -324,3 +319,213 @@ void ICM::optimizeAlg(int nIterations)
     delete[] D;
 }
 
+// Sets the label of grid pixel (x,y) to the best one given the labels of its neighbors,
+// for the checkerboard updates. D is scratch memory for m_nLabels costs
+void ICM::updateGridPixel(int x, int y, CostVal *D)
+{
+    int i, j, n = x+y*m_width;
+    Label *l = m_answer + n;
+
+    // set array D
+    if (m_dataType == FUNCTION)
+    {
+        for (i=0; i<m_nLabels; i++)
+        {
+            D[i] = m_dataFn(n, i);
+        }
+    }
+    else memcpy(D, &m_D(n,0), m_nLabels*sizeof(CostVal));
+    
+
+    // add smoothness costs
+    if (m_smoothType == FUNCTION)
+    {
+        if (x > 0)
+        {
+            j = *(l-1);
+            for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(n-1, n, j, i);
+        }
+        if (y > 0)
+        {
+            j = *(l-m_width);
+            for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(n-m_width, n, j, i);
+        }
+        if (x < m_width-1)
+        {
+            j = *(l+1);
+            for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(n+1, n, i, j);
+        }
+        if (y < m_height-1)
+        {
+            j = *(l+m_width);
+            for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(n+m_width, n, i, j);
+        }
+    }
+    else
+    {
+        if (x > 0)
+        {
+            j = *(l-1);
+            CostVal lambda = (m_varWeights) ? m_horizWeights[n-1] : 1;
+            for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
+        }
+        if (y > 0)
+        {
+            j = *(l-m_width);
+            CostVal lambda = (m_varWeights) ? m_vertWeights[n-m_width] : 1;
+            for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
+        }
+        if (x < m_width-1)
+        {
+            j = *(l+1);
+            CostVal lambda = (m_varWeights) ? m_horizWeights[n] : 1;
+            for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
+        }
+        if (y < m_height-1)
+        {
+            j = *(l+m_width);
+            CostVal lambda = (m_varWeights) ? m_vertWeights[n] : 1;
+            for (i=0; i<m_nLabels; i++) D[i] += lambda * m_V[j*m_nLabels + i];
+        }
+    }
+
+    setBestLabel(n, D);
+}
+
+// Same for pixel pix of a general neighborhood system
+void ICM::updatePixelNG(int pix, CostVal *D)
+{
+    Neighbor *temp;
+    int i, j;
+
+    if (m_dataType == FUNCTION)
+    {
+        for (i=0; i<m_nLabels; i++)
+        {
+            D[i] = m_dataFn(pix, i);
+        }
+    }
+    else memcpy(D, &m_D(pix,0), m_nLabels*sizeof(CostVal));
+
+    for (temp = m_neighbors->begin(pix); temp < m_neighbors->end(pix); temp++)
+    {
+        j = m_answer[temp->to_node];
+        if (m_smoothType == FUNCTION)
+        {
+            for (i=0; i<m_nLabels; i++) D[i] += m_smoothFn(temp->to_node, pix, j, i);
+        }
+        else
+        {
+            for (i=0; i<m_nLabels; i++) D[i] += temp->weight * m_V[j*m_nLabels + i];
+        }
+    }
+
+    setBestLabel(pix, D);
+}
+
+// compute minimum of D, set new label for pix
+void ICM::setBestLabel(int pix, CostVal *D)
+{
+    CostVal D_min = D[0];
+    Label best = 0;
+    for (int i=1; i<m_nLabels; i++)
+    {
+        if (D_min > D[i])
+        {
+            D_min = D[i];
+            best = i;
+        }
+    }
+    m_answer[pix] = best;
+}
+
+// Greedy coloring of a general neighborhood system: every pixel, in order, takes the
+// smallest color that none of its neighbors colored before it has. Pixels of one color
+// are then m_colorOrder[m_colorStart[c]] ... m_colorOrder[m_colorStart[c+1]-1]
+void ICM::colorNeighbors()
+{
+    int *color = new int[m_nPixels];
+    int *stamp = new int[m_nPixels+1];
+    if ( !color || !stamp ) {printf("\nNot enough memory, exiting");exit(0);}
+    Neighbor *temp;
+    int pix, c;
+
+    m_numColors = 0;
+    for (c=0; c<=m_nPixels; c++) stamp[c] = -1;
+    for (pix=0; pix<m_nPixels; pix++)
+    {
+        for (temp = m_neighbors->begin(pix); temp < m_neighbors->end(pix); temp++)
+        {
+            if (temp->to_node < pix) stamp[color[temp->to_node]] = pix;
+        }
+        for (c=0; stamp[c] == pix; c++) ;
+        color[pix] = c;
+        if (c >= m_numColors) m_numColors = c+1;
+    }
+
+    delete [] m_colorStart;
+    if ( !m_colorOrder ) m_colorOrder = new int[m_nPixels];
+    m_colorStart = new int[m_numColors+1];
+    memset(m_colorStart, 0, (m_numColors+1)*sizeof(int));
+    for (pix=0; pix<m_nPixels; pix++) m_colorStart[color[pix]+1]++;
+    for (c=0; c<m_numColors; c++) m_colorStart[c+1] += m_colorStart[c];
+    for (c=0; c<m_numColors; c++) stamp[c] = m_colorStart[c];   /* next place of color c */
+    for (pix=0; pix<m_nPixels; pix++) m_colorOrder[stamp[color[pix]]++] = pix;
+
+    delete [] color;
+    delete [] stamp;
+}
+
+// Sequentially ICM visits the pixels in order. In parallel it visits the pixels of
+// one color at a time, of which none are neighbors: on a grid the two colors of a
+// checkerboard, otherwise those of colorNeighbors(). Every update then still sets
+// a pixel to its best label given the labels of its neighbors, so the energy never
+// goes up, and the labels do not depend on the number of threads
+void ICM::optimizeAlg(int nIterations)
+{
+    int pix, c;
+    bool parallel = m_parallel && parallel_threads() > 1;
+    CostVal *D = (CostVal *) new CostVal[m_nLabels];
+    if ( !D ) {printf("\nNot enough memory, exiting");exit(0);}
+
+    if ( !m_grid_graph )
+    {
+        m_neighbors->build();
+        if ( parallel ) colorNeighbors();
+    }
+
+    for ( ; nIterations > 0; nIterations --)
+    {
+        if ( !parallel )
+        {
+            if ( m_grid_graph ) sweepGrid();
+            else
+            {
+                for (pix=0; pix<m_nPixels; pix++) updatePixelNG(pix, D);
+            }
+        }
+        else if ( m_grid_graph )
+        {
+            for (c=0; c<2; c++)
+                parallel_for(0, m_height, 0, [&](long first, long last)
+                {
+                    CostVal *Dt = new CostVal[m_nLabels];
+                    for (int y=(int)first; y<last; y++)
+                        for (int x=(y+c)%2; x<m_width; x+=2) updateGridPixel(x, y, Dt);
+                    delete [] Dt;
+                });
+        }
+        else
+        {
+            for (c=0; c<m_numColors; c++)
+                parallel_for(m_colorStart[c], m_colorStart[c+1], 0, [&](long first, long last)
+                {
+                    CostVal *Dt = new CostVal[m_nLabels];
+                    for (long k=first; k<last; k++) updatePixelNG(m_colorOrder[k], Dt);
+                    delete [] Dt;
+                });
+        }
+    }
+
+    delete[] D;
+}
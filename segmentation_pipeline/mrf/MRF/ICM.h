@@ -6,7 +6,7 @@
 #include <string.h>
 #include <assert.h>
 #include "mrf.h"
-#include "LinkedBlockList.h"
+#include "neighbors.h"
 
 
 class ICM : public MRF{
@@ -15,6 +15,7 @@ public:
     ICM(int nPixels, int nLabels,EnergyFunction *eng);
     ~ICM();
     void setNeighbors(int pix1, int pix2, CostVal weight);
+    void setNeighbors(int numEdges, int *pix1, int *pix2, CostVal *weights);
     Label getLabel(int pixel){return(m_answer[pixel]);};
     void setLabel(int pixel,Label label){m_answer[pixel] = label;};
     Label* getAnswerPtr(){return(m_answer);};
@@ -23,6 +24,12 @@ public:
     EnergyVal smoothnessEnergy();
     EnergyVal dataEnergy();
 
+    // Call this function with argument 1 to update the pixels in parallel, on the threads of
+    // the pipeline's pool (parallel.h), one color class at a time: the two checkerboard colors
+    // of a grid, or a greedy coloring of a general neighborhood system. The labels differ from
+    // those of the sequential order, but not with the number of threads.
+    void setParallel(bool PARALLEL);
+
 protected:
     void setData(DataCostFn dcost); 
     void setData(CostVal* data);    
@@ -30,7 +37,7 @@ protected:
     void setSmoothness(CostVal* V);
     void setSmoothness(int smoothExp,CostVal smoothMax, CostVal lambda);
     void setCues(CostVal* hCue, CostVal* vCue); 
-    void initializeAlg();
+    void initializeAlg() {};
     void optimizeAlg(int nIterations);
 
 private:
@@ -43,12 +50,21 @@ private:
     SmoothCostGeneralFn m_smoothFn;
     bool m_needToFreeV;
 
-    typedef struct NeighborStruct{
-        int     to_node;
-        CostVal weight;
-    } Neighbor;
+    typedef NeighborSystem<CostVal>::Neighbor Neighbor;
+
+    NeighborSystem<CostVal> *m_neighbors;
+
+    bool m_parallel;
+    int *m_colorOrder;  /* pixels sorted by color, for parallel updates on a general graph */
+    int *m_colorStart;  /* pixels of color c are m_colorOrder[m_colorStart[c]] ... m_colorOrder[m_colorStart[c+1]-1] */
+    int m_numColors;
 
-    LinkedBlockList *m_neighbors;
+    void initializeICM();
+    void sweepGrid();
+    void updateGridPixel(int x, int y, CostVal *D);
+    void updatePixelNG(int pix, CostVal *D);
+    void setBestLabel(int pix, CostVal *D);
+    void colorNeighbors();
 };
 
 
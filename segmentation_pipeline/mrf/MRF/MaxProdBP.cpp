@@ -5,6 +5,7 @@
 #include <math.h>
 #include "MaxProdBP.h"
 #include "regions-new.h"
+#include "parallel.h"
 
 #define m_D(pix,l)  m_D[(pix)*m_nLabels+(l)]
 #define m_V(l1,l2)  m_V[(l1)*m_nLabels+(l2)]
@@ -26,6 +27,8 @@ MaxProdBP::MaxProdBP(int nPixels, int nLabels,EnergyFunction *eng):MRF(nPixels,n
 MaxProdBP::~MaxProdBP()
 { 
 	delete[] m_answer;
+	delete[] nodeArray;
+	if (m_ExpData) delete[] m_ExpData;
 	if (m_message_chunk) delete[] m_message_chunk;
 	if (!m_grid_graph) delete[] m_neighbors;
 	if ( m_needToFreeV ) delete[] m_V;
@@ -41,14 +44,16 @@ void MaxProdBP::BPinitializeAlg()
 	m_answer = (Label *) new Label[m_nPixels];
 	if ( !m_answer ){printf("\nNot enough memory, exiting");exit(0);}
 
-	m_scratchMatrix = new FLOATTYPE[m_nLabels * m_nLabels];
-	// MEMORY LEAK? where does this ever get deleted??
-
 	nodeArray =     new OneNodeCluster[m_nPixels];
-	// MEMORY LEAK? where does this ever get deleted??
 
 	OneNodeCluster::numStates = m_nLabels;
 
+	m_ExpData = NULL;
+	m_message_chunk = NULL;
+	m_parallel = false;
+	m_scratch = NULL;
+	m_numScratch = 0;
+
 	if (!m_grid_graph)
 	{
 	  assert(0);
@@ -130,9 +135,25 @@ bool MaxProdBP::varWeights()
   return m_varWeights;
 }
 
-FLOATTYPE *MaxProdBP::getScratchMatrix()
+void MaxProdBP::setParallel(bool PARALLEL)
 {
-  return m_scratchMatrix;
+  m_parallel = PARALLEL;
+}
+
+// Takes the scratch memory of num threads from m_scratchArena, once for all iterations
+void MaxProdBP::allocateScratch(int num)
+{
+  m_scratchArena.reset();
+  m_scratch = m_scratchArena.New<MsgScratch>(num);
+  for(int i = 0; i < num; i++)
+  {
+    m_scratch[i].msgProd = m_scratchArena.New<FLOATTYPE>(m_nLabels);
+    m_scratch[i].nextMsg = m_scratchArena.New<FLOATTYPE>(m_nLabels);
+    m_scratch[i].z = m_scratchArena.New<FLOATTYPE>(m_nLabels+1);
+    m_scratch[i].psiMat = m_scratchArena.New<FLOATTYPE>(m_nLabels*m_nLabels);
+    m_scratch[i].v = m_scratchArena.New<int>(m_nLabels);
+  }
+  m_numScratch = num;
 }
 
 void MaxProdBP::clearAnswer()
@@ -235,8 +256,8 @@ void MaxProdBP::setData(DataCostFn dcost)
   m_dataFn = dcost;
   int i;
   int j;
+  if (m_ExpData) delete[] m_ExpData;
   m_ExpData = new FloatType[m_nPixels * m_nLabels];
-  // MEMORY LEAK? where does this ever get deleted??
   if(!m_ExpData)
   {
     exit(0);
@@ -261,8 +282,8 @@ void MaxProdBP::setData(CostVal* data)
   int i;
   int j;
   m_D = data;
+  if (m_ExpData) delete[] m_ExpData;
   m_ExpData = new FloatType[m_nPixels * m_nLabels];
-  // MEMORY LEAK? where does this ever get deleted??
   if(!m_ExpData)
   {
     exit(0);
@@ -339,16 +360,32 @@ void MaxProdBP::optimizeAlg(int nIterations)
 	int numRows = getHeight();
 	int numCols = getWidth();
 	const FLOATTYPE alpha = 0.8f;
-	for (int niter=0; niter < nIterations; niter++)
+
+	// the rows (columns) are cut into one band per thread, which uses its own scratch memory
+	int numBands = (m_parallel && parallel_threads() > 1) ? parallel_threads() : 1;
+	if (numBands > m_numScratch) allocateScratch(numBands);
+
+	auto bands = [&](int numLines, void (*computeMessages)(OneNodeCluster *, const int, const int, const int,
+								  const FLOATTYPE, MaxProdBP *, MsgScratch *))
 	{
-	  for(int r = 0; r < numRows; r++)
+	  if (numBands == 1)
 	  {
-	    computeMessagesLeftRight(nodeArray, numCols, numRows, r, alpha, this);
+	    for(int i = 0; i < numLines; i++)
+	      computeMessages(nodeArray, numCols, numRows, i, alpha, this, &m_scratch[0]);
+	    return;
 	  }
-	  for(int c = 0; c < numCols; c++)
+	  parallel_for(0, numBands, 1, [&](long first, long last)
 	  {
-	    computeMessagesUpDown(nodeArray, numCols, numRows, c, alpha, this);
-	  }
+	    for(long b = first; b < last; b++)
+	      for(int i = (int)(b*numLines/numBands); i < (int)((b+1)*numLines/numBands); i++)
+		computeMessages(nodeArray, numCols, numRows, i, alpha, this, &m_scratch[b]);
+	  });
+	};
+
+	for (int niter=0; niter < nIterations; niter++)
+	{
+	  bands(numRows, computeMessagesLeftRight);
+	  bands(numCols, computeMessagesUpDown);
 	}
 
       
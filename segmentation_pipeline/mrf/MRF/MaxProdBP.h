@@ -7,6 +7,7 @@
 #include <assert.h>
 #include "mrf.h"
 #include "LinkedBlockList.h"
+#include "arena.h"
 #include "regions-new.h"
 
 #define FloatType float
@@ -29,12 +30,16 @@ public:
   EnergyFunction *getEnergyFunction();
   int getWidth();
   int getHeight();
-  FLOATTYPE *getScratchMatrix();
   int getNLabels();
   bool varWeights();
   void setExpScale(int expScale);
   friend void getPsiMat(OneNodeCluster &cluster, FLOATTYPE *&destMatrix, 
-			int r, int c, MaxProdBP *mrf, int direction, FLOATTYPE &var_weight);
+			int r, int c, MaxProdBP *mrf, int direction, FLOATTYPE &var_weight, MsgScratch *scratch);
+
+  // Call this function with argument 1 to compute the messages of the rows (columns) of
+  // a grid in parallel, on the threads of the pipeline's pool (parallel.h). The rows are
+  // independent in each half of an iteration, so the result is the same.
+  void setParallel(bool PARALLEL);
 
   InputType getSmoothType();
   FLOATTYPE getExpV(int i);
@@ -79,10 +84,14 @@ private:
 	DataCostFn m_dataFn;
 	SmoothCostGeneralFn m_smoothFn;
 	bool m_needToFreeV;
-  FLOATTYPE *m_scratchMatrix;
   FLOATTYPE *m_ExpData;
-  FLOATTYPE *m_message_chunk;
+  FLOATTYPE *m_message_chunk;   // the 4 received messages of every node, in one array
   OneNodeCluster *nodeArray;
+  bool m_parallel;
+  Arena m_scratchArena;         // holds m_scratch
+  MsgScratch *m_scratch;        // one per thread computing messages
+  int m_numScratch;
+  void allocateScratch(int num);
   typedef struct NeighborStruct {
     int     to_node;
     CostVal weight;
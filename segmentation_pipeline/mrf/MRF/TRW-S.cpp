@@ -3,7 +3,11 @@
 #include <string.h>
 #include <assert.h>
 #include <new>
+#include <algorithm>
+#include <functional>
 #include "TRW-S.h"
+#include "vecops.h"
+#include "parallel.h"
 
 #define private public
 #include "typeTruncatedQuadratic2D.h"
@@ -26,34 +30,66 @@
 
 inline void CopyVector(TRWS::REAL* to, MRF::CostVal* from, int K)
 {
-    TRWS::REAL* to_finish = to + K;
-    do
-	{
-	    *to ++ = *from ++;
-	} while (to < to_finish);
+    VecCopy(to, from, K);
 }
 
 inline void AddVector(TRWS::REAL* to, TRWS::REAL* from, int K)
 {
-    TRWS::REAL* to_finish = to + K;
-    do
-	{
-	    *to ++ += *from ++;
-	} while (to < to_finish);
+    VecAdd(to, from, K);
 }
 
 inline TRWS::REAL SubtractMin(TRWS::REAL *D, int K)
 {
-    int k;
     TRWS::REAL delta;
 	
-    delta = D[0];
-    for (k=1; k<K; k++) TRUNCATE(delta, D[k]);
-    for (k=0; k<K; k++) D[k] -= delta;
+    delta = VecMin(D, K);
+    VecSubtract(D, delta, K);
 
     return delta;
 }
 
+// A packed message (TRWS::compressMessages()) is its minimum and scale as floats,
+// followed by K unsigned shorts: M[k] = minimum + q[k]*scale
+
+inline void PackMessage(char* P, TRWS::REAL* M, int K)
+{
+    float* header = (float*) P;
+    unsigned short* q = (unsigned short*) (P + 2*sizeof(float));
+    TRWS::REAL lo = M[0], hi = M[0], scale;
+    int k;
+
+    for (k=1; k<K; k++)
+	{
+	    TRUNCATE_MIN(lo, M[k]);
+	    TRUNCATE_MAX(hi, M[k]);
+	}
+    header[0] = (float) lo;
+    scale = (hi - header[0]) / 65535;
+    header[1] = (float) scale;
+
+    if (header[1] <= 0)
+	{
+	    for (k=0; k<K; k++) q[k] = 0;
+	    return;
+	}
+
+    TRWS::REAL inv = 1 / (TRWS::REAL) header[1];
+    for (k=0; k<K; k++)
+	{
+	    TRWS::REAL v = (M[k] - header[0]) * inv + (TRWS::REAL) 0.5;
+	    q[k] = (unsigned short) ((v < 0) ? 0 : (v > 65535) ? 65535 : v);
+	}
+}
+
+inline void UnpackMessage(TRWS::REAL* M, char* P, int K)
+{
+    float* header = (float*) P;
+    unsigned short* q = (unsigned short*) (P + 2*sizeof(float));
+    TRWS::REAL lo = header[0], scale = header[1];
+
+    for (int k=0; k<K; k++) M[k] = lo + q[k]*scale;
+}
+
 // Functions UpdateMessageTYPE (see the paper for details):
 //
 // - Set Di[ki] := gamma*Di_hat[ki] - M[ki]
@@ -71,9 +107,15 @@ inline TRWS::REAL SubtractMin(TRWS::REAL *D, int K)
 
 inline TRWS::REAL UpdateMessageL1(TRWS::REAL* M, TRWS::REAL* Di_hat, int K, TRWS::REAL gamma, MRF::CostVal lambda, MRF::CostVal smoothMax)
 {
-    int k;
     TRWS::REAL delta;
 
+#ifdef __AVX2__
+    delta = VecDiffMin(M, Di_hat, M, gamma, K);
+    VecDistanceL1(M, (TRWS::REAL)lambda, delta, (TRWS::REAL)(lambda*smoothMax), K);
+#else
+    /* one pass for the difference, its minimum and the forward scan */
+    int k;
+
     delta = M[0] = gamma*Di_hat[0] - M[0];
     for (k=1; k<K; k++)
 	{
@@ -90,6 +132,7 @@ inline TRWS::REAL UpdateMessageL1(TRWS::REAL* M, TRWS::REAL* Di_hat, int K, TRWS
 	    TRUNCATE(M[k], M[k+1] + lambda);
 	    TRUNCATE(M[k], lambda*smoothMax);
 	}
+#endif
 
     return delta;
 }
@@ -103,6 +146,10 @@ inline TRWS::REAL UpdateMessageL2(TRWS::REAL* M, TRWS::REAL* Di_hat, int K, TRWS
     TRWS::REAL* Di = (TRWS::REAL*) buf;
     int* parabolas = (int*) ((char*)buf + K*sizeof(TRWS::REAL));
     int* intersections = parabolas + K;
+#ifdef TRWS_FLOAT
+    TypeTruncatedQuadratic2D::REAL* Di_tmp = (TypeTruncatedQuadratic2D::REAL*) (intersections + K + 1);
+    TypeTruncatedQuadratic2D::REAL* M_tmp = Di_tmp + K;
+#endif
     TypeTruncatedQuadratic2D::Edge* tmp = NULL;
 
     int k;
@@ -110,13 +157,7 @@ inline TRWS::REAL UpdateMessageL2(TRWS::REAL* M, TRWS::REAL* Di_hat, int K, TRWS
 
     assert(lambda >= 0);
 
-    Di[0] = gamma*Di_hat[0] - M[0];
-    delta = Di[0];
-    for (k=1; k<K; k++)
-	{
-	    Di[k] = gamma*Di_hat[k] - M[k];
-	    TRUNCATE(delta, Di[k]);
-	}
+    delta = VecDiffMin(Di, Di_hat, M, gamma, K);
 
     if (lambda == 0)
 	{
@@ -124,13 +165,15 @@ inline TRWS::REAL UpdateMessageL2(TRWS::REAL* M, TRWS::REAL* Di_hat, int K, TRWS
 	    return delta;
 	}
 
+#ifdef TRWS_FLOAT
+    for (k=0; k<K; k++) Di_tmp[k] = Di[k];
+    tmp->DistanceTransformL2(K, 1, lambda, Di_tmp, M_tmp, parabolas, intersections);
+    for (k=0; k<K; k++) M[k] = (TRWS::REAL) M_tmp[k];
+#else
     tmp->DistanceTransformL2(K, 1, lambda, Di, M, parabolas, intersections);
+#endif
 
-    for (k=0; k<K; k++)
-	{
-	    M[k] -= delta;
-	    TRUNCATE(M[k], lambda*smoothMax);
-	}
+    VecSubtractTruncate(M, delta, (TRWS::REAL)(lambda*smoothMax), K);
 
     return delta;
 }
@@ -165,16 +208,9 @@ inline TRWS::REAL UpdateMessageFIXED_MATRIX(TRWS::REAL* M, TRWS::REAL* Di_hat, i
 
     if (lambda > 0)
 	{
-	    for (kj=0; kj<K; kj++)
+	    for (kj=0; kj<K; kj++, V+=K)
 		{
-		    M[kj] = Di[0] + V[0]; 
-		    V ++;
-		    for (ki=1; ki<K; ki++)
-			{
-			    TRUNCATE(M[kj], Di[ki] + V[0]);
-			    V ++;
-			}
-		    M[kj] *= lambda;
+		    M[kj] = VecMinSum(Di, V, (TRWS::REAL)1, K) * lambda;
 		}
 	}
     else
@@ -192,11 +228,7 @@ inline TRWS::REAL UpdateMessageFIXED_MATRIX(TRWS::REAL* M, TRWS::REAL* Di_hat, i
 		}
 	}
 
-    delta = M[0];
-    for (kj=1; kj<K; kj++) TRUNCATE(delta, M[kj]);
-    for (kj=0; kj<K; kj++) M[kj] -= delta;
-
-    return delta;
+    return SubtractMin(M, K);
 }
 
 /////////////////////////////////////////////
@@ -207,24 +239,14 @@ inline TRWS::REAL UpdateMessageGENERAL(TRWS::REAL* M, TRWS::REAL* Di_hat, int K,
 {
     TRWS::REAL* Di = (TRWS::REAL*) buf;
     int ki, kj;
-    TRWS::REAL delta;
 
-    for (ki=0; ki<K; ki++)
-	{
-	    Di[ki] = (gamma*Di_hat[ki] - M[ki]);
-	}
+    VecDiffMin(Di, Di_hat, M, gamma, K);
 
     if (dir == 0)
 	{
-	    for (kj=0; kj<K; kj++)
+	    for (kj=0; kj<K; kj++, V+=K)
 		{
-		    M[kj] = Di[0] + V[0]; 
-		    V ++;
-		    for (ki=1; ki<K; ki++)
-			{
-			    TRUNCATE(M[kj], Di[ki] + V[0]);
-			    V ++;
-			}
+		    M[kj] = VecMinSum(Di, V, (TRWS::REAL)1, K);
 		}
 	}
     else
@@ -242,11 +264,7 @@ inline TRWS::REAL UpdateMessageGENERAL(TRWS::REAL* M, TRWS::REAL* Di_hat, int K,
 		}
 	}
 
-    delta = M[0];
-    for (kj=1; kj<K; kj++) TRUNCATE(delta, M[kj]);
-    for (kj=0; kj<K; kj++) M[kj] -= delta;
-
-    return delta;
+    return SubtractMin(M, K);
 }
 
 inline TRWS::REAL UpdateMessageGENERAL(TRWS::REAL* M, TRWS::REAL* Di_hat, int K, TRWS::REAL gamma, TRWS::SmoothCostGeneralFn fn, int i, int j, void* buf)
@@ -297,6 +315,7 @@ TRWS::~TRWS()
     if ( m_needToFreeD ) delete [] m_D;
     if ( m_needToFreeV ) delete [] m_V;
     if ( m_messages ) delete [] m_messages;
+    if ( m_packed ) delete [] m_packed;
     if ( m_DBinary ) delete [] m_DBinary;
     if ( m_horzWeightsBinary ) delete [] m_horzWeightsBinary;
     if ( m_vertWeightsBinary ) delete [] m_vertWeightsBinary;
@@ -318,7 +337,11 @@ void TRWS::Allocate()
 
     m_DBinary = NULL;
     m_messages = NULL;
+    m_packed = NULL;
+    m_packedStride = 0;
+    m_compressMessages = false;
     m_messageArraySizeInBytes = 0;
+    m_parallel = false;
 
     m_answer = new Label[m_nPixels];
 }
@@ -330,6 +353,10 @@ void TRWS::clearAnswer()
 	{
 	    memset(m_messages, 0, m_messageArraySizeInBytes);
 	}
+    if (m_packed)
+	{
+	    memset(m_packed, 0, m_messageArraySizeInBytes);
+	}
 }
 
 
@@ -524,11 +551,21 @@ void TRWS::initializeAlg()
 	    m_type = BINARY;
 	}
 
-    // allocate messages
-    int messageNum = (m_type == BINARY) ? 4*m_nPixels : 4*m_nPixels*m_nLabels;
-    m_messageArraySizeInBytes = messageNum*sizeof(REAL);
-    m_messages = new REAL[messageNum];
-    memset(m_messages, 0, messageNum*sizeof(REAL));
+    // allocate messages, one per edge
+    if (m_compressMessages && m_type != BINARY)
+	{
+	    m_packedStride = 2*sizeof(float) + ((m_nLabels+1)&~1)*sizeof(unsigned short);
+	    m_messageArraySizeInBytes = 2*(size_t)m_nPixels*m_packedStride;
+	    m_packed = new char[m_messageArraySizeInBytes];
+	    memset(m_packed, 0, m_messageArraySizeInBytes);
+	}
+    else
+	{
+	    size_t messageNum = (m_type == BINARY) ? 2*(size_t)m_nPixels : 2*(size_t)m_nPixels*m_nLabels;
+	    m_messageArraySizeInBytes = messageNum*sizeof(REAL);
+	    m_messages = new REAL[messageNum];
+	    memset(m_messages, 0, m_messageArraySizeInBytes);
+	}
 
     if (m_type == BINARY)
 	{
@@ -589,19 +626,19 @@ void TRWS::optimizeAlg(int nIterations)
 	{
 	    int x, y, n, K = m_nLabels;
 	    CostVal* D_ptr;
-	    REAL* M_ptr;
 	    REAL* Di;
+	    REAL* tmp;
 	    REAL delta;
 	    int ki, kj;
 
 	    Di = new REAL[K];
+	    tmp = new REAL[K];
 
 	    n = 0;
 	    D_ptr = m_D;
-	    M_ptr = m_messages;
 
 	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, D_ptr+=K, M_ptr+=2*K, n++)
+		for (x=0; x<m_width; x++, D_ptr+=K, n++)
 		    {
 			CopyVector(Di, D_ptr, K);
 
@@ -670,8 +707,8 @@ void TRWS::optimizeAlg(int nIterations)
 				    }
 			    }
 
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+			if (x < m_width-1) AddVector(Di, message(n, 1, tmp), K); // message (x+1,y)->(x,y)
+			if (y < m_height-1) AddVector(Di, message(n, 0, tmp), K); // message (x,y+1)->(x,y)
 
 			// compute min
 			delta = Di[0];
@@ -687,6 +724,7 @@ void TRWS::optimizeAlg(int nIterations)
 		    }
 
 	    delete [] Di;
+	    delete [] tmp;
 	}
     else // m_type == BINARY
 	{
@@ -695,17 +733,18 @@ void TRWS::optimizeAlg(int nIterations)
 	    REAL Di;
 
 	    n = 0;
-	    M_ptr = m_messages;
 
 	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, M_ptr+=2, n++)
+		for (x=0; x<m_width; x++, n++)
 		    {
+			M_ptr = m_messages + 2*n;
+
 			Di = m_DBinary[n];
 			if (x > 0) Di += (m_answer[n-1] == 0)       ? m_horzWeightsBinary[n-1]       : -m_horzWeightsBinary[n-1];
 			if (y > 0) Di += (m_answer[n-m_width] == 0) ? m_vertWeightsBinary[n-m_width] : -m_vertWeightsBinary[n-m_width];
 
-			if (x < m_width-1)  Di += M_ptr[0]; // message (x+1,y)->(x,y)
-			if (y < m_height-1) Di += M_ptr[1]; // message (x,y+1)->(x,y)
+			if (x < m_width-1)  Di += M_ptr[1]; // message (x+1,y)->(x,y)
+			if (y < m_height-1) Di += M_ptr[0]; // message (x,y+1)->(x,y)
 
 			// compute min
 			m_answer[n] = (Di >= 0) ? 0 : 1;
@@ -713,223 +752,325 @@ void TRWS::optimizeAlg(int nIterations)
 	}
 }
 
-void TRWS::optimize_GRID_L1(int nIterations)
+/////////////////////////////////////////////////////////////////////////////
+//                  Forward and backward passes                            //
+/////////////////////////////////////////////////////////////////////////////
+
+// Message slot (0: down, 1: right) of a block. Packed messages are unpacked into tmp (N values)
+inline TRWS::REAL* TRWS::message(int block, int slot, REAL* tmp)
 {
-    int x, y, n, K = m_nLabels;
-    CostVal* D_ptr;
-    REAL* M_ptr;
-    REAL* Di;
+    size_t m = 2*(size_t)block + slot;
 
-    Di = new REAL[K];
+    if (!m_packed) return m_messages + m*((m_type == BINARY) ? 1 : m_nLabels);
 
-    for ( ; nIterations > 0; nIterations --)
-	{
-	    // forward pass
-	    n = 0;
-	    D_ptr = m_D;
-	    M_ptr = m_messages;
+    UnpackMessage(tmp, m_packed + m*m_packedStride, m_nLabels);
+    return tmp;
+}
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, D_ptr+=K, M_ptr+=2*K, n++)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+// Writes back a message returned by message() after it was updated
+inline void TRWS::storeMessage(int block, int slot, REAL* M)
+{
+    if (m_packed) PackMessage(m_packed + (2*(size_t)block + slot)*m_packedStride, M, m_nLabels);
+}
 
-			if (x < m_width-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n] : m_lambda;
-				UpdateMessageL1(M_ptr, Di, K, 0.5, lambda, m_smoothMax);
-			    }
-			if (y < m_height-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n] : m_lambda;
-				UpdateMessageL1(M_ptr+K, Di, K, 0.5, lambda, m_smoothMax);
-			    }
-		    }
+// Calls pixel(x, y, n, M, Di, buf, lowerBound) for the pixels of the tile [x0,x1) x [y0,y1),
+// in raster order for a forward pass and in reverse raster order for a backward pass. M[0], ..., M[3] are the messages on the edges of (x,y) to
+// (x-1,y), (x,y-1), (x+1,y) and (x,y+1), of which only those inside the grid are valid.
+// Di (K values) and buf (bufSize bytes) are scratch arrays of the calling thread.
+// Returns the sum that the calls added to lowerBound.
+template <class Pixel> double TRWS::sweepTile(bool forward, int bufSize, Pixel& pixel, int x0, int y0, int x1, int y1)
+{
+    int N = (m_type == BINARY) ? 1 : m_nLabels;
+    REAL* Di = new REAL[m_nLabels];
+    REAL* tmp = new REAL[4*N];
+    char* buf = new char[(bufSize > 0) ? bufSize : 1];
+    double lowerBound = 0;
+    REAL* M[4];
+    int x, y;
+
+    // the blocks of (x,y) and of its left and upper neighbors are n, n-1 and n-m_width
+    // (n itself outside the grid), so unpacked messages are addressed directly
+    auto visit = [&](int x, int y)
+	{
+	    int n = x+y*m_width;
+	    int left = (x > 0) ? n-1 : n;
+	    int up = (y > 0) ? n-m_width : n;
 
-	    // backward pass
-	    m_lowerBound = 0;
+	    if (!m_packed)
+		{
+		    REAL* B = m_messages + 2*(size_t)n*N;
+		    M[0] = m_messages + (2*(size_t)left+1)*N;
+		    M[1] = m_messages + 2*(size_t)up*N;
+		    M[2] = B + N;
+		    M[3] = B;
+		    pixel(x, y, n, M, Di, buf, lowerBound);
+		    return;
+		}
 
-	    n --;
-	    D_ptr -= K;
-	    M_ptr -= 2*K;
+	    M[0] = message(left, 1, tmp);
+	    M[1] = message(up, 0, tmp+N);
+	    M[2] = message(n, 1, tmp+2*N);
+	    M[3] = message(n, 0, tmp+3*N);
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, D_ptr-=K, M_ptr-=2*K, n--)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+	    pixel(x, y, n, M, Di, buf, lowerBound);
 
-			m_lowerBound += SubtractMin(Di, K);
+	    if (forward)
+		{
+		    if (x < m_width-1) storeMessage(n, 1, M[2]);
+		    if (y < m_height-1) storeMessage(n, 0, M[3]);
+		}
+	    else
+		{
+		    if (x > 0) storeMessage(left, 1, M[0]);
+		    if (y > 0) storeMessage(up, 0, M[1]);
+		}
+	};
 
-			if (x > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n-1] : m_lambda;
-				m_lowerBound += UpdateMessageL1(M_ptr-2*K, Di, K, 0.5, lambda, m_smoothMax);
-			    }
-			if (y > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n-m_width] : m_lambda;
-				m_lowerBound += UpdateMessageL1(M_ptr-(2*m_width-1)*K, Di, K, 0.5, lambda, m_smoothMax);
-			    }
-		    }
+    if (forward)
+	{
+	    for (y=y0; y<y1; y++)
+		for (x=x0; x<x1; x++) visit(x, y);
+	}
+    else
+	{
+	    for (y=y1-1; y>=y0; y--)
+		for (x=x1-1; x>=x0; x--) visit(x, y);
 	}
 
     delete [] Di;
+    delete [] tmp;
+    delete [] buf;
+
+    return lowerBound;
 }
 
-void TRWS::optimize_GRID_L2(int nIterations)
+// One forward or backward pass over the grid. Serially it is one tile. In parallel the
+// grid is cut into tiles of TRWS_TILE x TRWS_TILE pixels, and the tiles on one
+// anti-diagonal run at once, after all tiles of the diagonal before them (a wavefront).
+// A pixel then still comes after its left and upper neighbors and before its right and
+// lower ones, and tiles on one diagonal have no adjacent pixels, so every message goes
+// through the same updates as in the sequential pass.
+template <class Pixel> double TRWS::sweep(bool forward, int bufSize, Pixel& pixel)
 {
-    int x, y, n, K = m_nLabels;
-    CostVal* D_ptr;
-    REAL* M_ptr;
-    REAL* Di;
-    void* buf;
+    int tilesX = (m_width + TRWS_TILE - 1) / TRWS_TILE;
+    int tilesY = (m_height + TRWS_TILE - 1) / TRWS_TILE;
+    int numDiagonals = tilesX + tilesY - 1, d;
+    double lowerBound = 0;
 
-    Di = new REAL[K];
-    buf = new char[(2*K+1)*sizeof(int) + K*sizeof(REAL)];
+    auto tile = [&](int tx, int ty)
+	{
+	    return sweepTile(forward, bufSize, pixel, tx*TRWS_TILE, ty*TRWS_TILE,
+			     std::min((tx+1)*TRWS_TILE, m_width), std::min((ty+1)*TRWS_TILE, m_height));
+	};
 
-    for ( ; nIterations > 0; nIterations --)
+    if (!m_parallel || parallel_threads() < 2 || tilesX < 2 || tilesY < 2)
 	{
-	    // forward pass
-	    n = 0;
-	    D_ptr = m_D;
-	    M_ptr = m_messages;
+	    return sweepTile(forward, bufSize, pixel, 0, 0, m_width, m_height);
+	}
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, D_ptr+=K, M_ptr+=2*K, n++)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+    for (d=0; d<numDiagonals; d++)
+	{
+	    int diagonal = (forward) ? d : numDiagonals-1-d;
+	    int tx0 = std::max(0, diagonal-(tilesY-1));
+	    int tx1 = std::min(tilesX-1, diagonal);
 
-			if (x < m_width-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n] : m_lambda;
-				UpdateMessageL2(M_ptr, Di, K, 0.5, lambda, m_smoothMax, buf);
-			    }
-			if (y < m_height-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n] : m_lambda;
-				UpdateMessageL2(M_ptr+K, Di, K, 0.5, lambda, m_smoothMax, buf);
-			    }
-		    }
+	    // tiles are summed in a fixed order, so the lower bound does not depend on the threads
+	    lowerBound += parallel_reduce(tx0, tx1+1, 1, 0.0, [&](long first, long last)
+		{
+		    double sum = 0;
+		    for (long tx=first; tx<last; tx++) sum += tile((int)tx, diagonal-(int)tx);
+		    return sum;
+		}, std::plus<double>());
+	}
 
-	    // backward pass
-	    m_lowerBound = 0;
+    return lowerBound;
+}
 
-	    n --;
-	    D_ptr -= K;
-	    M_ptr -= 2*K;
+void TRWS::setParallel(bool PARALLEL)
+{
+    m_parallel = PARALLEL;
+}
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, D_ptr-=K, M_ptr-=2*K, n--)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+void TRWS::optimize_GRID_L1(int nIterations)
+{
+    int K = m_nLabels;
 
-			m_lowerBound += SubtractMin(Di, K);
+    auto forward = [&](int x, int y, int n, REAL** M, REAL* Di, void* /*buf*/, double& /*lowerBound*/)
+	{
+	    CostVal* D_ptr = m_D + n*K;
 
-			if (x > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n-1] : m_lambda;
-				m_lowerBound += UpdateMessageL2(M_ptr-2*K, Di, K, 0.5, lambda, m_smoothMax, buf);
-			    }
-			if (y > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n-m_width] : m_lambda;
-				m_lowerBound += UpdateMessageL2(M_ptr-(2*m_width-1)*K, Di, K, 0.5, lambda, m_smoothMax, buf);
-			    }
-		    }
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M[0], K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M[1], K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M[2], K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M[3], K); // message (x,y+1)->(x,y)
+
+	    if (x < m_width-1) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n] : m_lambda;
+		    UpdateMessageL1(M[2], Di, K, 0.5, lambda, m_smoothMax);
+		}
+	    if (y < m_height-1) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n] : m_lambda;
+		    UpdateMessageL1(M[3], Di, K, 0.5, lambda, m_smoothMax);
+		}
+	};
+
+    auto backward = [&](int x, int y, int n, REAL** M, REAL* Di, void* /*buf*/, double& lowerBound)
+	{
+	    CostVal* D_ptr = m_D + n*K;
+
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M[0], K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M[1], K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M[2], K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M[3], K); // message (x,y+1)->(x,y)
+
+	    lowerBound += SubtractMin(Di, K);
+
+	    if (x > 0) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n-1] : m_lambda;
+		    lowerBound += UpdateMessageL1(M[0], Di, K, 0.5, lambda, m_smoothMax);
+		}
+	    if (y > 0) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n-m_width] : m_lambda;
+		    lowerBound += UpdateMessageL1(M[1], Di, K, 0.5, lambda, m_smoothMax);
+		}
+	};
+
+    for ( ; nIterations > 0; nIterations --)
+	{
+	    sweep(true, 0, forward);
+	    m_lowerBound = sweep(false, 0, backward);
 	}
+}
 
-    delete [] Di;
-    delete [] (char *)buf;
+void TRWS::optimize_GRID_L2(int nIterations)
+{
+    int K = m_nLabels;
+    int bufSize = 2*K*sizeof(TypeTruncatedQuadratic2D::REAL) + (2*K+1)*sizeof(int) + K*sizeof(REAL);
+
+    auto forward = [&](int x, int y, int n, REAL** M, REAL* Di, void* buf, double& /*lowerBound*/)
+	{
+	    CostVal* D_ptr = m_D + n*K;
+
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M[0], K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M[1], K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M[2], K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M[3], K); // message (x,y+1)->(x,y)
+
+	    if (x < m_width-1) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n] : m_lambda;
+		    UpdateMessageL2(M[2], Di, K, 0.5, lambda, m_smoothMax, buf);
+		}
+	    if (y < m_height-1) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n] : m_lambda;
+		    UpdateMessageL2(M[3], Di, K, 0.5, lambda, m_smoothMax, buf);
+		}
+	};
+
+    auto backward = [&](int x, int y, int n, REAL** M, REAL* Di, void* buf, double& lowerBound)
+	{
+	    CostVal* D_ptr = m_D + n*K;
+
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M[0], K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M[1], K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M[2], K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M[3], K); // message (x,y+1)->(x,y)
+
+	    lowerBound += SubtractMin(Di, K);
+
+	    if (x > 0) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_lambda*m_horzWeights[n-1] : m_lambda;
+		    lowerBound += UpdateMessageL2(M[0], Di, K, 0.5, lambda, m_smoothMax, buf);
+		}
+	    if (y > 0) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_lambda*m_vertWeights[n-m_width] : m_lambda;
+		    lowerBound += UpdateMessageL2(M[1], Di, K, 0.5, lambda, m_smoothMax, buf);
+		}
+	};
+
+    for ( ; nIterations > 0; nIterations --)
+	{
+	    sweep(true, bufSize, forward);
+	    m_lowerBound = sweep(false, bufSize, backward);
+	}
 }
 
 
 void TRWS::optimize_GRID_BINARY(int nIterations)
 {
-    int x, y, n;
-    REAL* M_ptr;
-    REAL Di;
-
-    for ( ; nIterations > 0; nIterations --)
+    auto forward = [&](int x, int y, int n, REAL** M, REAL* /*Di*/, void* /*buf*/, double& /*lowerBound*/)
 	{
-	    // forward pass
-	    n = 0;
-	    M_ptr = m_messages;
+	    REAL Di;
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, M_ptr+=2, n++)
-		    {
-			Di = m_DBinary[n];
-			if (x > 0) Di += M_ptr[-2]; // message (x-1,y)->(x,y)
-			if (y > 0) Di += M_ptr[-2*m_width+1]; // message (x,y-1)->(x,y)
-			if (x < m_width-1) Di += M_ptr[0]; // message (x+1,y)->(x,y)
-			if (y < m_height-1) Di += M_ptr[1]; // message (x,y+1)->(x,y)
+	    Di = m_DBinary[n];
+	    if (x > 0) Di += M[0][0]; // message (x-1,y)->(x,y)
+	    if (y > 0) Di += M[1][0]; // message (x,y-1)->(x,y)
+	    if (x < m_width-1) Di += M[2][0]; // message (x+1,y)->(x,y)
+	    if (y < m_height-1) Di += M[3][0]; // message (x,y+1)->(x,y)
 
-			REAL DiScaled = Di * 0.5;
-			if (x < m_width-1) 
-			    {
-				Di = DiScaled - M_ptr[0];
-				CostVal lambda = m_horzWeightsBinary[n];
-				if (lambda < 0) { Di = -Di; lambda = -lambda; }
-				if (Di > lambda) M_ptr[0] = lambda;
-				else             M_ptr[0] = (Di < -lambda) ? -lambda : Di;
-			    }
-			if (y < m_height-1) 
-			    {
-				Di = DiScaled - M_ptr[1];
-				CostVal lambda = m_vertWeightsBinary[n];
-				if (lambda < 0) { Di = -Di; lambda = -lambda; }
-				if (Di > lambda) M_ptr[1] = lambda;
-				else             M_ptr[1] = (Di < -lambda) ? -lambda : Di;
-			    }
-		    }
+	    REAL DiScaled = Di * 0.5;
+	    if (x < m_width-1) 
+		{
+		    Di = DiScaled - M[2][0];
+		    CostVal lambda = m_horzWeightsBinary[n];
+		    if (lambda < 0) { Di = -Di; lambda = -lambda; }
+		    if (Di > lambda) M[2][0] = lambda;
+		    else             M[2][0] = (Di < -lambda) ? -lambda : Di;
+		}
+	    if (y < m_height-1) 
+		{
+		    Di = DiScaled - M[3][0];
+		    CostVal lambda = m_vertWeightsBinary[n];
+		    if (lambda < 0) { Di = -Di; lambda = -lambda; }
+		    if (Di > lambda) M[3][0] = lambda;
+		    else             M[3][0] = (Di < -lambda) ? -lambda : Di;
+		}
+	};
 
-	    // backward pass
-	    n --;
-	    M_ptr -= 2;
+    auto backward = [&](int x, int y, int n, REAL** M, REAL* /*Di*/, void* /*buf*/, double& /*lowerBound*/)
+	{
+	    REAL Di;
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, M_ptr-=2, n--)
-		    {
-			Di = m_DBinary[n];
-			if (x > 0) Di += M_ptr[-2]; // message (x-1,y)->(x,y)
-			if (y > 0) Di += M_ptr[-2*m_width+1]; // message (x,y-1)->(x,y)
-			if (x < m_width-1) Di += M_ptr[0]; // message (x+1,y)->(x,y)
-			if (y < m_height-1) Di += M_ptr[1]; // message (x,y+1)->(x,y)
+	    Di = m_DBinary[n];
+	    if (x > 0) Di += M[0][0]; // message (x-1,y)->(x,y)
+	    if (y > 0) Di += M[1][0]; // message (x,y-1)->(x,y)
+	    if (x < m_width-1) Di += M[2][0]; // message (x+1,y)->(x,y)
+	    if (y < m_height-1) Di += M[3][0]; // message (x,y+1)->(x,y)
 
-			REAL DiScaled = Di * 0.5;
-			if (x > 0) 
-			    {
-				Di = DiScaled - M_ptr[-2];
-				CostVal lambda = m_horzWeightsBinary[n-1];
-				if (lambda < 0) { Di = -Di; lambda = -lambda; }
-				if (Di > lambda) M_ptr[-2] = lambda;
-				else             M_ptr[-2] = (Di < -lambda) ? -lambda : Di;
-			    }
-			if (y > 0) 
-			    {
-				Di = DiScaled - M_ptr[-2*m_width+1];
-				CostVal lambda = m_vertWeightsBinary[n-m_width];
-				if (lambda < 0) { Di = -Di; lambda = -lambda; }
-				if (Di > lambda) M_ptr[-2*m_width+1] = lambda;
-				else             M_ptr[-2*m_width+1] = (Di < -lambda) ? -lambda : Di;
-			    }
-		    }
+	    REAL DiScaled = Di * 0.5;
+	    if (x > 0) 
+		{
+		    Di = DiScaled - M[0][0];
+		    CostVal lambda = m_horzWeightsBinary[n-1];
+		    if (lambda < 0) { Di = -Di; lambda = -lambda; }
+		    if (Di > lambda) M[0][0] = lambda;
+		    else             M[0][0] = (Di < -lambda) ? -lambda : Di;
+		}
+	    if (y > 0) 
+		{
+		    Di = DiScaled - M[1][0];
+		    CostVal lambda = m_vertWeightsBinary[n-m_width];
+		    if (lambda < 0) { Di = -Di; lambda = -lambda; }
+		    if (Di > lambda) M[1][0] = lambda;
+		    else             M[1][0] = (Di < -lambda) ? -lambda : Di;
+		}
+	};
+
+    for ( ; nIterations > 0; nIterations --)
+	{
+	    sweep(true, 0, forward);
+	    sweep(false, 0, backward);
 	}
 
     m_lowerBound = 0;
@@ -937,151 +1078,119 @@ void TRWS::optimize_GRID_BINARY(int nIterations)
 
 void TRWS::optimize_GRID_FIXED_MATRIX(int nIterations)
 {
-    int x, y, n, K = m_nLabels;
-    CostVal* D_ptr;
-    REAL* M_ptr;
-    REAL* Di;
-    void* buf;
+    int K = m_nLabels;
+    int bufSize = K*sizeof(REAL);
 
-    Di = new REAL[K];
-    buf = new REAL[K];
-
-    for ( ; nIterations > 0; nIterations --)
+    auto forward = [&](int x, int y, int n, REAL** M, REAL* Di, void* buf, double& /*lowerBound*/)
 	{
-	    // forward pass
-	    n = 0;
-	    D_ptr = m_D;
-	    M_ptr = m_messages;
+	    CostVal* D_ptr = m_D + n*K;
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, D_ptr+=K, M_ptr+=2*K, n++)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M[0], K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M[1], K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M[2], K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M[3], K); // message (x,y+1)->(x,y)
 
-			if (x < m_width-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_horzWeights[n] : 1;
-				UpdateMessageFIXED_MATRIX(M_ptr, Di, K, 0.5, lambda, m_V, buf);
-			    }
-			if (y < m_height-1) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_vertWeights[n] : 1;
-				UpdateMessageFIXED_MATRIX(M_ptr+K, Di, K, 0.5, lambda, m_V, buf);
-			    }
-		    }
+	    if (x < m_width-1) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_horzWeights[n] : 1;
+		    UpdateMessageFIXED_MATRIX(M[2], Di, K, 0.5, lambda, m_V, buf);
+		}
+	    if (y < m_height-1) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_vertWeights[n] : 1;
+		    UpdateMessageFIXED_MATRIX(M[3], Di, K, 0.5, lambda, m_V, buf);
+		}
+	};
 
-	    // backward pass
-	    m_lowerBound = 0;
+    auto backward = [&](int x, int y, int n, REAL** M, REAL* Di, void* buf, double& lowerBound)
+	{
+	    CostVal* D_ptr = m_D + n*K;
 
-	    n --;
-	    D_ptr -= K;
-	    M_ptr -= 2*K;
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M[0], K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M[1], K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M[2], K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M[3], K); // message (x,y+1)->(x,y)
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, D_ptr-=K, M_ptr-=2*K, n--)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+	    lowerBound += SubtractMin(Di, K);
 
-			m_lowerBound += SubtractMin(Di, K);
+	    if (x > 0) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_horzWeights[n-1] : 1;
+		    lowerBound += UpdateMessageFIXED_MATRIX(M[0], Di, K, 0.5, lambda, m_V, buf);
+		}
+	    if (y > 0) 
+		{
+		    CostVal lambda = (m_varWeights) ? m_vertWeights[n-m_width] : 1;
+		    lowerBound += UpdateMessageFIXED_MATRIX(M[1], Di, K, 0.5, lambda, m_V, buf);
+		}
+	};
 
-			if (x > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_horzWeights[n-1] : 1;
-				m_lowerBound += UpdateMessageFIXED_MATRIX(M_ptr-2*K, Di, K, 0.5, lambda, m_V, buf);
-			    }
-			if (y > 0) 
-			    {
-				CostVal lambda = (m_varWeights) ? m_vertWeights[n-m_width] : 1;
-				m_lowerBound += UpdateMessageFIXED_MATRIX(M_ptr-(2*m_width-1)*K, Di, K, 0.5, lambda, m_V, buf);
-			    }
-		    }
+    for ( ; nIterations > 0; nIterations --)
+	{
+	    sweep(true, bufSize, forward);
+	    m_lowerBound = sweep(false, bufSize, backward);
 	}
-
-    delete [] Di;
-    delete [] (REAL *)buf;
 }
 
 void TRWS::optimize_GRID_GENERAL(int nIterations)
 {
-    int x, y, n, K = m_nLabels;
-    CostVal* D_ptr;
-    REAL* M_ptr;
-    REAL* Di;
-    void* buf;
+    int K = m_nLabels;
+    int bufSize = K*sizeof(REAL);
 
-    Di = new REAL[K];
-    buf = new REAL[K];
-
-    for ( ; nIterations > 0; nIterations --)
+    auto forward = [&](int x, int y, int n, REAL** M, REAL* Di, void* buf, double& /*lowerBound*/)
 	{
-	    // forward pass
-	    n = 0;
-	    D_ptr = m_D;
-	    M_ptr = m_messages;
-	    CostVal* V_ptr = m_V;
+	    CostVal* D_ptr = m_D + n*K;
+	    CostVal* V_ptr = m_V + 2*n*K*K;
 
-	    for (y=0; y<m_height; y++)
-		for (x=0; x<m_width; x++, D_ptr+=K, M_ptr+=2*K, V_ptr+=2*K*K, n++)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M[0], K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M[1], K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M[2], K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M[3], K); // message (x,y+1)->(x,y)
 
-			if (x < m_width-1) 
-			    {
-				if (m_V) UpdateMessageGENERAL(M_ptr, Di, K, 0.5, /* forward dir*/ 0, V_ptr, buf);
-				else     UpdateMessageGENERAL(M_ptr, Di, K, 0.5,   m_smoothFn, n, n+1,      buf);
-			    }
-			if (y < m_height-1) 
-			    {
-				if (m_V) UpdateMessageGENERAL(M_ptr+K, Di, K, 0.5, /* forward dir*/ 0, V_ptr+K*K, buf);
-				else     UpdateMessageGENERAL(M_ptr+K, Di, K, 0.5,   m_smoothFn, n, n+m_width,    buf);
-			    }
-		    }
+	    if (x < m_width-1) 
+		{
+		    if (m_V) UpdateMessageGENERAL(M[2], Di, K, 0.5, /* forward dir*/ 0, V_ptr, buf);
+		    else     UpdateMessageGENERAL(M[2], Di, K, 0.5,   m_smoothFn, n, n+1,      buf);
+		}
+	    if (y < m_height-1) 
+		{
+		    if (m_V) UpdateMessageGENERAL(M[3], Di, K, 0.5, /* forward dir*/ 0, V_ptr+K*K, buf);
+		    else     UpdateMessageGENERAL(M[3], Di, K, 0.5,   m_smoothFn, n, n+m_width,    buf);
+		}
+	};
 
-	    // backward pass
-	    m_lowerBound = 0;
+    auto backward = [&](int x, int y, int n, REAL** M, REAL* Di, void* buf, double& lowerBound)
+	{
+	    CostVal* D_ptr = m_D + n*K;
+	    CostVal* V_ptr = m_V + 2*n*K*K;
 
-	    n --;
-	    D_ptr -= K;
-	    M_ptr -= 2*K;
-	    V_ptr -= 2*K*K;
+	    CopyVector(Di, D_ptr, K);
+	    if (x > 0) AddVector(Di, M[0], K); // message (x-1,y)->(x,y)
+	    if (y > 0) AddVector(Di, M[1], K); // message (x,y-1)->(x,y)
+	    if (x < m_width-1) AddVector(Di, M[2], K); // message (x+1,y)->(x,y)
+	    if (y < m_height-1) AddVector(Di, M[3], K); // message (x,y+1)->(x,y)
 
-	    for (y=m_height-1; y>=0; y--)
-		for (x=m_width-1; x>=0; x--, D_ptr-=K, M_ptr-=2*K, V_ptr-=2*K*K, n--)
-		    {
-			CopyVector(Di, D_ptr, K);
-			if (x > 0) AddVector(Di, M_ptr-2*K, K); // message (x-1,y)->(x,y)
-			if (y > 0) AddVector(Di, M_ptr-(2*m_width-1)*K, K); // message (x,y-1)->(x,y)
-			if (x < m_width-1) AddVector(Di, M_ptr, K); // message (x+1,y)->(x,y)
-			if (y < m_height-1) AddVector(Di, M_ptr+K, K); // message (x,y+1)->(x,y)
+	    // normalize Di, update lower bound
+	    lowerBound += SubtractMin(Di, K);
 
-			// normalize Di, update lower bound
-			m_lowerBound += SubtractMin(Di, K);
+	    if (x > 0) 
+		{
+		    if (m_V) lowerBound += UpdateMessageGENERAL(M[0], Di, K, 0.5, /* backward dir */ 1, V_ptr-2*K*K, buf);
+		    else     lowerBound += UpdateMessageGENERAL(M[0], Di, K, 0.5,   m_smoothFn, n, n-1,              buf);
+		}
+	    if (y > 0)
+		{
+		    if (m_V) lowerBound += UpdateMessageGENERAL(M[1], Di, K, 0.5, /* backward dir */ 1, V_ptr-(2*m_width-1)*K*K, buf);
+		    else     lowerBound += UpdateMessageGENERAL(M[1], Di, K, 0.5,   m_smoothFn, n, n-m_width,                    buf);
+		}
+	};
 
-			if (x > 0) 
-			    {
-				if (m_V) m_lowerBound += UpdateMessageGENERAL(M_ptr-2*K, Di, K, 0.5, /* backward dir */ 1, V_ptr-2*K*K, buf);
-				else     m_lowerBound += UpdateMessageGENERAL(M_ptr-2*K, Di, K, 0.5,   m_smoothFn, n, n-1,              buf);
-			    }
-			if (y > 0)
-			    {
-				if (m_V) m_lowerBound += UpdateMessageGENERAL(M_ptr-(2*m_width-1)*K, Di, K, 0.5, /* backward dir */ 1, V_ptr-(2*m_width-1)*K*K, buf);
-				else     m_lowerBound += UpdateMessageGENERAL(M_ptr-(2*m_width-1)*K, Di, K, 0.5,   m_smoothFn, n, n-m_width,                    buf);
-			    }
-		    }
+    for ( ; nIterations > 0; nIterations --)
+	{
+	    sweep(true, bufSize, forward);
+	    m_lowerBound = sweep(false, bufSize, backward);
 	}
-
-    delete [] Di;
-    delete [] (REAL *)buf;
 }
@@ -7,10 +7,17 @@
 #include <assert.h>
 #include "mrf.h"
 
+#define TRWS_TILE 32 /* side of the tiles of a pass */
 
 class TRWS : public MRF{
  public:
+    // messages are double unless the library is compiled with -DTRWS_FLOAT,
+    // which halves their memory and doubles the labels per AVX2 instruction
+#ifdef TRWS_FLOAT
+    typedef float REAL;
+#else
     typedef double REAL;
+#endif
 
     TRWS(int width, int height, int nLabels, EnergyFunction *eng);
     TRWS(int nPixels, int nLabels,EnergyFunction *eng);
@@ -29,6 +36,21 @@ class TRWS : public MRF{
     // for efficiency.  To prevent this, call the following function before calling initialize():
     void dontCacheSmoothnessCosts() {m_allocateArrayForSmoothnessCostFn = false;}
 
+    // To store the messages with 16 bits per label instead of sizeof(REAL) bytes, call the
+    // following function before calling initialize(). Each message is then kept as its minimum
+    // and a scale (two floats) and K integers in [0,65535], and is rounded to 1/65535 of its
+    // range every time it is updated, so the labels and lower bound are close to, but not the
+    // same as, those with REAL messages. Ignored with 2 labels and the L1 smoothness (BINARY),
+    // whose messages are a single number.
+    void compressMessages() {m_compressMessages = true;}
+
+    // Call this function with argument 1 to run the forward and backward passes on a grid in
+    // parallel, on the threads of the pipeline's pool (parallel.h), as a wavefront of tiles.
+    // The messages, and so the labels, are the same as those of the sequential passes; the
+    // lower bound is summed in another order. Has no effect with only one thread or on grids
+    // smaller than two tiles in either direction.
+    void setParallel(bool PARALLEL);
+
  protected:
     void setData(DataCostFn dcost); 
     void setData(CostVal* data);    
@@ -69,18 +91,31 @@ class TRWS : public MRF{
     bool m_needToFreeD;
 
     REAL* m_messages; // size of one message: N = 1 if m_type == BINARY, N = K otherwise
-    // message between edges (x,y)-(x+1,y): m_messages+(2*x+2*y*m_width)*N
-    // message between edges (x,y)-(x,y+1): m_messages+(2*x+2*y*m_width+1)*N
+    // Every pixel owns a block of two messages, in raster order: first the one on its edge
+    // (x,y)-(x,y+1), then the one on (x,y)-(x+1,y)
+    // message between edges (x,y)-(x,y+1): m_messages+2*(x+y*m_width)*N
+    // message between edges (x,y)-(x+1,y): m_messages+(2*(x+y*m_width)+1)*N
+
+    char* m_packed; // messages of compressMessages(), m_packedStride bytes each, in the same order
+    size_t m_packedStride;
+    bool m_compressMessages;
 
-    int	  m_messageArraySizeInBytes;
+    size_t m_messageArraySizeInBytes;
 
-    REAL m_lowerBound;
+    double m_lowerBound; // sum over all pixels, double for any REAL
 
     void optimize_GRID_L1(int nIterations);
     void optimize_GRID_L2(int nIterations);
     void optimize_GRID_FIXED_MATRIX(int nIterations);
     void optimize_GRID_GENERAL(int nIterations);
     void optimize_GRID_BINARY(int nIterations);
+
+    REAL* message(int block, int slot, REAL* tmp);
+    void storeMessage(int block, int slot, REAL* M);
+
+    bool m_parallel;
+    template <class Pixel> double sweep(bool forward, int bufSize, Pixel& pixel);
+    template <class Pixel> double sweepTile(bool forward, int bufSize, Pixel& pixel, int x0, int y0, int x1, int y1);
 };
 
 #endif /*  __TRWS_H__ */
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <vector>
+#include "TiledExpansion.h"
+#include "GCoptimization.h"
+#include "parallel.h"
+
+#define m_D(pix,l)  m_D[(size_t)(pix)*m_nLabels+(l)]
+#define m_V(l1,l2)  m_V[(l1)*m_nLabels+(l2)]
+
+#define DEFAULT_TILE_SIZE 256
+#define DEFAULT_HALO 16
+
+
+TiledExpansion::TiledExpansion(int width, int height, int nLabels,EnergyFunction *eng):MRF(width,height,nLabels,eng)
+{
+    m_needToFreeV = 0;
+    m_answer = (Label *) new Label[m_nPixels];
+    if ( !m_answer ){printf("\nNot enough memory, exiting");exit(0);}
+
+    m_tileSize = DEFAULT_TILE_SIZE;
+    m_halo = DEFAULT_HALO;
+    m_tilesX = m_tilesY = 0;
+    m_tileSeams = NULL;
+    m_converged = false;
+    m_relativeDecrease = 0;
+    m_maxSeconds = 0;
+}
+
+TiledExpansion::~TiledExpansion()
+{
+    delete[] m_answer;
+    delete[] m_tileSeams;
+    if ( m_needToFreeV ) delete[] m_V;
+}
+
+void TiledExpansion::clearAnswer()
+{
+    memset(m_answer, 0, m_nPixels*sizeof(Label));
+}
+
+void TiledExpansion::setTiles(int tileSize, int halo)
+{
+    if ( tileSize < 1 || halo < 0 || halo >= tileSize )
+    {
+        fprintf(stderr, "TiledExpansion needs 0 <= halo < tileSize\n");
+        exit(1);
+    }
+    m_tileSize = tileSize;
+    m_halo = halo;
+}
+
+void TiledExpansion::setConvergence(double relative_decrease, double max_seconds)
+{
+    m_relativeDecrease = relative_decrease;
+    m_maxSeconds = max_seconds;
+}
+
+void TiledExpansion::initializeAlg()
+{
+    if ( !m_grid_graph || m_dataType != ARRAY || m_smoothType == FUNCTION )
+    {
+        fprintf(stderr, "TiledExpansion needs a grid, data costs in an array and smoothness costs in an array or by parameters\n");
+        exit(1);
+    }
+}
+
+
+MRF::EnergyVal TiledExpansion::smoothnessEnergy()
+{
+    EnergyVal eng = (EnergyVal) 0;
+    EnergyVal weight;
+    int x,y,pix;
+
+    for ( y = 0; y < m_height; y++ )
+        for ( x = 1; x < m_width; x++ )
+        {
+            pix    = x+y*m_width;
+            weight = m_varWeights ? m_horizWeights[pix-1] :  1;
+            eng = eng + m_V(m_answer[pix],m_answer[pix-1])*weight;
+        }
+
+    for ( y = 1; y < m_height; y++ )
+        for ( x = 0; x < m_width; x++ )
+        {
+            pix = x+y*m_width;
+            weight = m_varWeights ? m_vertWeights[pix-m_width] :  1;
+            eng = eng + m_V(m_answer[pix],m_answer[pix-m_width])*weight;
+        }
+
+    return(eng);
+}
+
+
+MRF::EnergyVal TiledExpansion::dataEnergy()
+{
+    EnergyVal eng = (EnergyVal) 0;
+
+    for ( int i = 0; i < m_nPixels; i++ )
+        eng = eng + m_D(i,m_answer[i]);
+
+    return(eng);
+}
+
+
+void TiledExpansion::setData(DataCostFn /*dcost*/)
+{
+    /* initializeAlg() reports the error */
+}
+
+void TiledExpansion::setData(CostVal* data)
+{
+    m_D = data;
+}
+
+
+void TiledExpansion::setSmoothness(SmoothCostGeneralFn /*cost*/)
+{
+    /* initializeAlg() reports the error */
+}
+void TiledExpansion::setSmoothness(CostVal* V)
+{
+    m_V = V;
+}
+
+
+void TiledExpansion::setSmoothness(int smoothExp,CostVal smoothMax, CostVal lambda)
+{
+    int i, j;
+    CostVal cost;
+
+    m_needToFreeV = 1;
+
+    m_V = (CostVal *) new CostVal[m_nLabels*m_nLabels];
+    if (!m_V) { fprintf(stderr, "Not enough memory!\n"); exit(1); }
+
+    for (i=0; i<m_nLabels; i++)
+        for (j=i; j<m_nLabels; j++)
+        {
+            cost = (CostVal) ((smoothExp == 1) ? j - i : (j - i)*(j - i));
+            if (cost > smoothMax) cost = smoothMax;
+            m_V[i*m_nLabels + j] = m_V[j*m_nLabels + i] = cost*lambda;
+        }
+}
+
+
+void TiledExpansion::setCues(CostVal* hCue, CostVal* vCue)
+{
+    m_horizWeights = hCue;
+    m_vertWeights  = vCue;
+}
+
+
+// Adds to the data costs D of a border pixel of a window its smoothness term with pixel
+// nPix outside the window, whose label stays fixed
+void TiledExpansion::addBorderCosts(CostVal *D, int nPix, CostVal weight)
+{
+    Label label = m_answer[nPix];
+
+    for ( int l = 0; l < m_nLabels; l++ )
+        D[l] += m_V(l,label)*weight;
+}
+
+
+// Solves tile number tile on its window, for at most maxSeconds (0 for no limit), and keeps
+// the labels of the tile. Returns true if any of them changed. Reads the labels of the window
+// and the pixels around it, and writes only those of the tile, so tiles of one color can be
+// solved at the same time
+bool TiledExpansion::solveTile(int tile, double maxSeconds)
+{
+    int x, y, pix, wpix;
+    int cx0 = (tile % m_tilesX)*m_tileSize, cy0 = (tile / m_tilesX)*m_tileSize;
+    int cx1 = (cx0 + m_tileSize < m_width)  ? cx0 + m_tileSize : m_width;
+    int cy1 = (cy0 + m_tileSize < m_height) ? cy0 + m_tileSize : m_height;
+    int wx0 = (cx0 > m_halo) ? cx0 - m_halo : 0;
+    int wy0 = (cy0 > m_halo) ? cy0 - m_halo : 0;
+    int wx1 = (cx1 + m_halo < m_width)  ? cx1 + m_halo : m_width;
+    int wy1 = (cy1 + m_halo < m_height) ? cy1 + m_halo : m_height;
+    int w = wx1 - wx0, h = wy1 - wy0;
+
+    /* the costs of the window: its rows of the data costs and cues, and the smoothness   */
+    /* terms with the pixels around it as data costs of its border                        */
+    std::vector<CostVal> D((size_t) w*h*m_nLabels);
+    std::vector<CostVal> hCue(m_varWeights ? (size_t) w*h : 0), vCue(m_varWeights ? (size_t) w*h : 0);
+
+    for ( y = wy0; y < wy1; y++ )
+    {
+        wpix = (y-wy0)*w;
+        pix = wx0 + y*m_width;
+        memcpy(&D[(size_t) wpix*m_nLabels], &m_D(pix,0), (size_t) w*m_nLabels*sizeof(CostVal));
+        if ( m_varWeights )
+        {
+            memcpy(&hCue[wpix], &m_horizWeights[pix], w*sizeof(CostVal));
+            memcpy(&vCue[wpix], &m_vertWeights[pix], w*sizeof(CostVal));
+        }
+
+        if ( wx0 > 0 )
+            addBorderCosts(&D[(size_t) wpix*m_nLabels], pix-1, m_varWeights ? m_horizWeights[pix-1] : 1);
+        if ( wx1 < m_width )
+            addBorderCosts(&D[(size_t) (wpix+w-1)*m_nLabels], pix+w, m_varWeights ? m_horizWeights[pix+w-1] : 1);
+    }
+    for ( x = wx0; x < wx1; x++ )
+    {
+        if ( wy0 > 0 )
+        {
+            pix = x + wy0*m_width;
+            addBorderCosts(&D[(size_t) (x-wx0)*m_nLabels], pix-m_width, m_varWeights ? m_vertWeights[pix-m_width] : 1);
+        }
+        if ( wy1 < m_height )
+        {
+            pix = x + (wy1-1)*m_width;
+            addBorderCosts(&D[(size_t) ((x-wx0)+(h-1)*w)*m_nLabels], pix+m_width, m_varWeights ? m_vertWeights[pix] : 1);
+        }
+    }
+
+    DataCost data(&D[0]);
+    SmoothnessCost smooth = m_varWeights ? SmoothnessCost(m_V, &hCue[0], &vCue[0]) : SmoothnessCost(m_V);
+    EnergyFunction energy(&data, &smooth);
+
+    GCoptimization *mrf;
+    if ( m_nLabels == 2 ) mrf = new BinaryCut(w, h, m_nLabels, &energy);
+    else mrf = new Expansion(w, h, m_nLabels, &energy);
+    mrf->setLabelOrder(0);
+    mrf->setActiveLabels(true);
+    mrf->setConvergence(m_relativeDecrease, maxSeconds);
+    mrf->initialize();
+
+    for ( y = wy0; y < wy1; y++ )
+        for ( x = wx0; x < wx1; x++ )
+            mrf->setLabel((x-wx0)+(y-wy0)*w, m_answer[x+y*m_width]);
+
+    float t;
+    mrf->optimize(INT_MAX, t);
+
+    /* keep the labels of the tile, and count those of the halo that disagree */
+    bool changed = false;
+    long seams = 0;
+    for ( y = wy0; y < wy1; y++ )
+        for ( x = wx0; x < wx1; x++ )
+        {
+            pix = x+y*m_width;
+            Label label = mrf->getLabel((x-wx0)+(y-wy0)*w);
+            if ( label == m_answer[pix] ) continue;
+            if ( x >= cx0 && x < cx1 && y >= cy0 && y < cy1 )
+            {
+                m_answer[pix] = label;
+                changed = true;
+            }
+            else seams++;
+        }
+    m_tileSeams[tile] = seams;
+
+    /* the phases and counters of the window's moves */
+    const Stats &s = mrf->getStats();
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_stats.buildTime += s.buildTime;
+        m_stats.maxflowTime += s.maxflowTime;
+        m_stats.energyTime += s.energyTime;
+        m_stats.energyEvaluations += s.energyEvaluations;
+        m_stats.moves += s.moves;
+        m_stats.augmentations += s.augmentations;
+        m_stats.terms += s.terms;
+        m_stats.truncations += s.truncations;
+        for ( int l = 0; l < m_nLabels; l++ ) m_stats.labelMoves[l] += s.labelMoves[l];
+    }
+
+    delete mrf;
+    return(changed);
+}
+
+
+void TiledExpansion::optimizeAlg(int nIterations)
+{
+    int tile, tx, ty, c, round;
+    int numTiles;
+
+    m_tilesX = (m_width + m_tileSize - 1)/m_tileSize;
+    m_tilesY = (m_height + m_tileSize - 1)/m_tileSize;
+    numTiles = m_tilesX*m_tilesY;
+
+    delete[] m_tileSeams;
+    m_tileSeams = new long[numTiles];
+    memset(m_tileSeams, 0, numTiles*sizeof(long));
+
+    /* a tile is dirty until it is solved, and again once a neighbor's labels change */
+    std::vector<char> dirty(numTiles, 1), changed(numTiles, 0);
+    std::vector<int> todo;
+    bool anyDirty = true, outOfTime = false;
+    double start = wallClock(), remaining = 0;
+
+    for ( round = 0; round < nIterations && anyDirty && !outOfTime; round++ )
+    {
+        for ( c = 0; c < 4; c++ )
+        {
+            /* the windows get the time left; past the limit no more tiles are started */
+            if ( m_maxSeconds > 0 )
+            {
+                remaining = m_maxSeconds - (wallClock() - start);
+                if ( remaining <= 0 ) { outOfTime = true; break; }
+            }
+
+            todo.clear();
+            for ( ty = c/2; ty < m_tilesY; ty += 2 )
+                for ( tx = c%2; tx < m_tilesX; tx += 2 )
+                    if ( dirty[tx+ty*m_tilesX] ) todo.push_back(tx+ty*m_tilesX);
+
+            parallel_for(0, (long) todo.size(), 1, [&](long first, long last)
+            {
+                for (long k=first; k<last; k++) changed[todo[k]] = solveTile(todo[k], remaining);
+            });
+
+            for ( size_t k = 0; k < todo.size(); k++ )
+            {
+                tile = todo[k];
+                dirty[tile] = 0;
+                if ( !changed[tile] ) continue;
+                tx = tile % m_tilesX;
+                ty = tile / m_tilesX;
+                for ( int ny = ty-1; ny <= ty+1; ny++ )
+                    for ( int nx = tx-1; nx <= tx+1; nx++ )
+                        if ( nx >= 0 && nx < m_tilesX && ny >= 0 && ny < m_tilesY && (nx != tx || ny != ty) )
+                            dirty[nx+ny*m_tilesX] = 1;
+            }
+        }
+
+        anyDirty = false;
+        for ( tile = 0; tile < numTiles; tile++ )
+            if ( dirty[tile] ) anyDirty = true;
+    }
+
+    m_iterations = round;
+    m_converged = !anyDirty && !outOfTime;
+}
+
+
+long TiledExpansion::seamDisagreements()
+{
+    long seams = 0;
+
+    for ( int tile = 0; tile < m_tilesX*m_tilesY; tile++ )
+        seams += m_tileSeams[tile];
+    return(seams);
+}
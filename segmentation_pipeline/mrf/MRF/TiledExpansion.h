@@ -0,0 +1,87 @@
+#ifndef __TILEDEXPANSION_H__
+#define __TILEDEXPANSION_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mrf.h"
+
+// Solves a grid too large for one graph in overlapping tiles. The grid is cut into square
+// tiles, and each tile is solved on a window that extends a halo past it on every side, with
+// the labels outside the window fixed: their smoothness terms with the window become data
+// costs of its border pixels. The solve is a BinaryCut for 2 labels and an Expansion (from
+// the current labels) otherwise, and only the labels of the tile itself are kept, so the
+// halo gives the tile the context of its neighbors without the seams of disjoint tiles.
+//
+// Tiles are solved in 4 checkerboard colors, (tx%2, ty%2), and the tiles of a color in
+// parallel on the threads of the pipeline's pool (parallel.h): their windows do not reach
+// each other's tiles, so the labels do not depend on the number of threads. Each call to
+// optimize(nIterations) runs up to nIterations rounds over the tiles. The first round solves
+// all of them, and later rounds only the tiles next to a tile whose labels changed, until no
+// labels change. Only the graphs are bounded by the tiles: one window's graph, costs and labels
+// per thread. The data costs and cues of the whole grid are still read from the caller's arrays,
+// and the labels of the whole grid are kept here.
+//
+// Only for grids, with data costs in an array and smoothness costs in an array or given by
+// parameters, with or without cues; the windows need them to build their own costs.
+
+class TiledExpansion : public MRF{
+public:
+    TiledExpansion(int width, int height, int nLabels, EnergyFunction *eng);
+    ~TiledExpansion();
+    void setNeighbors(int /*pix1*/, int /*pix2*/, CostVal /*weight*/)
+        {fprintf(stderr, "TiledExpansion works only on grids\n"); exit(1);}
+    Label getLabel(int pixel){return(m_answer[pixel]);};
+    void setLabel(int pixel,Label label){m_answer[pixel] = label;};
+    Label* getAnswerPtr(){return(m_answer);};
+    void clearAnswer();
+    void setParameters(int /*numParam*/, void * /*param*/){printf("No optional parameters to set"); exit(1);}
+    EnergyVal smoothnessEnergy();
+    EnergyVal dataEnergy();
+
+    // Tiles of tileSize x tileSize pixels, solved on windows that extend halo pixels past
+    // them on every side. halo must be smaller than tileSize. By default 256 and 16
+    void setTiles(int tileSize, int halo);
+
+    // Passed on to the expansions of the windows (see GCoptimization::setConvergence()), each
+    // of which also stops once max_seconds have passed since optimize() started. No new round
+    // or color of tiles is started after that (0 for no limit)
+    void setConvergence(double relative_decrease, double max_seconds = 0);
+
+    // Returns true if the last optimize() stopped because a round changed no labels, not
+    // because it ran out of rounds or time
+    bool converged() { return m_converged; }
+
+    // Pixels of the halos where the last solve of a window disagrees with the labels of the
+    // tiles they belong to, summed over the tiles. Exact once optimize() has converged
+    long seamDisagreements();
+
+protected:
+    void setData(DataCostFn dcost);
+    void setData(CostVal* data);
+    void setSmoothness(SmoothCostGeneralFn cost);
+    void setSmoothness(CostVal* V);
+    void setSmoothness(int smoothExp,CostVal smoothMax, CostVal lambda);
+    void setCues(CostVal* hCue, CostVal* vCue);
+    void initializeAlg();
+    void optimizeAlg(int nIterations);
+
+private:
+    Label *m_answer;
+    CostVal *m_V;
+    CostVal *m_D;
+    CostVal *m_horizWeights;
+    CostVal *m_vertWeights;
+    bool m_needToFreeV;
+
+    int m_tileSize, m_halo;
+    int m_tilesX, m_tilesY;
+    long *m_tileSeams;   /* m_tileSeams[t]: halo disagreements of the last solve of tile t */
+    bool m_converged;
+    double m_relativeDecrease, m_maxSeconds;  /* see setConvergence() */
+
+    bool solveTile(int tile, double maxSeconds);
+    void addBorderCosts(CostVal *D, int nPix, CostVal weight);
+};
+
+
+#endif /*  __TILEDEXPANSION_H__ */
@@ -0,0 +1,113 @@
+/* arena.h */
+/*
+    Class Arena
+    Monotonic allocator for memory that is freed all at once.
+
+    alloc() hands out consecutive pieces of large chunks, so
+    building a structure of many small items costs one heap
+    allocation per chunk instead of one per item. Items are
+    never freed one by one: reset() marks all chunks as empty
+    and keeps them for the next use, and the destructor
+    deallocates them. A request larger than the chunk size
+    gets a chunk of its own.
+
+    Block, DBlock (block.h) and Graph (graph.h) take an optional
+    arena in their constructors and then take their blocks from
+    it; their destructors leave the blocks to the arena. The
+    solvers of the library keep one arena for their neighborhood
+    systems and one for the graphs of their moves, which they
+    reset after every move.
+
+    No constructors or destructors are called for items, and
+    pieces are aligned to ARENA_ALIGN bytes.
+
+    Example usage:
+    ///////////////////////////////////////////////////
+    #include "arena.h"
+
+    Arena *arena = new Arena();
+    Block<MyType> *block = new Block<MyType>(BLOCK_SIZE, NULL, arena);
+    int *array = arena -> New<int>(1000);
+    ...
+    delete block;
+    arena -> reset();  // memory of block and array is reused
+    ...
+    delete arena;      // memory of block and array is deallocated
+    ///////////////////////////////////////////////////
+*/
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stdlib.h>
+
+#define ARENA_CHUNK_SIZE (1<<20)
+#define ARENA_ALIGN 16
+
+class Arena
+{
+public:
+    /* Constructor. Arguments are the chunk size in bytes and
+       (optionally) the pointer to the function which
+       will be called if allocation failed; the message
+       passed to this function is "Not enough memory!" */
+    Arena(size_t size = ARENA_CHUNK_SIZE, void (*err_function)(const char *) = NULL)
+        { first = current = last = NULL; top = end = NULL; chunk_size = size; error_function = err_function; }
+
+    /* Destructor. Deallocates all chunks */
+    ~Arena() { while (first) { chunk *next = first -> next; delete [] (char *) first; first = next; } }
+
+    /* Allocates 'size' bytes */
+    void *alloc(size_t size)
+    {
+        char *t;
+
+        size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+        if (!current || top + size > end)
+        {
+            chunk *next = current ? current -> next : first;
+            while (next && next -> size < size) next = next -> next;
+            if (!next)
+            {
+                size_t next_size = (size > chunk_size) ? size : chunk_size;
+                next = (chunk *) new char [sizeof(chunk) + ARENA_ALIGN + next_size];
+                if (!next) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+                next -> size = next_size;
+                next -> next = NULL;
+                if (last) last -> next = next;
+                else first = next;
+                last = next;
+            }
+            current = next;
+            top = (char *) (((size_t) (current + 1) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1));
+            end = top + current -> size;
+        }
+        t = top;
+        top += size;
+        return t;
+    }
+
+    /* Allocates 'num' consecutive items of type 'Type' */
+    template <class Type> Type *New(size_t num = 1) { return (Type *) alloc(num*sizeof(Type)); }
+
+    /* Marks all chunks as empty. Items allocated so far must not be used anymore */
+    void reset() { current = NULL; top = end = NULL; }
+
+/***********************************************************************/
+
+private:
+
+    typedef struct chunk_st
+    {
+        struct chunk_st         *next;
+        size_t                  size;       /* usable bytes after the header */
+    } chunk;
+
+    size_t  chunk_size;
+    chunk   *first, *current, *last;
+    char    *top, *end;                     /* free part of the current chunk */
+
+    void    (*error_function)(const char *);
+};
+
+#endif
@@ -0,0 +1,121 @@
+// bench.cpp -- times the graph cut algorithms on a large synthetic grid, to compare
+// builds of the library with 32-bit and 64-bit energy types (see README.txt):
+//
+//     make allclean; make bench DEFS=-DMRF_64BIT_ENERGY; ./bench 2000 2000 1
+
+static const char *usage = "usage: %s [width height [scale]]\n";
+
+#include "mrf.h"
+#include "GCoptimization.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// the costs of the mrf stage, multiplied by scale
+const int labelCost = 20;
+const int edgeCost  = 50;
+const int numLabels = 8;
+
+// a labeling of rectangles with 5% noise, as in a freespace map
+int blocks(int x, int y, int nLabels)
+{
+    if (rand() % 20 == 0) return rand() % nLabels;
+    return (x/97 + 3*(y/61)) % nLabels;
+}
+
+// the energy of the labeling in double, which cannot overflow
+double exactEnergy(MRF *mrf, MRF::CostVal *D, MRF::CostVal *V, int width, int height, int nLabels)
+{
+    double E = 0;
+    for (int y=0; y<height; y++) {
+	for (int x=0; x<width; x++) {
+	    int pix = x + y*width, l = mrf->getLabel(pix);
+	    E += (double) D[(size_t) pix*nLabels + l];
+	    if (x < width-1)  E += (double) V[l + mrf->getLabel(pix+1)*nLabels];
+	    if (y < height-1) E += (double) V[l + mrf->getLabel(pix+width)*nLabels];
+	}
+    }
+    return E;
+}
+
+void run(const char *name, GCoptimization *mrf, MRF::CostVal *D, MRF::CostVal *V,
+	 int width, int height, int nLabels, int nIterations)
+{
+    float t;
+
+    mrf->setLabelOrder(0);
+    mrf->initialize();
+    mrf->clearAnswer();
+    mrf->optimize(nIterations, t);
+
+    MRF::Stats stats = mrf->getStats();
+    double E = (double) mrf->totalEnergy();
+    double exact = exactEnergy(mrf, D, V, width, height, nLabels);
+
+    printf("%-10s energy = %.0f%s  wall %.3f s  build %.3f s  maxflow %.3f s  energy %.3f s\n",
+	   name, E, (E == exact) ? "" : " (overflow)",
+	   stats.wallTime, stats.buildTime, stats.maxflowTime, stats.energyTime);
+}
+
+int main(int argc, char **argv)
+{
+    int width = 1000, height = 1000, scale = 1;
+
+    if (argc == 3 || argc == 4) {
+	width  = atoi(argv[1]);
+	height = atoi(argv[2]);
+	if (argc == 4) scale = atoi(argv[3]);
+    }
+    else if (argc != 1) {
+	fprintf(stderr, usage, argv[0]);
+	exit(1);
+    }
+
+    printf("%dx%d grid, costs x%d, EnergyVal %d bytes, CostVal %d bytes\n", width, height, scale,
+	   (int) sizeof(MRF::EnergyVal), (int) sizeof(MRF::CostVal));
+
+    int nPixels = width*height;
+    MRF::CostVal *D = new MRF::CostVal[(size_t) nPixels*numLabels];
+    MRF::CostVal V[numLabels*numLabels];
+    int x, y, l, k;
+
+    // two labels with a Potts penalty, solved by BinaryCut as in the mrf stage
+    srand(1);
+    for (y=0; y<height; y++) {
+	for (x=0; x<width; x++) {
+	    int label = blocks(x, y, 2);
+	    for (l=0; l<2; l++) D[(size_t) (x + y*width)*2 + l] = (MRF::CostVal) (l == label ? 0 : labelCost*scale);
+	}
+    }
+    for (l=0; l<2; l++)
+	for (k=0; k<2; k++) V[l + k*2] = (MRF::CostVal) (l == k ? 0 : edgeCost*scale);
+
+    EnergyFunction *energy = new EnergyFunction(new DataCost(D), new SmoothnessCost(V));
+    GCoptimization *mrf = new BinaryCut(width, height, 2, energy);
+    run("binary", mrf, D, V, width, height, 2, 1);
+    delete mrf;
+
+    // more labels with a truncated linear penalty, solved by expansion and swap
+    srand(1);
+    for (y=0; y<height; y++) {
+	for (x=0; x<width; x++) {
+	    int label = blocks(x, y, numLabels);
+	    for (l=0; l<numLabels; l++)
+		D[(size_t) (x + y*width)*numLabels + l] = (MRF::CostVal) (abs(l - label)*labelCost*scale);
+	}
+    }
+    for (l=0; l<numLabels; l++)
+	for (k=0; k<numLabels; k++) V[l + k*numLabels] = (MRF::CostVal) ((abs(l - k) < 3 ? abs(l - k) : 3)*edgeCost*scale);
+
+    energy = new EnergyFunction(new DataCost(D), new SmoothnessCost(V));
+    mrf = new Expansion(width, height, numLabels, energy);
+    run("expansion", mrf, D, V, width, height, numLabels, 3);
+    delete mrf;
+
+    mrf = new Swap(width, height, numLabels, energy);
+    run("swap", mrf, D, V, width, height, numLabels, 1);
+    delete mrf;
+
+    delete [] D;
+    return 0;
+}
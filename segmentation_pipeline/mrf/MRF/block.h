@@ -44,6 +44,10 @@
 
     Note that no constructors or destructors are called for items.
 
+    Both classes can take their blocks from an Arena (arena.h)
+    passed to the constructor. The destructor then leaves the
+    blocks to the arena, which frees or reuses them.
+
     Example usage for items of type 'MyType':
 
     ///////////////////////////////////////////////////
@@ -110,6 +114,7 @@
 #define __BLOCK_H__
 
 #include <stdlib.h>
+#include "arena.h"
 
 /***********************************************************************/
 /***********************************************************************/
@@ -118,14 +123,15 @@
 template <class Type> class Block
 {
 public:
-    /* Constructor. Arguments are the block size and
+    /* Constructor. Arguments are the block size,
        (optionally) the pointer to the function which
        will be called if allocation failed; the message
-       passed to this function is "Not enough memory!" */
-    Block(int size, void (*err_function)(char *) = NULL) { first = last = NULL; block_size = size; error_function = err_function; }
+       passed to this function is "Not enough memory!",
+       and (optionally) the arena to allocate blocks from */
+    Block(int size, void (*err_function)(const char *) = NULL, Arena *a = NULL) { first = last = NULL; block_size = size; error_function = err_function; arena = a; }
 
-    /* Destructor. Deallocates all items added so far */
-    ~Block() { while (first) { block *next = first -> next; delete first; first = next; } }
+    /* Destructor. Deallocates all items added so far, unless they are in an arena */
+    ~Block() { while (first && !arena) { block *next = first -> next; delete [] (char *) first; first = next; } }
 
     /* Allocates 'num' consecutive items; returns pointer
        to the first item. 'num' cannot be greater than the
@@ -139,7 +145,8 @@ public:
             if (last && last->next) last = last -> next;
             else
             {
-                block *next = (block *) new char [sizeof(block) + (block_size-1)*sizeof(Type)];
+                size_t size = sizeof(block) + (block_size-1)*sizeof(Type);
+                block *next = (block *) (arena ? arena -> alloc(size) : new char [size]);
                 if (!next) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
                 if (last) last -> next = next;
                 else first = next;
@@ -209,6 +216,7 @@ private:
     block   *scan_current_block;
     Type    *scan_current_data;
 
+    Arena   *arena;
     void    (*error_function)(const char *);
 };
 
@@ -219,14 +227,15 @@ private:
 template <class Type> class DBlock
 {
 public:
-    /* Constructor. Arguments are the block size and
+    /* Constructor. Arguments are the block size,
        (optionally) the pointer to the function which
        will be called if allocation failed; the message
-       passed to this function is "Not enough memory!" */
-    DBlock(int size, void (*err_function)(const char *) = NULL) { first = NULL; first_free = NULL; block_size = size; error_function = err_function; }
+       passed to this function is "Not enough memory!",
+       and (optionally) the arena to allocate blocks from */
+    DBlock(int size, void (*err_function)(const char *) = NULL, Arena *a = NULL) { first = NULL; first_free = NULL; block_size = size; error_function = err_function; arena = a; }
 
-    /* Destructor. Deallocates all items added so far */
-    ~DBlock() { while (first) { block *next = first -> next; delete first; first = next; } }
+    /* Destructor. Deallocates all items added so far, unless they are in an arena */
+    ~DBlock() { while (first && !arena) { block *next = first -> next; delete [] (char *) first; first = next; } }
 
     /* Allocates one item */
     Type *New()
@@ -236,7 +245,8 @@ public:
         if (!first_free)
         {
             block *next = first;
-            first = (block *) new char [sizeof(block) + (block_size-1)*sizeof(block_item)];
+            size_t size = sizeof(block) + (block_size-1)*sizeof(block_item);
+            first = (block *) (arena ? arena -> alloc(size) : new char [size]);
             if (!first) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
             first_free = & (first -> data[0] );
             for (item=first_free; item<first_free+block_size-1; item++)
@@ -277,6 +287,7 @@ private:
     block       *first;
     block_item  *first_free;
 
+    Arena   *arena;
     void    (*error_function)(const char *);
 };
 
@@ -7,13 +7,9 @@
    In this version of the file submodularity is ensured by adjusting ("truncating")
    the values A, B, C, D in add_term2.
 
-   It is also possible to count the number of times this occurs using global variables
-   by uncommenting the two lines below
+   The number of times this occurs is counted, see num_truncations()
 */
 
-//#define COUNT_TRUNCATIONS
-//extern int truncCnt, totalCnt;
-
 
 /* Vladimir Kolmogorov (vnk@cs.cornell.edu), 2003. */
 
@@ -131,8 +127,9 @@ public:
     /* Constructor. Optional argument is the pointer to the
        function which will be called if an error occurs;
        an error message is passed to this function. If this
-       argument is omitted, exit(1) will be called. */
-    Energy(void (*err_function)(const char *) = NULL);
+       argument is omitted, exit(1) will be called.
+       The optional arena is passed on to Graph */
+    Energy(void (*err_function)(const char *) = NULL, Arena *arena = NULL);
 
     /* Destructor */
     ~Energy();
@@ -188,6 +185,13 @@ public:
        Returns either 0 or 1 */
     int get_var(Var x);
 
+    /* Numbers of calls of add_term2() and of the terms among them that were truncated */
+    long num_terms() { return terms; }
+    long num_truncations() { return truncations; }
+
+    /* Number of augmenting paths that minimize() found */
+    using Graph::num_augmentations;
+
 /***********************************************************************/
 /***********************************************************************/
 /***********************************************************************/
@@ -196,6 +200,7 @@ private:
     /* internal variables and functions */
 
     TotalValue  Econst;
+    long        terms, truncations;
     void        (*error_function)(const char *);  /* this function is called if a error occurs,
                                             with a corresponding error message
                                             (or exit(1) is called if it's NULL) */
@@ -219,9 +224,10 @@ private:
 /************************  Implementation ******************************/
 /***********************************************************************/
 
-inline Energy::Energy(void (*err_function)(const char *)) : Graph(err_function)
+inline Energy::Energy(void (*err_function)(const char *), Arena *arena) : Graph(err_function, arena)
 {
     Econst = 0;
+    terms = truncations = 0;
     error_function = err_function;
 }
 
@@ -249,13 +255,9 @@ inline void Energy::add_term2(Var x, Var y,
         A = A-subtrA;
         C = C+subtrA;
         B = B+(delta-subtrA*2);
-#ifdef COUNT_TRUNCATIONS
-	truncCnt++;
-#endif
+	truncations++;
     }    
-#ifdef COUNT_TRUNCATIONS
-    totalCnt++;
-#endif
+    terms++;
     
     /* 
        E = A A  +  0   B-A
@@ -25,10 +25,6 @@ MRF::CostVal V[numLabels*numLabels];
 MRF::CostVal hCue[sizeX*sizeY];
 MRF::CostVal vCue[sizeX*sizeY];
 
-#ifdef COUNT_TRUNCATIONS
-int truncCnt, totalCnt;
-#endif
-
 EnergyFunction* generate_DataARRAY_SmoothFIXED_FUNCTION()
 {
     int i, j;
@@ -206,9 +202,6 @@ int main(int argc, char **argv)
 	    printf("Energy at the Start= %g (%g,%g)\n", (float)E,
 		   (float)mrf->smoothnessEnergy(), (float)mrf->dataEnergy());
 
-#ifdef COUNT_TRUNCATIONS
-	    truncCnt = totalCnt = 0;
-#endif
 	    tot_t = 0;
 	    for (iter=0; iter<6; iter++) {
 		mrf->optimize(1, t);
@@ -217,11 +210,11 @@ int main(int argc, char **argv)
 		tot_t = tot_t + t ;
 		printf("energy = %g (%f secs)\n", (float)E, tot_t);
 	    }
-#ifdef COUNT_TRUNCATIONS
-	    if (truncCnt > 0)
-		printf("***WARNING: %d terms (%.2f%%) were truncated to ensure regularity\n", 
-		       truncCnt, (float)(100.0 * truncCnt / totalCnt));
-#endif
+	    if (mrf->getStats().truncations > 0)
+		printf("***WARNING: %ld terms (%.2f%%) were truncated to ensure regularity\n", 
+		       mrf->getStats().truncations,
+		       (float)(100.0 * mrf->getStats().truncations / mrf->getStats().terms));
+	    mrf->printStats(stdout);
 
 	    delete mrf;
 	}
@@ -239,9 +232,6 @@ int main(int argc, char **argv)
 	    printf("Energy at the Start= %g (%g,%g)\n", (float)E,
 		   (float)mrf->smoothnessEnergy(), (float)mrf->dataEnergy());
 
-#ifdef COUNT_TRUNCATIONS
-	    truncCnt = totalCnt = 0;
-#endif
 	    tot_t = 0;
 	    for (iter=0; iter<8; iter++) {
 		mrf->optimize(1, t);
@@ -250,11 +240,11 @@ int main(int argc, char **argv)
 		tot_t = tot_t + t ;
 		printf("energy = %g (%f secs)\n", (float)E, tot_t);
 	    }
-#ifdef COUNT_TRUNCATIONS
-	    if (truncCnt > 0)
-		printf("***WARNING: %d terms (%.2f%%) were truncated to ensure regularity\n", 
-		       truncCnt, (float)(100.0 * truncCnt / totalCnt));
-#endif
+	    if (mrf->getStats().truncations > 0)
+		printf("***WARNING: %ld terms (%.2f%%) were truncated to ensure regularity\n", 
+		       mrf->getStats().truncations,
+		       (float)(100.0 * mrf->getStats().truncations / mrf->getStats().terms));
+	    mrf->printStats(stdout);
 
    
 	    delete mrf;
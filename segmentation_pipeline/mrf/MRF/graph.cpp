@@ -21,39 +21,50 @@
 #include <stdio.h>
 #include "graph.h"
 
-Graph::Graph(void (*err_function)(const char *))
+Graph::Graph(void (*err_function)(const char *), Arena *a)
 {
     error_function = err_function;
+    arena = a;
     node_block_first = NULL;
     arc_for_block_first = NULL;
     arc_rev_block_first = NULL;
     flow = 0;
+    augmentations = 0;
 }
 
 Graph::~Graph()
 {
+    if (arena) return;
+
     while (node_block_first)
     {
         node_block *next = node_block_first -> next;
-        delete node_block_first;
+        delete [] (char *) node_block_first;
         node_block_first = next;
     }
 
     while (arc_for_block_first)
     {
         arc_for_block *next = arc_for_block_first -> next;
-        delete arc_for_block_first -> start;
+        delete [] arc_for_block_first -> start;
         arc_for_block_first = next;
     }
 
     while (arc_rev_block_first)
     {
         arc_rev_block *next = arc_rev_block_first -> next;
-        delete arc_rev_block_first -> start;
+        delete [] arc_rev_block_first -> start;
         arc_rev_block_first = next;
     }
 }
 
+char *Graph::alloc_block(size_t size)
+{
+    char *ptr = arena ? (char *) arena -> alloc(size) : new char[size];
+    if (!ptr) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+    return ptr;
+}
+
 Graph::node_id Graph::add_node()
 {
     node *i;
@@ -61,8 +72,7 @@ Graph::node_id Graph::add_node()
     if (!node_block_first || node_block_first->current+1 > &node_block_first->nodes[NODE_BLOCK_SIZE-1])
     {
         node_block *next = node_block_first;
-        node_block_first = (node_block *) new node_block;
-        if (!node_block_first) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+        node_block_first = (node_block *) alloc_block(sizeof(node_block));
         node_block_first -> current = & ( node_block_first -> nodes[0] );
         node_block_first -> next = next;
     }
@@ -84,8 +94,7 @@ void Graph::add_edge(node_id from, node_id to, captype cap, captype rev_cap)
     if (!arc_for_block_first || arc_for_block_first->current+1 > &arc_for_block_first->arcs_for[ARC_BLOCK_SIZE])
     {
         arc_for_block *next = arc_for_block_first;
-        char *ptr = new char[sizeof(arc_for_block)+1];
-        if (!ptr) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+        char *ptr = alloc_block(sizeof(arc_for_block)+1);
         if ((PTR_CAST)ptr & 1) arc_for_block_first = (arc_for_block *) (ptr + 1);
         else              arc_for_block_first = (arc_for_block *) ptr;
         arc_for_block_first -> start = ptr;
@@ -96,8 +105,7 @@ void Graph::add_edge(node_id from, node_id to, captype cap, captype rev_cap)
     if (!arc_rev_block_first || arc_rev_block_first->current+1 > &arc_rev_block_first->arcs_rev[ARC_BLOCK_SIZE])
     {
         arc_rev_block *next = arc_rev_block_first;
-        char *ptr = new char[sizeof(arc_rev_block)+1];
-        if (!ptr) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+        char *ptr = alloc_block(sizeof(arc_rev_block)+1);
         if ((PTR_CAST)ptr & 1) arc_rev_block_first = (arc_rev_block *) (ptr + 1);
         else              arc_rev_block_first = (arc_rev_block *) ptr;
         arc_rev_block_first -> start = ptr;
@@ -189,8 +197,7 @@ void Graph::prepare_graph()
                 if (ab_for == NULL)
                 {
                     arc_for_block *next = arc_for_block_first;
-                    char *ptr = new char[sizeof(arc_for_block)+1];
-                    if (!ptr) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+                    char *ptr = alloc_block(sizeof(arc_for_block)+1);
                     if ((PTR_CAST)ptr & 1) arc_for_block_first = (arc_for_block *) (ptr + 1);
                     else              arc_for_block_first = (arc_for_block *) ptr;
                     arc_for_block_first -> start = ptr;
@@ -222,8 +229,7 @@ void Graph::prepare_graph()
                 if (ab_rev == NULL)
                 {
                     arc_rev_block *next = arc_rev_block_first;
-                    char *ptr = new char[sizeof(arc_rev_block)+1];
-                    if (!ptr) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+                    char *ptr = alloc_block(sizeof(arc_rev_block)+1);
                     if ((PTR_CAST)ptr & 1) arc_rev_block_first = (arc_rev_block *) (ptr + 1);
                     else              arc_rev_block_first = (arc_rev_block *) ptr;
                     arc_rev_block_first -> start = ptr;
@@ -259,7 +265,7 @@ void Graph::prepare_graph()
         arc_forward *af;
         arc_reverse *ar;
         node *from;
-        int shift = 0, shift_new;
+        PTR_CAST shift = 0, shift_new;   /* node blocks can be more than 2GB apart */
         captype r_cap = 0, r_rev_cap = 0, r_cap_new, r_rev_cap_new;
 
         if (!(from=(node *)(a_rev->sister))) continue;
@@ -270,7 +276,7 @@ void Graph::prepare_graph()
         {
             ar -> sister = NULL;
 
-            shift_new = (int)(((char *)(af->shift)) - (char *)from);
+            shift_new = (PTR_CAST)(((char *)(af->shift)) - (char *)from);
             r_cap_new = af -> r_cap;
             r_rev_cap_new = af -> r_rev_cap;
             if (shift)
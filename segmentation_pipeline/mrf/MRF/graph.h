@@ -74,7 +74,7 @@ public:
 
     typedef MRF::CostVal captype;
 
-    /* Type of total flow */
+    /* Type of total flow, long long with -DMRF_64BIT_ENERGY */
     typedef MRF::EnergyVal flowtype;
     
     typedef void * node_id;
@@ -84,8 +84,10 @@ public:
     /* Constructor. Optional argument is the pointer to the
        function which will be called if an error occurs;
        an error message is passed to this function. If this
-       argument is omitted, exit(1) will be called. */
-    Graph(void (*err_function)(const char *) = NULL);
+       argument is omitted, exit(1) will be called.
+       If an arena is given, nodes and arcs are allocated
+       from it and the destructor leaves them to the arena */
+    Graph(void (*err_function)(const char *) = NULL, Arena *arena = NULL);
 
     /* Destructor */
     ~Graph();
@@ -114,6 +116,9 @@ public:
     /* Computes the maxflow. Can be called only once. */
     flowtype maxflow();
 
+    /* Number of augmenting paths that maxflow() found */
+    long num_augmentations() { return augmentations; }
+
 /***********************************************************************/
 /***********************************************************************/
 /***********************************************************************/
@@ -232,12 +237,14 @@ private:
     arc_for_block       *arc_for_block_first;
     arc_rev_block       *arc_rev_block_first;
     DBlock<nodeptr>     *nodeptr_block;
+    Arena               *arena;
 
     void    (*error_function)(const char *);  /* this function is called if a error occurs,
                                            with a corresponding error message
                                            (or exit(1) is called if it's NULL) */
 
     flowtype            flow;       /* total flow */
+    long                augmentations;
 
 /***********************************************************************/
 
@@ -247,6 +254,8 @@ private:
 
 /***********************************************************************/
 
+    char *alloc_block(size_t size);
+
     /* functions for processing active list */
     void set_active(node *i);
     node *next_active();
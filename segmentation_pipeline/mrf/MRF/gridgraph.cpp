@@ -0,0 +1,706 @@
+/* gridgraph.cpp */
+/*
+    Grid version of maxflow.cpp; see gridgraph.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gridgraph.h"
+
+#define INFINITE_D ((int)(((unsigned)-1)/2))     /* infinite distance to the terminal */
+
+GridGraph::GridGraph(int width, int height, bool dynamic, void (*err_function)(const char *))
+{
+    error_function = err_function;
+    m_width = width;
+    m_height = height;
+    m_stride = width + 2;
+    m_nodes = m_stride*(height + 2);
+
+    m_shift[RIGHT] = 1;
+    m_shift[LEFT] = -1;
+    m_shift[DOWN] = m_stride;
+    m_shift[UP] = -m_stride;
+
+    m_node = (node_st *) malloc(m_nodes*sizeof(node_st));
+    m_rcap = (captype *) calloc(4*m_nodes, sizeof(captype));
+    if (!m_node || !m_rcap) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+
+    m_updating = false;
+    m_tr_old = m_tr_new = m_rcap_old = m_rcap_new = NULL;
+    m_const_old = m_const_new = 0;
+    if (dynamic)
+    {
+        m_tr_old = (captype *) calloc(m_nodes, sizeof(captype));
+        m_tr_new = (captype *) calloc(m_nodes, sizeof(captype));
+        m_rcap_old = (captype *) calloc(4*m_nodes, sizeof(captype));
+        m_rcap_new = (captype *) calloc(4*m_nodes, sizeof(captype));
+        if (!m_tr_old || !m_tr_new || !m_rcap_old || !m_rcap_new)
+            { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+    }
+
+    for (node_id i=0; i<m_nodes; i++) m_node[i].tr_cap = 0;
+    flow = 0;
+    augmentations = 0;
+    init_nodes();
+}
+
+GridGraph::~GridGraph()
+{
+    free(m_node);
+    free(m_rcap);
+    free(m_tr_old);
+    free(m_tr_new);
+    free(m_rcap_old);
+    free(m_rcap_new);
+}
+
+void GridGraph::reset()
+{
+    for (node_id i=0; i<m_nodes; i++) m_node[i].tr_cap = 0;
+    memset(m_rcap, 0, 4*m_nodes*sizeof(captype));
+    flow = 0;
+
+    if (m_tr_old)
+    {
+        memset(m_tr_old, 0, m_nodes*sizeof(captype));
+        memset(m_rcap_old, 0, 4*m_nodes*sizeof(captype));
+        m_const_old = 0;
+    }
+    m_updating = false;
+    init_nodes();
+}
+
+void GridGraph::add_edge(node_id i, int d, captype cap, captype rev_cap)
+{
+    if (m_updating)
+    {
+        m_rcap_new[4*i+d] += cap;
+        m_rcap_new[4*neighbor(i, d)+(d^1)] += rev_cap;
+        return;
+    }
+    r_cap(i, d) += cap;
+    r_cap(neighbor(i, d), d^1) += rev_cap;
+}
+
+void GridGraph::add_tweights(node_id i, captype cap_source, captype cap_sink)
+{
+    if (m_updating)
+    {
+        m_tr_new[i] += cap_source - cap_sink;
+        m_const_new += cap_sink;
+        return;
+    }
+    add_residual_tweights(i, cap_source, cap_sink);
+}
+
+void GridGraph::add_residual_tweights(node_id i, captype cap_source, captype cap_sink)
+{
+    captype delta = m_node[i].tr_cap;
+    if (delta > 0) cap_source += delta;
+    else           cap_sink   -= delta;
+    flow += (cap_source < cap_sink) ? cap_source : cap_sink;
+    m_node[i].tr_cap = cap_source - cap_sink;
+}
+
+GridGraph::termtype GridGraph::what_segment(node_id i)
+{
+    if (m_node[i].parent != FREE && !m_node[i].is_sink) return Graph::SOURCE;
+    return Graph::SINK;
+}
+
+/***********************************************************************/
+
+void GridGraph::begin_update()
+{
+    if (!m_tr_old) { if (error_function) (*error_function)("GridGraph was not constructed as dynamic"); exit(1); }
+
+    memset(m_tr_new, 0, m_nodes*sizeof(captype));
+    memset(m_rcap_new, 0, 4*m_nodes*sizeof(captype));
+    m_const_new = 0;
+    m_updating = true;
+}
+
+void GridGraph::end_update()
+{
+    node_id i, j;
+    int d, x, y;
+    captype delta, *tmp;
+
+    m_updating = false;
+
+    /* add the differences to the residual graph */
+    flow += m_const_new - m_const_old;
+    for (y=0; y<m_height; y++)
+    for (x=0; x<m_width; x++)
+    {
+        i = node(x, y);
+        if ((delta = m_tr_new[i] - m_tr_old[i]))
+        {
+            add_residual_tweights(i, delta, 0);
+            mark_node(i);
+        }
+        for (d=0; d<4; d++)
+        if ((delta = m_rcap_new[4*i+d] - m_rcap_old[4*i+d]))
+        {
+            r_cap(i, d) += delta;
+            mark_node(i);
+            mark_node(neighbor(i, d));
+        }
+    }
+
+    /*
+       An arc i->j with residual capacity -a < 0 adds -a to every cut with
+       i in the source set and j in the sink set. Reducing i->SINK by a,
+       increasing j->SINK by a and reducing j->i by a gives the same cuts.
+       The residual capacities of i->j and j->i add up to their capacities
+       in the new problem, which are >= 0, so j->i stays >= 0.
+    */
+    for (i=queue_first[1]; i>=0; i=(m_node[i].next==i) ? -1 : m_node[i].next)
+    {
+        for (d=0; d<4; d++)
+        if (r_cap(i, d) < 0)
+        {
+            delta = - r_cap(i, d);
+            j = neighbor(i, d);
+            r_cap(i, d) = 0;
+            r_cap(j, d^1) -= delta;
+            add_residual_tweights(i, 0, -delta);
+            add_residual_tweights(j, 0, delta);
+        }
+    }
+
+    tmp = m_tr_old; m_tr_old = m_tr_new; m_tr_new = tmp;
+    tmp = m_rcap_old; m_rcap_old = m_rcap_new; m_rcap_new = tmp;
+    m_const_old = m_const_new;
+}
+
+void GridGraph::mark_node(node_id i)
+{
+    if (m_node[i].next < 0)
+    {
+        /* it's not in the list yet */
+        if (queue_last[1] >= 0) m_node[queue_last[1]].next = i;
+        else                    queue_first[1]             = i;
+        queue_last[1] = i;
+        m_node[i].next = i;
+    }
+    m_node[i].is_marked = 1;
+}
+
+/***********************************************************************/
+
+/*
+    Functions for processing active list, as in maxflow.cpp.
+    i->next points to the next node in the list
+    (or to i, if i is the last node in the list).
+    i->next is -1 iff i is not in the list.
+*/
+
+inline void GridGraph::set_active(node_id i)
+{
+    if (m_node[i].next < 0)
+    {
+        /* it's not in the list yet */
+        if (queue_last[1] >= 0) m_node[queue_last[1]].next = i;
+        else                    queue_first[1]             = i;
+        queue_last[1] = i;
+        m_node[i].next = i;
+    }
+}
+
+inline GridGraph::node_id GridGraph::next_active()
+{
+    node_id i;
+
+    while ( 1 )
+    {
+        if ((i=queue_first[0]) < 0)
+        {
+            queue_first[0] = i = queue_first[1];
+            queue_last[0]  = queue_last[1];
+            queue_first[1] = -1;
+            queue_last[1]  = -1;
+            if (i < 0) return -1;
+        }
+
+        /* remove it from the active list */
+        if (m_node[i].next == i) queue_first[0] = queue_last[0] = -1;
+        else                     queue_first[0] = m_node[i].next;
+        m_node[i].next = -1;
+
+        /* a node in the list is active iff it has a parent */
+        if (m_node[i].parent != FREE) return i;
+    }
+}
+
+inline void GridGraph::set_orphan_front(node_id i)
+{
+    m_node[i].parent = ORPHAN;
+    orphans.push_front(i);
+}
+
+inline void GridGraph::set_orphan_rear(node_id i)
+{
+    m_node[i].parent = ORPHAN;
+    orphans.push_back(i);
+}
+
+/***********************************************************************/
+
+void GridGraph::init_nodes()
+{
+    node_id i;
+
+    queue_first[0] = queue_last[0] = -1;
+    queue_first[1] = queue_last[1] = -1;
+    orphans.clear();
+
+    for (i=0; i<m_nodes; i++)
+    {
+        m_node[i].next = -1;
+        m_node[i].TS = 0;
+        m_node[i].DIST = 0;
+        m_node[i].is_sink = 0;
+        m_node[i].is_marked = 0;
+        m_node[i].parent = FREE;
+    }
+    TIME = 0;
+}
+
+void GridGraph::maxflow_init()
+{
+    node_id i;
+    int x, y;
+
+    init_nodes();
+
+    for (y=0; y<m_height; y++)
+    for (x=0; x<m_width; x++)
+    {
+        i = node(x, y);
+        if (m_node[i].tr_cap > 0)
+        {
+            /* i is connected to the source */
+            m_node[i].is_sink = 0;
+            m_node[i].parent = TERMINAL;
+            set_active(i);
+            m_node[i].DIST = 1;
+        }
+        else if (m_node[i].tr_cap < 0)
+        {
+            /* i is connected to the sink */
+            m_node[i].is_sink = 1;
+            m_node[i].parent = TERMINAL;
+            set_active(i);
+            m_node[i].DIST = 1;
+        }
+    }
+}
+
+/*
+    As maxflow_reuse_trees_init() in maxflow-v3.0: marked nodes with a
+    terminal arc become children of their terminal, switching trees if
+    needed, marked nodes without one become orphans, and the adoption
+    stage repairs the trees around them. Other nodes keep their parents.
+*/
+void GridGraph::maxflow_reuse_trees_init()
+{
+    node_id i, j, queue = queue_first[1];
+    int d;
+
+    queue_first[0] = queue_last[0] = -1;
+    queue_first[1] = queue_last[1] = -1;
+    orphans.clear();
+
+    TIME ++;
+
+    while ((i=queue) >= 0)
+    {
+        queue = m_node[i].next;
+        if (queue == i) queue = -1;
+        m_node[i].next = -1;
+        m_node[i].is_marked = 0;
+        set_active(i);
+
+        if (m_node[i].tr_cap == 0)
+        {
+            if (m_node[i].parent != FREE) set_orphan_rear(i);
+            continue;
+        }
+
+        if (m_node[i].tr_cap > 0)
+        {
+            if (m_node[i].parent == FREE || m_node[i].is_sink)
+            {
+                m_node[i].is_sink = 0;
+                for (d=0; d<4; d++)
+                {
+                    j = neighbor(i, d);
+                    if (!m_node[j].is_marked)
+                    {
+                        if (m_node[j].parent == (d^1)) set_orphan_rear(j);
+                        if (m_node[j].parent != FREE && m_node[j].is_sink && r_cap(i, d)) set_active(j);
+                    }
+                }
+            }
+        }
+        else
+        {
+            if (m_node[i].parent == FREE || !m_node[i].is_sink)
+            {
+                m_node[i].is_sink = 1;
+                for (d=0; d<4; d++)
+                {
+                    j = neighbor(i, d);
+                    if (!m_node[j].is_marked)
+                    {
+                        if (m_node[j].parent == (d^1)) set_orphan_rear(j);
+                        if (m_node[j].parent != FREE && !m_node[j].is_sink && r_cap(j, d^1)) set_active(j);
+                    }
+                }
+            }
+        }
+        m_node[i].parent = TERMINAL;
+        m_node[i].TS = TIME;
+        m_node[i].DIST = 1;
+    }
+
+    /* adoption */
+    while (!orphans.empty())
+    {
+        i = orphans.front();
+        orphans.pop_front();
+        if (m_node[i].is_sink) process_sink_orphan(i);
+        else                   process_source_orphan(i);
+    }
+    /* adoption end */
+}
+
+/***********************************************************************/
+
+/* s_start is in the source tree, t_start = neighbor(s_start,d_middle) in the sink tree */
+void GridGraph::augment(node_id s_start, node_id t_start, int d_middle)
+{
+    node_id i, j;
+    int d;
+    captype bottleneck;
+
+    augmentations ++;
+
+    /* 1. Finding bottleneck capacity */
+    /* 1a - the source tree */
+    bottleneck = r_cap(s_start, d_middle);
+    for (i=s_start; ; i=j)
+    {
+        d = m_node[i].parent;
+        if (d == TERMINAL) break;
+        j = neighbor(i, d);
+        if (bottleneck > r_cap(j, d^1)) bottleneck = r_cap(j, d^1);
+    }
+    if (bottleneck > m_node[i].tr_cap) bottleneck = m_node[i].tr_cap;
+    /* 1b - the sink tree */
+    for (i=t_start; ; i=j)
+    {
+        d = m_node[i].parent;
+        if (d == TERMINAL) break;
+        j = neighbor(i, d);
+        if (bottleneck > r_cap(i, d)) bottleneck = r_cap(i, d);
+    }
+    if (bottleneck > - m_node[i].tr_cap) bottleneck = - m_node[i].tr_cap;
+
+    /* 2. Augmenting */
+    /* 2a - the middle arc */
+    r_cap(t_start, d_middle^1) += bottleneck;
+    r_cap(s_start, d_middle) -= bottleneck;
+    /* 2b - the source tree */
+    for (i=s_start; ; i=j)
+    {
+        d = m_node[i].parent;
+        if (d == TERMINAL) break;
+        j = neighbor(i, d);
+        r_cap(i, d) += bottleneck;
+        r_cap(j, d^1) -= bottleneck;
+        if (!r_cap(j, d^1)) set_orphan_front(i);
+    }
+    m_node[i].tr_cap -= bottleneck;
+    if (!m_node[i].tr_cap) set_orphan_front(i);
+    /* 2c - the sink tree */
+    for (i=t_start; ; i=j)
+    {
+        d = m_node[i].parent;
+        if (d == TERMINAL) break;
+        j = neighbor(i, d);
+        r_cap(j, d^1) += bottleneck;
+        r_cap(i, d) -= bottleneck;
+        if (!r_cap(i, d)) set_orphan_front(i);
+    }
+    m_node[i].tr_cap += bottleneck;
+    if (!m_node[i].tr_cap) set_orphan_front(i);
+
+    flow += bottleneck;
+}
+
+/***********************************************************************/
+
+void GridGraph::process_source_orphan(node_id i)
+{
+    node_id j, k;
+    int d, d0, d0_min = FREE, dist, dist_min = INFINITE_D;
+
+    /* trying to find a new parent */
+    for (d0=0; d0<4; d0++)
+    {
+        j = neighbor(i, d0);
+        if (r_cap(j, d0^1) && !m_node[j].is_sink && m_node[j].parent != FREE)
+        {
+            /* checking the origin of j */
+            dist = 0;
+            for (k=j; ; k=neighbor(k, d))
+            {
+                if (m_node[k].TS == TIME)
+                {
+                    dist += m_node[k].DIST;
+                    break;
+                }
+                d = m_node[k].parent;
+                dist ++;
+                if (d == TERMINAL)
+                {
+                    m_node[k].TS = TIME;
+                    m_node[k].DIST = 1;
+                    break;
+                }
+                if (d == ORPHAN) { dist = INFINITE_D; break; }
+            }
+
+            if (dist < INFINITE_D) /* j originates from the source - done */
+            {
+                if (dist < dist_min)
+                {
+                    d0_min = d0;
+                    dist_min = dist;
+                }
+                /* set marks along the path */
+                for (k=j; m_node[k].TS!=TIME; k=neighbor(k, m_node[k].parent))
+                {
+                    m_node[k].TS = TIME;
+                    m_node[k].DIST = dist --;
+                }
+            }
+        }
+    }
+
+    if ((m_node[i].parent = d0_min) != FREE)
+    {
+        m_node[i].TS = TIME;
+        m_node[i].DIST = dist_min + 1;
+    }
+    else
+    {
+        /* no parent is found */
+        m_node[i].TS = 0;
+
+        /* process neighbors */
+        for (d0=0; d0<4; d0++)
+        {
+            j = neighbor(i, d0);
+            d = m_node[j].parent;
+            if (!m_node[j].is_sink && d != FREE)
+            {
+                if (r_cap(j, d0^1)) set_active(j);
+                if (d == (d0^1)) set_orphan_rear(j);
+            }
+        }
+    }
+}
+
+void GridGraph::process_sink_orphan(node_id i)
+{
+    node_id j, k;
+    int d, d0, d0_min = FREE, dist, dist_min = INFINITE_D;
+
+    /* trying to find a new parent */
+    for (d0=0; d0<4; d0++)
+    {
+        j = neighbor(i, d0);
+        if (r_cap(i, d0) && m_node[j].is_sink && m_node[j].parent != FREE)
+        {
+            /* checking the origin of j */
+            dist = 0;
+            for (k=j; ; k=neighbor(k, d))
+            {
+                if (m_node[k].TS == TIME)
+                {
+                    dist += m_node[k].DIST;
+                    break;
+                }
+                d = m_node[k].parent;
+                dist ++;
+                if (d == TERMINAL)
+                {
+                    m_node[k].TS = TIME;
+                    m_node[k].DIST = 1;
+                    break;
+                }
+                if (d == ORPHAN) { dist = INFINITE_D; break; }
+            }
+
+            if (dist < INFINITE_D) /* j originates from the sink - done */
+            {
+                if (dist < dist_min)
+                {
+                    d0_min = d0;
+                    dist_min = dist;
+                }
+                /* set marks along the path */
+                for (k=j; m_node[k].TS!=TIME; k=neighbor(k, m_node[k].parent))
+                {
+                    m_node[k].TS = TIME;
+                    m_node[k].DIST = dist --;
+                }
+            }
+        }
+    }
+
+    if ((m_node[i].parent = d0_min) != FREE)
+    {
+        m_node[i].TS = TIME;
+        m_node[i].DIST = dist_min + 1;
+    }
+    else
+    {
+        /* no parent is found */
+        m_node[i].TS = 0;
+
+        /* process neighbors */
+        for (d0=0; d0<4; d0++)
+        {
+            j = neighbor(i, d0);
+            d = m_node[j].parent;
+            if (m_node[j].is_sink && d != FREE)
+            {
+                if (r_cap(i, d0)) set_active(j);
+                if (d == (d0^1)) set_orphan_rear(j);
+            }
+        }
+    }
+}
+
+/***********************************************************************/
+
+GridGraph::flowtype GridGraph::maxflow(bool reuse_trees)
+{
+    node_id i, j, current_node = -1, s_start = -1, t_start = -1;
+    int d, d_middle = 0;
+
+    if (reuse_trees) maxflow_reuse_trees_init();
+    else             maxflow_init();
+
+    while ( 1 )
+    {
+        if ((i=current_node) >= 0)
+        {
+            m_node[i].next = -1; /* remove active flag */
+            if (m_node[i].parent == FREE) i = -1;
+        }
+        if (i < 0)
+        {
+            if ((i = next_active()) < 0) break;
+        }
+
+        /* growth */
+        s_start = -1;
+
+        if (!m_node[i].is_sink)
+        {
+            /* grow source tree */
+            for (d=0; d<4; d++)
+            if (r_cap(i, d))
+            {
+                j = neighbor(i, d);
+                if (m_node[j].parent == FREE)
+                {
+                    m_node[j].is_sink = 0;
+                    m_node[j].parent = d^1;
+                    m_node[j].TS = m_node[i].TS;
+                    m_node[j].DIST = m_node[i].DIST + 1;
+                    set_active(j);
+                }
+                else if (m_node[j].is_sink)
+                {
+                    s_start = i;
+                    t_start = j;
+                    d_middle = d;
+                    break;
+                }
+                else if (m_node[j].TS <= m_node[i].TS &&
+                         m_node[j].DIST > m_node[i].DIST)
+                {
+                    /* heuristic - trying to make the distance from j to the source shorter */
+                    m_node[j].parent = d^1;
+                    m_node[j].TS = m_node[i].TS;
+                    m_node[j].DIST = m_node[i].DIST + 1;
+                }
+            }
+        }
+        else
+        {
+            /* grow sink tree */
+            for (d=0; d<4; d++)
+            {
+                j = neighbor(i, d);
+                if (!r_cap(j, d^1)) continue;
+                if (m_node[j].parent == FREE)
+                {
+                    m_node[j].is_sink = 1;
+                    m_node[j].parent = d^1;
+                    m_node[j].TS = m_node[i].TS;
+                    m_node[j].DIST = m_node[i].DIST + 1;
+                    set_active(j);
+                }
+                else if (!m_node[j].is_sink)
+                {
+                    s_start = j;
+                    t_start = i;
+                    d_middle = d^1;
+                    break;
+                }
+                else if (m_node[j].TS <= m_node[i].TS &&
+                         m_node[j].DIST > m_node[i].DIST)
+                {
+                    /* heuristic - trying to make the distance from j to the sink shorter */
+                    m_node[j].parent = d^1;
+                    m_node[j].TS = m_node[i].TS;
+                    m_node[j].DIST = m_node[i].DIST + 1;
+                }
+            }
+        }
+
+        TIME ++;
+
+        if (s_start >= 0)
+        {
+            m_node[i].next = i; /* set active flag */
+            current_node = i;
+
+            /* augmentation */
+            augment(s_start, t_start, d_middle);
+            /* augmentation end */
+
+            /* adoption */
+            while (!orphans.empty())
+            {
+                j = orphans.front();
+                orphans.pop_front();
+                if (m_node[j].is_sink) process_sink_orphan(j);
+                else                   process_source_orphan(j);
+            }
+            /* adoption end */
+        }
+        else current_node = -1;
+    }
+
+    return flow;
+}
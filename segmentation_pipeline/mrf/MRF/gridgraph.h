@@ -0,0 +1,246 @@
+/* gridgraph.h */
+/*
+    Maxflow for 4-connected grids of width x height nodes.
+
+    This is the algorithm of graph.h / maxflow.cpp (Boykov-Kolmogorov search
+    trees with the same timestamp and distance heuristics), but the graph is
+    implicit in the grid: nodes are referred to by index, the residual
+    capacities of the arcs leaving a node are stored next to each other in one
+    array (right, left, down, up), and the sister of an arc is found by index
+    arithmetic. Everything is allocated once in the constructor, so there is
+    no per-node or per-arc allocation and no pointer chasing while the search
+    trees grow.
+
+    The grid is padded by one node on every side. Arcs into and out of padding
+    nodes stay 0, so the inner loops need no border tests. Use node(x,y) to get
+    the index of pixel (x,y).
+
+    GridEnergy adds the add_term1() / add_term2() interface of energy.h, with
+    the same truncation of non-submodular terms.
+
+    A graph can be used for several problems on the same grid. reset() sets
+    all capacities back to 0 without freeing anything. A graph constructed
+    with dynamic = true can instead be updated to a changed problem and keep
+    its flow (dynamic graph cuts, P. Kohli and P. Torr, ICCV 2005):
+
+        g -> begin_update();
+        ... add_tweights() / add_edge() for ALL terms of the new problem ...
+        g -> end_update();
+        g -> maxflow(true);
+
+    end_update() adds the difference to the previous problem to the residual
+    graph of the previous flow, reparametrizing arcs whose residual capacity
+    becomes negative, and marks the nodes it touched. maxflow(true) reuses the
+    search trees of the previous call for all unmarked nodes, as in
+    maxflow-v3.0 by Kolmogorov. A dynamic graph keeps a second copy of the
+    capacities to compute the difference. The first problem may also be
+    added this way.
+*/
+
+#ifndef __GRIDGRAPH_H__
+#define __GRIDGRAPH_H__
+
+#include <assert.h>
+#include <deque>
+#include "graph.h"
+
+class GridGraph
+{
+public:
+    typedef Graph::termtype termtype;
+    typedef Graph::captype captype;
+    typedef Graph::flowtype flowtype;
+    typedef int node_id;
+
+    /* Directions of the arcs leaving a node. The sister of arc (i,d) is arc (neighbor(i,d),d^1) */
+    enum { RIGHT = 0, LEFT = 1, DOWN = 2, UP = 3 };
+
+    /* Constructor. Optional argument is the function called on an error, as in Graph. */
+    /* All capacities start at 0. Only dynamic graphs support begin_update() / end_update() */
+    GridGraph(int width, int height, bool dynamic = false, void (*err_function)(const char *) = NULL);
+
+    ~GridGraph();
+
+    /* Index of the node of pixel (x,y) */
+    inline node_id node(int x, int y) { return (y+1)*m_stride + x+1; }
+
+    /* Neighbor of node i in direction d */
+    inline node_id neighbor(node_id i, int d) { return i + m_shift[d]; }
+
+    /* Adds capacities to the arcs i->neighbor(i,d) and back. Can be called several times for an arc */
+    void add_edge(node_id i, int d, captype cap, captype rev_cap);
+
+    /* Adds new edges 'SOURCE->i' and 'i->SINK', as in Graph */
+    void add_tweights(node_id i, captype cap_source, captype cap_sink);
+
+    /* After the maxflow is computed, returns to which segment node i belongs */
+    termtype what_segment(node_id i);
+
+    /* Computes the maxflow. Returns the value of the minimum cut of the current problem. */
+    /* With reuse_trees, starts from the search trees of the previous call (see above)    */
+    flowtype maxflow(bool reuse_trees = false);
+
+    /* Sets all capacities and the flow to 0, keeping the memory */
+    void reset();
+
+    /* Number of augmenting paths that all calls of maxflow() found since the graph was constructed */
+    long num_augmentations() { return augmentations; }
+
+    /* Updating a dynamic graph to a new problem, see above */
+    void begin_update();
+    void end_update();
+
+    /* Marks node i as changed for maxflow(true); end_update() calls it for every node it changes */
+    void mark_node(node_id i);
+
+private:
+    /* values of parent[i] besides the direction 0..3 of the arc to the parent */
+    enum { TERMINAL = 4, ORPHAN = 5, FREE = 6 };
+
+    struct node_st
+    {
+        node_id         next;       /* next active node, itself if last, -1 if not active */
+        int             TS;         /* timestamp showing when DIST was computed */
+        int             DIST;       /* distance to the terminal */
+        captype         tr_cap;     /* residual capacity of SOURCE->i if > 0, of i->SINK if < 0 */
+        unsigned char   parent;     /* direction of the arc to the parent, or TERMINAL, ORPHAN, FREE */
+        unsigned char   is_sink;    /* if the node is in the sink tree */
+        unsigned char   is_marked;  /* if the node was changed since the last maxflow */
+    };
+
+    int         m_width, m_height, m_stride, m_nodes;
+    int         m_shift[4];
+    node_st     *m_node;
+    captype     *m_rcap;            /* m_rcap[4*i+d] is the residual capacity of arc (i,d) */
+    flowtype    flow;
+    long        augmentations;
+
+    /* dynamic graphs: the problem of the last end_update() and the one being added */
+    bool        m_updating;
+    captype     *m_tr_old, *m_tr_new;       /* source minus sink capacity of each node */
+    captype     *m_rcap_old, *m_rcap_new;   /* arc capacities, laid out as m_rcap */
+    flowtype    m_const_old, m_const_new;   /* sink capacities moved out of m_tr_* */
+
+    void        (*error_function)(const char *);
+
+    node_id             queue_first[2], queue_last[2];
+    std::deque<node_id> orphans;
+    int                 TIME;
+
+    inline captype &r_cap(node_id i, int d) { return m_rcap[4*i+d]; }
+
+    void add_residual_tweights(node_id i, captype cap_source, captype cap_sink);
+
+    void set_active(node_id i);
+    node_id next_active();
+    void set_orphan_front(node_id i);
+    void set_orphan_rear(node_id i);
+
+    void init_nodes();
+    void maxflow_init();
+    void maxflow_reuse_trees_init();
+    void augment(node_id s_start, node_id t_start, int d_middle);
+    void process_source_orphan(node_id i);
+    void process_sink_orphan(node_id i);
+};
+
+/***********************************************************************/
+
+class GridEnergy : GridGraph
+{
+public:
+    typedef node_id Var;
+    typedef captype Value;
+    typedef flowtype TotalValue;
+
+    using GridGraph::RIGHT;
+    using GridGraph::LEFT;
+    using GridGraph::DOWN;
+    using GridGraph::UP;
+    using GridGraph::node;
+    using GridGraph::neighbor;
+
+    using GridGraph::reset;
+    using GridGraph::begin_update;
+    using GridGraph::end_update;
+    using GridGraph::num_augmentations;
+
+    GridEnergy(int width, int height, bool dynamic = false, void (*err_function)(const char *) = NULL)
+        : GridGraph(width, height, dynamic, err_function) { terms = truncations = 0; }
+
+    /* E(x) = A if x == 0, B if x == 1 */
+    void add_term1(Var x, Value A, Value B);
+
+    /* Term for x and its neighbor y in direction d:
+       E(x,y) = A if x == 0, y == 0; B if 0,1; C if 1,0; D if 1,1.
+       Terms with A+D > B+C are truncated as in Energy::add_term2 */
+    void add_term2(Var x, int d, Value A, Value B, Value C, Value D);
+
+    /* Same as add_term2(x, d, 0, lambda, lambda, 0), a Potts term, for lambda >= 0.
+       Such a term is one edge and needs no truncation */
+    void add_potts_term(Var x, int d, Value lambda);
+
+    /* With reuse_trees, see GridGraph::maxflow() */
+    TotalValue minimize(bool reuse_trees = false) { return maxflow(reuse_trees); }
+
+    int get_var(Var x) { return (int) what_segment(x); }
+
+    /* Numbers of calls of add_term2() and of the terms among them that were truncated,
+       since the energy was constructed */
+    long num_terms() { return terms; }
+    long num_truncations() { return truncations; }
+
+private:
+    long terms, truncations;
+};
+
+inline void GridEnergy::add_term1(Var x, Value A, Value B)
+{
+    add_tweights(x, B, A);
+}
+
+inline void GridEnergy::add_term2(Var x, int d, Value A, Value B, Value C, Value D)
+{
+    Var y = neighbor(x, d);
+
+    if ( A+D > C+B) {
+        Value delta = A+D-C-B;
+        Value subtrA = delta/3;
+
+        A = A-subtrA;
+        C = C+subtrA;
+        B = B+(delta-subtrA*2);
+        truncations++;
+    }
+    terms++;
+
+    add_tweights(x, D, A);
+    B -= A; C -= D;
+
+    assert(B + C >= 0);
+    if (B < 0)
+    {
+        add_tweights(x, 0, B);
+        add_tweights(y, 0, -B);
+        add_edge(x, d, 0, B+C);
+    }
+    else if (C < 0)
+    {
+        add_tweights(x, 0, -C);
+        add_tweights(y, 0, C);
+        add_edge(x, d, B+C, 0);
+    }
+    else
+    {
+        add_edge(x, d, B, C);
+    }
+}
+
+inline void GridEnergy::add_potts_term(Var x, int d, Value lambda)
+{
+    assert(lambda >= 0);
+    terms++;
+    add_edge(x, d, lambda, lambda);
+}
+
+#endif
@@ -137,6 +137,7 @@ void Graph::augment(node *s_start, node *t_start, captype *cap_middle, captype *
     captype bottleneck;
     nodeptr *np;
 
+    augmentations ++;
 
     /* 1. Finding bottleneck capacity */
     /* 1a - the source tree */
@@ -660,7 +661,7 @@ Graph::flowtype Graph::maxflow()
 
     prepare_graph();
     maxflow_init();
-    nodeptr_block = new DBlock<nodeptr>(NODEPTR_BLOCK_SIZE, error_function);
+    nodeptr_block = new DBlock<nodeptr>(NODEPTR_BLOCK_SIZE, error_function, arena);
 
     while ( 1 )
     {
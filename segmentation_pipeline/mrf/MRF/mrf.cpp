@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <chrono>
 #include "mrf.h"
 
 
@@ -51,6 +52,13 @@ void MRF::initialize()
 }
 
 
+void MRF::setNeighbors(int numEdges, int *pix1, int *pix2, CostVal *weights)
+{
+    for ( int i = 0; i < numEdges; i++ )
+        setNeighbors(pix1[i],pix2[i],weights[i]);
+}
+
+
 void MRF::commonInitialization(EnergyFunction *e)
 {
     m_dataType    = e->m_dataCost->m_type;
@@ -59,6 +67,9 @@ void MRF::commonInitialization(EnergyFunction *e)
     m_initialized = 0;
     m_e = e;
     m_allocateArrayForSmoothnessCostFn = true;
+
+    m_stats.labelMoves = new long[m_nLabels];
+    resetStats();
 }
 
 
@@ -101,15 +112,77 @@ void MRF::optimize(int nIterations, float& time)
     if (!isValid()) { fprintf(stderr, "optimize() cannot be called for invalid energy!\n"); exit(1); }
     if (!m_initialized ) { fprintf(stderr, "run initialize() first!\n"); exit(1); }
 
-    // start timer
-    clock_t start = clock();
-
+    // start timer; clock() is the CPU time of all threads, so the time returned is on a wall clock
+    double start = wallClock();
+    clock_t startCpu = clock();
 
+    m_iterations = nIterations;
     optimizeAlg(nIterations);
 
     // stop timer
-    clock_t finish = clock();
-    time = (float) (((double)(finish - start)) / CLOCKS_PER_SEC);
+    double finish = wallClock();
+    clock_t finishCpu = clock();
+    time = (float) (finish - start);
+
+    m_stats.wallTime += finish - start;
+    m_stats.cpuTime += ((double)(finishCpu - startCpu)) / CLOCKS_PER_SEC;
+    m_stats.iterations += m_iterations;
+}
+
+
+double MRF::wallClock()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void MRF::resetStats()
+{
+    long *labelMoves = m_stats.labelMoves;
+
+    memset(&m_stats, 0, sizeof(Stats));
+    m_stats.labelMoves = labelMoves;
+    memset(labelMoves, 0, m_nLabels*sizeof(long));
+}
+
+
+void MRF::addMoveStats(int label1, int label2, double buildTime, double maxflowTime,
+                       long augmentations, long terms, long truncations)
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+
+    m_stats.buildTime += buildTime;
+    m_stats.maxflowTime += maxflowTime;
+    m_stats.moves++;
+    m_stats.augmentations += augmentations;
+    m_stats.terms += terms;
+    m_stats.truncations += truncations;
+    m_stats.labelMoves[label1]++;
+    if ( label2 >= 0 ) m_stats.labelMoves[label2]++;
+}
+
+
+void MRF::addEnergyStats(double energyTime)
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+
+    m_stats.energyTime += energyTime;
+    m_stats.energyEvaluations++;
+}
+
+
+void MRF::printStats(FILE *fp)
+{
+    fprintf(fp, "{\"wall_time\": %.6f, \"cpu_time\": %.6f, \"iterations\": %d,\n",
+            m_stats.wallTime, m_stats.cpuTime, m_stats.iterations);
+    fprintf(fp, " \"build_time\": %.6f, \"maxflow_time\": %.6f, \"energy_time\": %.6f, \"energy_evaluations\": %ld,\n",
+            m_stats.buildTime, m_stats.maxflowTime, m_stats.energyTime, m_stats.energyEvaluations);
+    fprintf(fp, " \"moves\": %ld, \"augmentations\": %ld, \"terms\": %ld, \"truncations\": %ld,\n",
+            m_stats.moves, m_stats.augmentations, m_stats.terms, m_stats.truncations);
+    fprintf(fp, " \"label_moves\": [");
+    for ( int l = 0; l < m_nLabels; l++ )
+        fprintf(fp, (l > 0) ? ", %ld" : "%ld", m_stats.labelMoves[l]);
+    fprintf(fp, "]}\n");
 }
 
 
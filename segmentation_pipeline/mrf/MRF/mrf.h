@@ -5,6 +5,7 @@
 #ifndef __MRF_H__
 #define __MRF_H__
 #include <stdio.h>
+#include <mutex>
 
 class EnergyFunction;
 
@@ -28,7 +29,7 @@ public:
     // after this constructor you need to call setNeighbors() to specify the neighborhood system
     MRF(int nPixels, int nLabels, EnergyFunction *eng);
 
-    virtual ~MRF() { }
+    virtual ~MRF() { delete [] m_stats.labelMoves; }
     
     // Returns true if energy function has been specified, returns false otherwise
     // By default, it always returns true. Can be modified by the supplier of
@@ -38,10 +39,18 @@ public:
 
     // *********** EVALUATING THE ENERGY
     typedef int Label;
+#if defined(MRF_64BIT_COST)
+    typedef long long EnergyVal;  /* The total energy of a labeling */
+    typedef long long CostVal;    /* costs of individual terms of the energy */
+#elif defined(MRF_64BIT_ENERGY)
+    typedef long long EnergyVal;  /* The total energy of a labeling, and the flow of graph cuts */
+    typedef int CostVal;          /* costs of individual terms of the energy */
+#else
     typedef int EnergyVal;        /* The total energy of a labeling */
     typedef int CostVal;          /* costs of individual terms of the energy */
+#endif
  
-    EnergyVal totalEnergy();      /* returns energy of current labeling */
+    virtual EnergyVal totalEnergy();  /* returns energy of current labeling */
     virtual EnergyVal dataEnergy() = 0;        /* returns the data part of the energy */
     virtual EnergyVal smoothnessEnergy() = 0;  /* returns the smoothness part of the energy */
 
@@ -61,11 +70,16 @@ public:
     // or setNeighbors(pixel2,pixel1,weight), but NOT BOTH                                     
     virtual void setNeighbors(int pix1, int pix2, CostVal weight)= 0;
 
+    // Sets numEdges neighbor pairs at once: pix1[k] and pix2[k] with weight weights[k].
+    // Same as calling setNeighbors(pix1[k],pix2[k],weights[k]) for every k, which is what
+    // it does unless an implementation builds its neighborhood system in bulk
+    virtual void setNeighbors(int numEdges, int *pix1, int *pix2, CostVal *weights);
+
 
     void initialize();
 
-    // Runs optimization for nIterations. Input parameter time returns the time it took to
-    // perform nIterations of optimization
+    // Runs optimization for nIterations. Input parameter time returns the wall clock time
+    // it took to perform nIterations of optimization
     void optimize(int nIterations, float& time);
     virtual void optimizeAlg(int nIterations)=0;
 
@@ -92,6 +106,32 @@ public:
     // Returns 2 if current optimizaiton algorithm does not check the energy 
     virtual char checkEnergy();
 
+    // *********** TIMING AND STATISTICS
+    // optimize() adds the wall clock and CPU time it took and the iterations it ran to the
+    // statistics below, and the graph cut algorithms add the phases and counters of their
+    // moves. They are sums over all calls of optimize() since construction or resetStats().
+    // Phases of moves that run in parallel are summed over the threads that run them.
+    typedef struct
+    {
+        double wallTime;            // seconds in optimize(), on a monotonic clock
+        double cpuTime;             // seconds of CPU time of all threads of the process in optimize()
+        int    iterations;          // iterations run, fewer than asked for if an algorithm stopped early
+        double buildTime;           // seconds building the graphs of moves
+        double maxflowTime;         // seconds computing their maxflows
+        double energyTime;          // seconds evaluating the energy of the labeling from scratch
+        long   energyEvaluations;   // such evaluations
+        long   moves;               // alpha expansions, alpha-beta swaps or binary cuts
+        long   augmentations;       // augmenting paths found by maxflow
+        long   terms;               // pairwise terms added to the graphs (add_term2)
+        long   truncations;         // terms among them made submodular by truncation
+        long  *labelMoves;          // labelMoves[l]: moves that involve label l, nLabels entries
+    } Stats;
+
+    const Stats& getStats() { return m_stats; }
+    void resetStats();
+    // Writes the statistics as one JSON object
+    void printStats(FILE *fp);
+
     typedef enum
         {
             FUNCTION,
@@ -108,6 +148,7 @@ protected:
     bool m_grid_graph;   // true if the graph is a 2D grid
     bool m_varWeights;   // true if weights are spatially varying. To be used only with 2D grids
     bool m_initialized;  // true if array m_V is allocated memory.  
+    int  m_iterations;   // iterations the last optimizeAlg() ran, its nIterations unless it stopped early
     EnergyFunction *m_e;
     
     InputType m_dataType;     
@@ -151,6 +192,16 @@ protected:
     virtual void initializeAlg()=0; // called by initialize()
 
     void commonInitialization(EnergyFunction *e);
+
+    Stats m_stats;
+    std::mutex m_statsMutex;
+    // Seconds on a monotonic clock, for differences of times
+    static double wallClock();
+    // Adds a move of label1 (and label2 unless it is negative) to the statistics. Can be called
+    // from several threads at once
+    void addMoveStats(int label1, int label2, double buildTime, double maxflowTime,
+                      long augmentations, long terms, long truncations);
+    void addEnergyStats(double energyTime);
     void checkArray(CostVal *V);
 };
 
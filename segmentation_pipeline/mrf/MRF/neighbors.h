@@ -0,0 +1,152 @@
+/* neighbors.h */
+/*
+    Template class NeighborSystem
+    Neighborhood system of a non-grid graph, in compressed sparse row form.
+
+    Edges are added one at a time or as arrays, and are kept in a Block
+    taken from the arena of the neighborhood system, so adding millions of
+    edges does not allocate them one by one. build() then lays out the
+    neighbors of all pixels in one array, in two passes over the edges:
+    the first counts the neighbors of every pixel, the second writes each
+    edge into the ranges of both of its pixels. The neighbors of pixel p
+    are begin(p) ... end(p)-1, in the reverse order of their addition (the
+    order of the LinkedBlockList this replaces).
+
+    build() must be called after the last add() and before begin() / end()
+    are used. It does nothing if no edge was added since the last call, so
+    the solvers call it at the start of every pass over the neighbors.
+
+    Example usage:
+    ///////////////////////////////////////////////////
+    #include "neighbors.h"
+
+    NeighborSystem<int> *nb = new NeighborSystem<int>(num_pixels);
+    nb -> add(0, 1, 10);
+    nb -> add(num_edges, pix1, pix2, weights);
+    nb -> build();
+    for (NeighborSystem<int>::Neighbor *n=nb->begin(p); n<nb->end(p); n++)
+    {
+        printf("%d %d\n", n->to_node, n->weight);
+    }
+    delete nb;
+    ///////////////////////////////////////////////////
+*/
+
+#ifndef __NEIGHBORS_H__
+#define __NEIGHBORS_H__
+
+#include <string.h>
+#include "arena.h"
+#include "block.h"
+
+#define NEIGHBOR_EDGE_BLOCK_SIZE 4096
+
+template <class WeightType> class NeighborSystem
+{
+public:
+    typedef struct NeighborStruct
+    {
+        int             to_node;
+        WeightType      weight;
+    } Neighbor;
+
+    /* Constructor. Arguments are the number of pixels and
+       (optionally) the pointer to the function which
+       will be called if allocation failed */
+    NeighborSystem(int num_pixels, void (*err_function)(const char *) = NULL)
+        : arena(ARENA_CHUNK_SIZE, err_function)
+    {
+        edges = new Block<edge>(NEIGHBOR_EDGE_BLOCK_SIZE, err_function, &arena);
+        n = num_pixels;
+        num_edges = 0;
+        changed = true;
+        start = NULL;
+        list = NULL;
+        error_function = err_function;
+    }
+
+    /* Destructor. The edges are freed with the arena */
+    ~NeighborSystem() { delete edges; delete [] start; delete [] list; }
+
+    /* Makes pix1 and pix2 neighbors of each other with the given weight */
+    void add(int pix1, int pix2, WeightType weight)
+    {
+        edge *e = edges -> New();
+        e -> pix1 = pix1;
+        e -> pix2 = pix2;
+        e -> weight = weight;
+        num_edges++;
+        changed = true;
+    }
+
+    /* Adds the edges (pix1[k], pix2[k]) with weights weight[k], k = 0 ... num-1 */
+    void add(int num, const int *pix1, const int *pix2, const WeightType *weight)
+    {
+        for (int k=0; k<num; k++) add(pix1[k], pix2[k], weight[k]);
+    }
+
+    /* Lays out the neighbors of every pixel contiguously, see above */
+    void build();
+
+    /* Neighbors of pixel pix are begin(pix) ... end(pix)-1 */
+    inline Neighbor *begin(int pix) { return list + start[pix]; }
+    inline Neighbor *end(int pix) { return list + start[pix+1]; }
+
+/***********************************************************************/
+
+private:
+    typedef struct edge_st
+    {
+        int             pix1, pix2;
+        WeightType      weight;
+    } edge;
+
+    Arena       arena;
+    Block<edge> *edges;
+    int         n, num_edges;
+    bool        changed;            /* if edges were added since the last build() */
+    int         *start;             /* neighbors of p are list[start[p]] ... list[start[p+1]-1] */
+    Neighbor    *list;
+
+    void        (*error_function)(const char *);
+};
+
+/***********************************************************************/
+
+template <class WeightType> void NeighborSystem<WeightType>::build()
+{
+    edge *e;
+    int p;
+
+    if (!changed) return;
+    changed = false;
+
+    delete [] start;
+    delete [] list;
+    start = new int[n+1];
+    list = new Neighbor[2*num_edges > 0 ? 2*num_edges : 1];
+    if (!start || !list) { if (error_function) (*error_function)("Not enough memory!"); exit(1); }
+
+    /* start[p] becomes the end of the range of p ... */
+    memset(start, 0, (n+1)*sizeof(int));
+    for (e=edges->ScanFirst(); e; e=edges->ScanNext())
+    {
+        start[e->pix1] ++;
+        start[e->pix2] ++;
+    }
+    for (p=1; p<n; p++) start[p] += start[p-1];
+    start[n] = 2*num_edges;
+
+    /* ... and moves back to its beginning while the range is filled from the end */
+    for (e=edges->ScanFirst(); e; e=edges->ScanNext())
+    {
+        Neighbor *a = &list[-- start[e->pix1]];
+        Neighbor *b = &list[-- start[e->pix2]];
+        a -> to_node = e -> pix2;
+        a -> weight  = e -> weight;
+        b -> to_node = e -> pix1;
+        b -> weight  = e -> weight;
+    }
+}
+
+#endif
@@ -0,0 +1,162 @@
+/* regiongraph.cpp */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "regiongraph.h"
+
+/**************************************************************************************/
+
+RegionGraph::RegionGraph(int width, int height, const int *labels)
+{
+    m_width  = width;
+    m_height = height;
+    m_region = new int[width*height];
+    if ( !m_region ) { fprintf(stderr, "Not enough memory!\n"); exit(1); }
+
+    findRegions(labels);
+    findEdges();
+}
+
+/**************************************************************************************/
+
+RegionGraph::~RegionGraph()
+{
+    delete [] m_region;
+    delete [] m_regionLabel;
+    delete [] m_regionSize;
+    delete [] m_edge1;
+    delete [] m_edge2;
+    delete [] m_length;
+}
+
+/**************************************************************************************/
+/* Flood fills the 4-connected components of equal labels with an explicit stack      */
+
+void RegionGraph::findRegions(const int *labels)
+{
+    int nPixels = m_width*m_height;
+    int *stack = new int[nPixels];
+    int *regionLabel = new int[nPixels];
+    int *regionSize = new int[nPixels];
+    if ( !stack || !regionLabel || !regionSize ) { fprintf(stderr, "Not enough memory!\n"); exit(1); }
+
+    int pix,top,x,y;
+
+    for ( pix = 0; pix < nPixels; pix++ ) m_region[pix] = -1;
+
+    m_nRegions = 0;
+    for ( pix = 0; pix < nPixels; pix++ )
+    {
+        if ( labels[pix] < 0 || m_region[pix] >= 0 ) continue;
+
+        int label = labels[pix];
+        int size  = 0;
+
+        m_region[pix] = m_nRegions;
+        stack[0] = pix;
+        top = 1;
+        while ( top > 0 )
+        {
+            int p = stack[--top];
+            size++;
+            x = p % m_width;
+            y = p / m_width;
+
+            if ( x > 0 && labels[p-1] == label && m_region[p-1] < 0 )
+                { m_region[p-1] = m_nRegions; stack[top++] = p-1; }
+            if ( x < m_width-1 && labels[p+1] == label && m_region[p+1] < 0 )
+                { m_region[p+1] = m_nRegions; stack[top++] = p+1; }
+            if ( y > 0 && labels[p-m_width] == label && m_region[p-m_width] < 0 )
+                { m_region[p-m_width] = m_nRegions; stack[top++] = p-m_width; }
+            if ( y < m_height-1 && labels[p+m_width] == label && m_region[p+m_width] < 0 )
+                { m_region[p+m_width] = m_nRegions; stack[top++] = p+m_width; }
+        }
+
+        regionLabel[m_nRegions] = label;
+        regionSize[m_nRegions]  = size;
+        m_nRegions++;
+    }
+
+    m_regionLabel = new int[m_nRegions > 0 ? m_nRegions : 1];
+    m_regionSize  = new int[m_nRegions > 0 ? m_nRegions : 1];
+    for ( int r = 0; r < m_nRegions; r++ )
+    {
+        m_regionLabel[r] = regionLabel[r];
+        m_regionSize[r]  = regionSize[r];
+    }
+
+    delete [] stack;
+    delete [] regionLabel;
+    delete [] regionSize;
+}
+
+/**************************************************************************************/
+/* Every pair of 4-neighbors in different regions adds 1 to the length of their edge. */
+/* The pairs are collected as (smaller region, larger region) keys and sorted, so     */
+/* each edge is one run of equal keys                                                 */
+
+void RegionGraph::findEdges()
+{
+    long long *keys = new long long[2*m_width*m_height];
+    if ( !keys ) { fprintf(stderr, "Not enough memory!\n"); exit(1); }
+
+    int nKeys = 0,x,y,k;
+
+    for ( y = 0; y < m_height; y++ )
+        for ( x = 0; x < m_width; x++ )
+        {
+            int pix = x+y*m_width;
+            int a = m_region[pix];
+            if ( a < 0 ) continue;
+
+            int b = (x < m_width-1)  ? m_region[pix+1]       : -1;
+            int c = (y < m_height-1) ? m_region[pix+m_width] : -1;
+
+            if ( b >= 0 && b != a )
+                keys[nKeys++] = (long long) std::min(a,b)*m_nRegions + std::max(a,b);
+            if ( c >= 0 && c != a )
+                keys[nKeys++] = (long long) std::min(a,c)*m_nRegions + std::max(a,c);
+        }
+
+    std::sort(keys,keys+nKeys);
+
+    m_nEdges = 0;
+    for ( k = 0; k < nKeys; k++ )
+        if ( k == 0 || keys[k] != keys[k-1] ) m_nEdges++;
+
+    m_edge1  = new int[m_nEdges > 0 ? m_nEdges : 1];
+    m_edge2  = new int[m_nEdges > 0 ? m_nEdges : 1];
+    m_length = new MRF::CostVal[m_nEdges > 0 ? m_nEdges : 1];
+    if ( !m_edge1 || !m_edge2 || !m_length ) { fprintf(stderr, "Not enough memory!\n"); exit(1); }
+
+    int e = -1;
+    for ( k = 0; k < nKeys; k++ )
+    {
+        if ( k == 0 || keys[k] != keys[k-1] )
+        {
+            e++;
+            m_edge1[e]  = (int) (keys[k] / m_nRegions);
+            m_edge2[e]  = (int) (keys[k] % m_nRegions);
+            m_length[e] = 0;
+        }
+        m_length[e]++;
+    }
+
+    delete [] keys;
+}
+
+/**************************************************************************************/
+
+void RegionGraph::setNeighbors(MRF *mrf, MRF::CostVal lambda)
+{
+    MRF::CostVal *weights = new MRF::CostVal[m_nEdges > 0 ? m_nEdges : 1];
+    if ( !weights ) { fprintf(stderr, "Not enough memory!\n"); exit(1); }
+
+    for ( int e = 0; e < m_nEdges; e++ )
+        weights[e] = lambda*m_length[e];
+
+    mrf -> setNeighbors(m_nEdges,m_edge1,m_edge2,weights);
+
+    delete [] weights;
+}
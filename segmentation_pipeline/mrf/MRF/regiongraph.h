@@ -0,0 +1,72 @@
+/* regiongraph.h */
+/*
+    Region adjacency graph of a label image, as the neighborhood system of a
+    non-grid MRF whose "pixels" are regions.
+
+    A region is a 4-connected component of pixels with the same label, so a
+    label that is split into several pieces gives several regions. Pixels with
+    a negative label belong to no region. Two regions are neighbors if they
+    touch, and the weight of their edge is the length of their shared
+    boundary: the number of 4-neighbor pixel pairs with one pixel in each.
+
+    An MRF over the regions is usually orders of magnitude smaller than the
+    pixel grid of the same image. Build it with the non-grid constructor of a
+    solver, e.g. for alpha-expansion with a Potts smoothness term:
+
+        RegionGraph *rg = new RegionGraph(width, height, labels);
+        ... data costs D[r*nLabels+l] for every region r = 0,...,numRegions()-1 ...
+        MRF *mrf = new Expansion(rg->numRegions(), nLabels, eng);
+        rg -> setNeighbors(mrf, lambda);
+        mrf -> initialize();
+        ...
+        label of pixel p is mrf->getLabel(rg->region(p)) if rg->region(p) >= 0
+
+    With a Potts term lambda*[l1 != l2], the smoothness energy of a labeling
+    is lambda times the length of the boundaries between differently labeled
+    regions, as on the pixel grid.
+*/
+
+#ifndef __REGIONGRAPH_H__
+#define __REGIONGRAPH_H__
+
+#include "mrf.h"
+
+class RegionGraph
+{
+public:
+    /* labels is an image of width by height in row major order */
+    RegionGraph(int width, int height, const int *labels);
+    ~RegionGraph();
+
+    int numRegions() { return m_nRegions; }
+    int numEdges() { return m_nEdges; }
+
+    /* Region of pixel pix, -1 if its label is negative */
+    int region(int pix) { return m_region[pix]; }
+
+    /* Label of the pixels of region r in the input image, and their number */
+    int regionLabel(int r) { return m_regionLabel[r]; }
+    int regionSize(int r) { return m_regionSize[r]; }
+
+    /* Edge k joins regions edgeRegion1()[k] < edgeRegion2()[k] with boundary length edgeLength()[k] */
+    int *edgeRegion1() { return m_edge1; }
+    int *edgeRegion2() { return m_edge2; }
+    MRF::CostVal *edgeLength() { return m_length; }
+
+    /* Makes adjacent regions neighbors in mrf, with weight lambda times their boundary length. */
+    /* mrf must be built on numRegions() pixels with a non-grid constructor                     */
+    void setNeighbors(MRF *mrf, MRF::CostVal lambda = 1);
+
+private:
+    int m_width, m_height;
+    int m_nRegions, m_nEdges;
+    int *m_region;
+    int *m_regionLabel, *m_regionSize;
+    int *m_edge1, *m_edge2;
+    MRF::CostVal *m_length;
+
+    void findRegions(const int *labels);
+    void findEdges();
+};
+
+#endif
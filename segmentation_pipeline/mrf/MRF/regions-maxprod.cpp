@@ -44,7 +44,7 @@ FLOATTYPE vec_max(FLOATTYPE *vec, int length)
 }
 
 void getPsiMat(OneNodeCluster &/*cluster*/, FLOATTYPE *&destMatrix, 
-	       int r, int c, MaxProdBP *mrf, int direction, FLOATTYPE &var_weight)
+	       int r, int c, MaxProdBP *mrf, int direction, FLOATTYPE &var_weight, MsgScratch *scratch)
 {
   int mrfHeight = mrf->getHeight();
   int mrfWidth = mrf->getWidth();
@@ -53,7 +53,7 @@ void getPsiMat(OneNodeCluster &/*cluster*/, FLOATTYPE *&destMatrix,
   int y=r;
   int i;
   
-  FLOATTYPE *currMatrix = mrf->getScratchMatrix();
+  FLOATTYPE *currMatrix = scratch->psiMat;
   if(mrf->getSmoothType() != MRF::FUNCTION)
   {
     if(((direction==UP) &&(r==0)) ||
@@ -168,8 +168,6 @@ void initOneNodeMsgMem(OneNodeCluster *nodeArray, FLOATTYPE *memChunk,
 {
   FLOATTYPE *currPtr = memChunk;
   OneNodeCluster *currNode = nodeArray;
-  FLOATTYPE *nextRoundChunk = new FLOATTYPE[nodeArray[1].numStates];
-  // MEMORY LEAK? where does this ever get deleted??
   for(int i = 0; i < numNodes; i++)
   {
 
@@ -178,11 +176,6 @@ void initOneNodeMsgMem(OneNodeCluster *nodeArray, FLOATTYPE *memChunk,
     currNode->receivedMsgs[2] = currPtr; currPtr+=msgChunkSize;
     currNode->receivedMsgs[3] = currPtr; currPtr+=msgChunkSize;
 
-    currNode->nextRoundReceivedMsgs[0] = nextRoundChunk;
-    currNode->nextRoundReceivedMsgs[1] = nextRoundChunk;
-    currNode->nextRoundReceivedMsgs[2] = nextRoundChunk;
-    currNode->nextRoundReceivedMsgs[3] = nextRoundChunk;
-
     currNode++;
   }
 }
@@ -222,12 +215,10 @@ inline void l1_dist_trans_comp(FLOATTYPE smoothMax, FLOATTYPE c, FLOATTYPE* tmpM
 
 
 
-inline void l2_dist_trans_comp(FLOATTYPE smoothMax, FLOATTYPE c, FLOATTYPE* tmpMsgDest, FLOATTYPE * msgProd, int numStates)
+// z (numStates+1 values) and v (numStates values) are scratch arrays
+inline void l2_dist_trans_comp(FLOATTYPE smoothMax, FLOATTYPE c, FLOATTYPE* tmpMsgDest, FLOATTYPE * msgProd, int numStates,
+			       FLOATTYPE *z, int *v)
 {
-
-
-  FLOATTYPE *z = new FLOATTYPE[numStates];
-  int       *v = new int[numStates];
   int j=0;
   FLOATTYPE INFINITY_ =std::numeric_limits<float>::infinity();
 
@@ -248,8 +239,6 @@ inline void l2_dist_trans_comp(FLOATTYPE smoothMax, FLOATTYPE c, FLOATTYPE* tmpM
     {
       tmpMsgDest[q]=-minVal;
     }
-    delete [] z;
-    delete [] v;
     return;
   }
 
@@ -287,12 +276,9 @@ inline void l2_dist_trans_comp(FLOATTYPE smoothMax, FLOATTYPE c, FLOATTYPE* tmpM
       tmpMsgDest[q] = minPotts;
     tmpMsgDest[q] = -tmpMsgDest[q];
   }
-  delete [] z;
-  delete [] v;
-
 }
 
-void OneNodeCluster::ComputeMsgRight(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf)
+void OneNodeCluster::ComputeMsgRight(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf, MsgScratch *scratch)
 {
 
 
@@ -308,7 +294,7 @@ void OneNodeCluster::ComputeMsgRight(FLOATTYPE *msgDest, int r, int c, MaxProdBP
   
   if(mrf->m_type==MaxProdBP::L1 || mrf->m_type==MaxProdBP::L2)
   {
-    FLOATTYPE *msgProd = new FLOATTYPE[numStates];
+    FLOATTYPE *msgProd = scratch->msgProd;
     const FLOATTYPE lambda = (FLOATTYPE)mrf->m_lambda;
     const FLOATTYPE smoothMax = (FLOATTYPE)mrf->m_smoothMax;
     for(int leftNodeInd = 0; leftNodeInd < numStates; leftNodeInd++)
@@ -323,15 +309,14 @@ void OneNodeCluster::ComputeMsgRight(FLOATTYPE *msgDest, int r, int c, MaxProdBP
     }
     else
     {
-      l2_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates);
+      l2_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates, scratch->z, scratch->v);
     }
-    delete [] msgProd;
   }
   else if ((mrf->getSmoothType()==MRF::FUNCTION)||(mrf->getSmoothType()==MRF::ARRAY))
   {
     FLOATTYPE *psiMat, var_weight;
   
-    getPsiMat(*this,psiMat,r,c,mrf,RIGHT, var_weight);
+    getPsiMat(*this,psiMat,r,c,mrf,RIGHT, var_weight, scratch);
     FLOATTYPE *cmessage = msgDest;    
     for(int rightNodeInd = 0; rightNodeInd < numStates; rightNodeInd++)
     {
@@ -366,7 +351,7 @@ void OneNodeCluster::ComputeMsgRight(FLOATTYPE *msgDest, int r, int c, MaxProdBP
 
 // This means, "Compute the message to send left."
 
-void OneNodeCluster::ComputeMsgLeft(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf)
+void OneNodeCluster::ComputeMsgLeft(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf, MsgScratch *scratch)
 {
 
   FLOATTYPE *nodeRightMsg = receivedMsgs[RIGHT],
@@ -381,7 +366,7 @@ void OneNodeCluster::ComputeMsgLeft(FLOATTYPE *msgDest, int r, int c, MaxProdBP
     FLOATTYPE weight_mod;
     getVarWeight(*this,r,c,mrf,LEFT, weight_mod);
     
-    FLOATTYPE *msgProd = new FLOATTYPE[numStates];
+    FLOATTYPE *msgProd = scratch->msgProd;
       
     const FLOATTYPE lambda = (FLOATTYPE)mrf->m_lambda;
 
@@ -398,15 +383,14 @@ void OneNodeCluster::ComputeMsgLeft(FLOATTYPE *msgDest, int r, int c, MaxProdBP
     {      l1_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates);
     }
     else
-      l2_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates);
+      l2_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates, scratch->z, scratch->v);
     
-    delete [] msgProd;
   }
   else if ((mrf->getSmoothType()==MRF::FUNCTION)||(mrf->getSmoothType()==MRF::ARRAY))
   {
     FLOATTYPE *psiMat, var_weight;
     
-    getPsiMat(*this,psiMat,r,c,mrf,LEFT, var_weight);
+    getPsiMat(*this,psiMat,r,c,mrf,LEFT, var_weight, scratch);
   
     FLOATTYPE *cmessage = msgDest;
     
@@ -443,7 +427,7 @@ void OneNodeCluster::ComputeMsgLeft(FLOATTYPE *msgDest, int r, int c, MaxProdBP
 
 }
 
-void OneNodeCluster::ComputeMsgUp(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf)
+void OneNodeCluster::ComputeMsgUp(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf, MsgScratch *scratch)
 {
   FLOATTYPE *nodeRightMsg = receivedMsgs[RIGHT],
     *nodeDownMsg = receivedMsgs[DOWN],
@@ -459,7 +443,7 @@ void OneNodeCluster::ComputeMsgUp(FLOATTYPE *msgDest, int r, int c, MaxProdBP *m
     getVarWeight(*this,r,c,mrf,UP,weight_mod);
     
     FLOATTYPE *tmpMsgDest = msgDest;
-    FLOATTYPE *msgProd = new FLOATTYPE[numStates];
+    FLOATTYPE *msgProd = scratch->msgProd;
     
     const FLOATTYPE lambda = (FLOATTYPE)mrf->m_lambda;
     
@@ -479,14 +463,13 @@ void OneNodeCluster::ComputeMsgUp(FLOATTYPE *msgDest, int r, int c, MaxProdBP *m
     {      l1_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates);
     }
     else
-      l2_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates);
-    delete [] msgProd;
+      l2_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates, scratch->z, scratch->v);
   }
   else if ((mrf->getSmoothType()==MRF::FUNCTION)||(mrf->getSmoothType()==MRF::ARRAY))
   {
     FLOATTYPE *psiMat, var_weight;
     
-    getPsiMat(*this,psiMat,r,c,mrf,UP, var_weight);
+    getPsiMat(*this,psiMat,r,c,mrf,UP, var_weight, scratch);
     
     FLOATTYPE *cmessage = msgDest;
     
@@ -518,7 +501,7 @@ void OneNodeCluster::ComputeMsgUp(FLOATTYPE *msgDest, int r, int c, MaxProdBP *m
     msgDest[i]  -=max;
 }
 
-void OneNodeCluster::ComputeMsgDown(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf)
+void OneNodeCluster::ComputeMsgDown(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf, MsgScratch *scratch)
 {
 
   FLOATTYPE *nodeRightMsg = receivedMsgs[RIGHT],
@@ -533,7 +516,7 @@ void OneNodeCluster::ComputeMsgDown(FLOATTYPE *msgDest, int r, int c, MaxProdBP
     getVarWeight(*this,r,c,mrf,DOWN,weight_mod);
     
     FLOATTYPE *tmpMsgDest = msgDest;
-    FLOATTYPE *msgProd = new FLOATTYPE[numStates];
+    FLOATTYPE *msgProd = scratch->msgProd;
     
     const FLOATTYPE lambda = (FLOATTYPE)mrf->m_lambda;
     
@@ -551,15 +534,14 @@ void OneNodeCluster::ComputeMsgDown(FLOATTYPE *msgDest, int r, int c, MaxProdBP
     {      l1_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates);
     }
     else
-      l2_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates);
-    delete [] msgProd;
+      l2_dist_trans_comp( weight_mod*smoothMax*lambda, lambda*weight_mod, tmpMsgDest, msgProd, numStates, scratch->z, scratch->v);
 
   }
   else if((mrf->getSmoothType()==MRF::FUNCTION)||(mrf->getSmoothType()==MRF::ARRAY))
   {
     FLOATTYPE *psiMat, var_weight;
     
-    getPsiMat(*this,psiMat,r,c,mrf,DOWN, var_weight);
+    getPsiMat(*this,psiMat,r,c,mrf,DOWN, var_weight, scratch);
     
     FLOATTYPE *cmessage = msgDest;
     
@@ -633,7 +615,7 @@ int OneNodeCluster::getBeliefMaxInd()
 }
 
 
-void computeMessagesLeftRight(OneNodeCluster *nodeArray, const int numCols, const int /*numRows*/, const int currRow, const FLOATTYPE alpha, MaxProdBP *mrf)
+void computeMessagesLeftRight(OneNodeCluster *nodeArray, const int numCols, const int /*numRows*/, const int currRow, const FLOATTYPE alpha, MaxProdBP *mrf, MsgScratch *scratch)
 {
   const int numStates = OneNodeCluster::numStates;
   const FLOATTYPE omalpha = 1.0f - alpha;
@@ -641,28 +623,28 @@ void computeMessagesLeftRight(OneNodeCluster *nodeArray, const int numCols, cons
   int col;
   for( col = 0; col < numCols-1; col++)
   {
-    nodeArray[currRow * numCols + col].ComputeMsgRight(nodeArray[currRow * numCols + col+1].nextRoundReceivedMsgs[LEFT],currRow, col, mrf);
+    nodeArray[currRow * numCols + col].ComputeMsgRight(scratch->nextMsg, currRow, col, mrf, scratch);
     for(i = 0; i < numStates; i++)
     {
       nodeArray[currRow * numCols + col+1].receivedMsgs[LEFT][i] = 
 	omalpha * nodeArray[currRow * numCols + col+1].receivedMsgs[LEFT][i] + 
-	alpha * nodeArray[currRow * numCols + col+1].nextRoundReceivedMsgs[LEFT][i];
+	alpha * scratch->nextMsg[i];
     }
   } 
   for( col = numCols-1; col > 0; col--)
   {
-    nodeArray[currRow * numCols + col].ComputeMsgLeft(nodeArray[currRow * numCols + col-1].nextRoundReceivedMsgs[RIGHT],currRow, col, mrf);
+    nodeArray[currRow * numCols + col].ComputeMsgLeft(scratch->nextMsg, currRow, col, mrf, scratch);
     for(i = 0; i < numStates; i++)
     {
       nodeArray[currRow * numCols + col-1].receivedMsgs[RIGHT][i] = 
 	omalpha * nodeArray[currRow * numCols + col-1].receivedMsgs[RIGHT][i] + 
-	alpha * nodeArray[currRow * numCols + col-1].nextRoundReceivedMsgs[RIGHT][i];
+	alpha * scratch->nextMsg[i];
     }
   } 
 
 }
 
-void computeMessagesUpDown(OneNodeCluster *nodeArray, const int numCols, const int numRows, const int currCol, const FLOATTYPE alpha, MaxProdBP *mrf)
+void computeMessagesUpDown(OneNodeCluster *nodeArray, const int numCols, const int numRows, const int currCol, const FLOATTYPE alpha, MaxProdBP *mrf, MsgScratch *scratch)
 {
   const int numStates = OneNodeCluster::numStates;
   const FLOATTYPE omalpha = 1.0f - alpha;
@@ -670,22 +652,22 @@ void computeMessagesUpDown(OneNodeCluster *nodeArray, const int numCols, const i
   int row;
   for(row = 0; row < numRows-1; row++)
   {
-    nodeArray[row * numCols + currCol].ComputeMsgDown(nodeArray[(row+1) * numCols + currCol].nextRoundReceivedMsgs[UP],row, currCol, mrf);
+    nodeArray[row * numCols + currCol].ComputeMsgDown(scratch->nextMsg, row, currCol, mrf, scratch);
     for(i = 0; i < numStates; i++)
     {
       nodeArray[(row+1) * numCols + currCol].receivedMsgs[UP][i] = 
 	omalpha * nodeArray[(row+1) * numCols + currCol].receivedMsgs[UP][i] + 
-	alpha * nodeArray[(row+1) * numCols + currCol].nextRoundReceivedMsgs[UP][i];
+	alpha * scratch->nextMsg[i];
     }
   } 
   for( row = numRows-1; row > 0; row--)
   {
-    nodeArray[row * numCols + currCol].ComputeMsgUp(nodeArray[(row-1) * numCols + currCol].nextRoundReceivedMsgs[DOWN], row, currCol, mrf);
+    nodeArray[row * numCols + currCol].ComputeMsgUp(scratch->nextMsg, row, currCol, mrf, scratch);
     for(i = 0; i < numStates; i++)
     {
       nodeArray[(row-1) * numCols + currCol].receivedMsgs[DOWN][i] = 
 	omalpha * nodeArray[(row-1) * numCols + currCol].receivedMsgs[DOWN][i] + 
-	alpha * nodeArray[(row-1) * numCols + currCol].nextRoundReceivedMsgs[DOWN][i];
+	alpha * scratch->nextMsg[i];
     }
   } 
 
@@ -11,6 +11,20 @@
 #include "MaxProdBP.h"
 
 class MaxProdBP;
+
+// Scratch memory of one thread computing messages, so that computing a message
+// allocates nothing: the product of the incoming messages, the new message before
+// it is blended into the old one, the lower envelope of the L2 distance transform
+// and the smoothness matrix of an edge
+struct MsgScratch
+{
+  FLOATTYPE *msgProd,   // numStates
+            *nextMsg,   // numStates
+            *z,         // numStates+1
+            *psiMat;    // numStates*numStates
+  int       *v;         // numStates
+};
+
 class OneNodeCluster
 {
 public:
@@ -20,17 +34,16 @@ public:
   static int numStates;
   
   FLOATTYPE   *receivedMsgs[4],
-              *nextRoundReceivedMsgs[4],
               *localEv;
 
 
 //   FLOATTYPE *psi[4];
-  void ComputeMsgRight(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf);
-  void ComputeMsgUp(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf);
+  void ComputeMsgRight(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf, MsgScratch *scratch);
+  void ComputeMsgUp(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf, MsgScratch *scratch);
 
-  void ComputeMsgLeft(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf);
+  void ComputeMsgLeft(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf, MsgScratch *scratch);
 
-  void ComputeMsgDown(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf);
+  void ComputeMsgDown(FLOATTYPE *msgDest, int r, int c, MaxProdBP *mrf, MsgScratch *scratch);
 
   void getBelief(FLOATTYPE *beliefVec);
   int getBeliefMaxInd();
@@ -45,9 +58,9 @@ void initOneNodeMsgMem(OneNodeCluster *nodeArray, FLOATTYPE *memChunk, const int
                        const int msgChunkSize);
 
 void computeMessagesUpDown(OneNodeCluster *nodeArray, const int numCols, const int numRows,
-                           const int currCol, const FLOATTYPE alpha, MaxProdBP *mrf);
+                           const int currCol, const FLOATTYPE alpha, MaxProdBP *mrf, MsgScratch *scratch);
 void computeMessagesLeftRight(OneNodeCluster *nodeArray, const int numCols, const int numRows,
-                              const int currRow, const FLOATTYPE alpha, MaxProdBP *mrf);
+                              const int currRow, const FLOATTYPE alpha, MaxProdBP *mrf, MsgScratch *scratch);
 
 void computeOneNodeMessagesPeriodic(OneNodeCluster *nodeTopArray, OneNodeCluster *nodeBotArray,
                                     const int numCols, const FLOATTYPE alpha);
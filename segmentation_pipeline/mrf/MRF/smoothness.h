@@ -0,0 +1,81 @@
+/* smoothness.h */
+/*
+    Smoothness models of the graph cut algorithms as function objects.
+
+    Each model has an operator()(pix, nPix, label1, label2, weight) that
+    returns the smoothness cost of neighbors pix and nPix having labels
+    label1 and label2, like GCoptimization::pair_cost(). The loops that
+    build the graphs of moves are templates on the model, so the cost is
+    inlined instead of going through the runtime switch of pair_cost()
+    and, for FunctionSmoothness, a call through a function pointer.
+
+    GCoptimization picks the model in initialize() (see initializeAlg()):
+    a smoothness array with zero costs on the diagonal and one cost off it
+    is Potts, setSmoothness(smoothExp,smoothMax,lambda) is truncated
+    linear or quadratic, any other array is ArraySmoothness and a function
+    is FunctionSmoothness. All of them give the same costs as pair_cost().
+
+    CostType is the type of the individual terms, GCoptimization::EnergyTermType.
+*/
+
+#ifndef __SMOOTHNESS_H__
+#define __SMOOTHNESS_H__
+
+/* V(l1,l2) = lambda if l1 != l2, 0 otherwise */
+template <class CostType> struct PottsSmoothness
+{
+    CostType lambda;
+
+    PottsSmoothness(CostType l) : lambda(l) {}
+    CostType operator()(int, int, int l1, int l2, CostType weight) const
+        { return (l1 != l2) ? lambda*weight : 0; }
+};
+
+/* V(l1,l2) = lambda*min(|l1-l2|, smoothMax) */
+template <class CostType> struct TruncatedLinearSmoothness
+{
+    CostType lambda, smoothMax;
+
+    TruncatedLinearSmoothness(CostType l, CostType m) : lambda(l), smoothMax(m) {}
+    CostType operator()(int, int, int l1, int l2, CostType weight) const
+    {
+        CostType d = (CostType) ((l1 > l2) ? l1 - l2 : l2 - l1);
+        return ((d < smoothMax) ? d : smoothMax)*lambda*weight;
+    }
+};
+
+/* V(l1,l2) = lambda*min((l1-l2)^2, smoothMax) */
+template <class CostType> struct TruncatedQuadraticSmoothness
+{
+    CostType lambda, smoothMax;
+
+    TruncatedQuadraticSmoothness(CostType l, CostType m) : lambda(l), smoothMax(m) {}
+    CostType operator()(int, int, int l1, int l2, CostType weight) const
+    {
+        CostType d = (CostType) ((l1-l2)*(l1-l2));
+        return ((d < smoothMax) ? d : smoothMax)*lambda*weight;
+    }
+};
+
+/* V(l1,l2) = V[l1+l2*nLabels] */
+template <class CostType> struct ArraySmoothness
+{
+    const CostType *V;
+    int nLabels;
+
+    ArraySmoothness(const CostType *v, int n) : V(v), nLabels(n) {}
+    CostType operator()(int, int, int l1, int l2, CostType weight) const
+        { return V[l1+l2*nLabels]*weight; }
+};
+
+/* V(pix,nPix,l1,l2) = fn(pix,nPix,l1,l2), without weights. fn may return another type than CostType */
+template <class CostType, class Fn = CostType (*)(int, int, int, int)> struct FunctionSmoothness
+{
+    Fn fn;
+
+    FunctionSmoothness(Fn f) : fn(f) {}
+    CostType operator()(int pix, int nPix, int l1, int l2, CostType) const
+        { return fn(pix,nPix,l1,l2); }
+};
+
+#endif
@@ -0,0 +1,346 @@
+/* vecops.h */
+/*
+    Operations on the messages of BP-S and TRW-S: arrays of K labels of
+    type int, float or double (BPS::REAL and TRWS::REAL). The costs they
+    read are MRF::CostVal, int unless compiled with -DMRF_64BIT_COST.
+
+    When BP-S and TRW-S are compiled with AVX2 (make ARCH=-mavx2 or
+    ARCH=-march=native, which define __AVX2__), each function processes 8 ints
+    or floats, or 4 doubles, per instruction and finishes the last K % 8
+    (or K % 4) labels with the plain loop. Without AVX2 the plain loop does
+    all the work, so the results are the same either way (for float and
+    double up to the order in which sums are rounded). Without AVX2 the
+    truncated linear updates of BP-S and TRW-S (UpdateMessageL1) do not
+    call VecDiffMin and VecDistanceL1 but keep their original loop, which
+    takes the difference, its minimum and the forward scan in one pass.
+
+    VecDistanceL1 is the distance transform of the truncated linear model,
+    M[k] := min_j M[j] + lambda*|k-j|, as a forward and a backward min-plus
+    scan, fused with the normalization and truncation of the message.
+    Inside a vector the scan takes log2(8) (or log2(4)) steps, each
+    comparing every lane with the lane s = 1, 2, 4 below it plus s*lambda,
+    and the last label of the previous vector is then carried into all
+    lanes at once.
+*/
+
+#ifndef __VECOPS_H__
+#define __VECOPS_H__
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+/* Any other type, such as the 64-bit messages of BP-S with -DMRF_64BIT_COST */
+/* (AVX2 has no 64-bit min or multiply), is one lane: the plain loops        */
+template <class T> struct VecTraits
+{
+    typedef T V;
+    enum { W = 1 };
+    static V load(const T* p) { return *p; }
+    static void store(T* p, V v) { *p = v; }
+    static V loadInt(const int* p) { return (T) *p; }
+    static V set1(T a) { return a; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V min(V a, V b) { return (a < b) ? a : b; }
+    static T hmin(V v) { return v; }
+    static V up(V v, int) { return v; }
+    static V down(V v, int) { return v; }
+};
+
+template <> struct VecTraits<int>
+{
+    typedef __m256i V;
+    enum { W = 8 };
+    static V load(const int* p) { return _mm256_loadu_si256((const __m256i*) p); }
+    static void store(int* p, V v) { _mm256_storeu_si256((__m256i*) p, v); }
+    static V loadInt(const int* p) { return load(p); }
+    static V set1(int a) { return _mm256_set1_epi32(a); }
+    static V add(V a, V b) { return _mm256_add_epi32(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_epi32(a, b); }
+    static V mul(V a, V b) { return _mm256_mullo_epi32(a, b); }
+    static V min(V a, V b) { return _mm256_min_epi32(a, b); }
+    static int hmin(V v)
+    {
+        __m128i m = _mm_min_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1,0,3,2)));
+        m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2,3,0,1)));
+        return _mm_cvtsi128_si32(m);
+    }
+    /* lane i gets lane i-s (lane i+s for down), lanes without one keep their own */
+    static V up(V v, int s)
+    {
+        if (s == 1) return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0,0,1,2,3,4,5,6));
+        if (s == 2) return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0,1,0,1,2,3,4,5));
+        return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0,1,2,3,0,1,2,3));
+    }
+    static V down(V v, int s)
+    {
+        if (s == 1) return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(1,2,3,4,5,6,7,7));
+        if (s == 2) return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(2,3,4,5,6,7,6,7));
+        return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(4,5,6,7,4,5,6,7));
+    }
+};
+
+template <> struct VecTraits<float>
+{
+    typedef __m256 V;
+    enum { W = 8 };
+    static V load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+    static V loadInt(const int* p) { return _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*) p)); }
+    static V set1(float a) { return _mm256_set1_ps(a); }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V min(V a, V b) { return _mm256_min_ps(a, b); }
+    static float hmin(V v)
+    {
+        __m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1,0,3,2)));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2,3,0,1)));
+        return _mm_cvtss_f32(m);
+    }
+    static V up(V v, int s)
+    {
+        if (s == 1) return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(0,0,1,2,3,4,5,6));
+        if (s == 2) return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(0,1,0,1,2,3,4,5));
+        return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(0,1,2,3,0,1,2,3));
+    }
+    static V down(V v, int s)
+    {
+        if (s == 1) return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(1,2,3,4,5,6,7,7));
+        if (s == 2) return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(2,3,4,5,6,7,6,7));
+        return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(4,5,6,7,4,5,6,7));
+    }
+};
+
+template <> struct VecTraits<double>
+{
+    typedef __m256d V;
+    enum { W = 4 };
+    static V load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+    static V loadInt(const int* p) { return _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*) p)); }
+    static V set1(double a) { return _mm256_set1_pd(a); }
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V min(V a, V b) { return _mm256_min_pd(a, b); }
+    static double hmin(V v)
+    {
+        __m128d m = _mm_min_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        m = _mm_min_pd(m, _mm_unpackhi_pd(m, m));
+        return _mm_cvtsd_f64(m);
+    }
+    static V up(V v, int s)
+    {
+        if (s == 1) return _mm256_permute4x64_pd(v, _MM_SHUFFLE(2,1,0,0));
+        return _mm256_permute4x64_pd(v, _MM_SHUFFLE(1,0,1,0));
+    }
+    static V down(V v, int s)
+    {
+        if (s == 1) return _mm256_permute4x64_pd(v, _MM_SHUFFLE(3,3,2,1));
+        return _mm256_permute4x64_pd(v, _MM_SHUFFLE(3,2,3,2));
+    }
+};
+#endif
+
+/**************************************************************************************/
+
+/* to[k] := from[k] */
+template <class T> inline void VecCopy(T* to, const int* from, int K)
+{
+    int k = 0;
+#ifdef __AVX2__
+    typedef VecTraits<T> S;
+    for ( ; k+S::W<=K; k+=S::W) S::store(to+k, S::loadInt(from+k));
+#endif
+    for ( ; k<K; k++) to[k] = (T) from[k];
+}
+
+/* Same, for the 64-bit costs of -DMRF_64BIT_COST (AVX2 has no conversion from 64-bit ints) */
+template <class T> inline void VecCopy(T* to, const long long* from, int K)
+{
+    for (int k=0; k<K; k++) to[k] = (T) from[k];
+}
+
+/* to[k] += from[k] */
+template <class T> inline void VecAdd(T* to, const T* from, int K)
+{
+    int k = 0;
+#ifdef __AVX2__
+    typedef VecTraits<T> S;
+    for ( ; k+S::W<=K; k+=S::W) S::store(to+k, S::add(S::load(to+k), S::load(from+k)));
+#endif
+    for ( ; k<K; k++) to[k] += from[k];
+}
+
+/* min_k D[k] */
+template <class T> inline T VecMin(const T* D, int K)
+{
+    int k = 1;
+    T delta = D[0];
+#ifdef __AVX2__
+    typedef VecTraits<T> S;
+    if (K >= S::W)
+    {
+        typename S::V m = S::load(D);
+        for (k=S::W; k+S::W<=K; k+=S::W) m = S::min(m, S::load(D+k));
+        delta = S::hmin(m);
+    }
+#endif
+    for ( ; k<K; k++) if (delta > D[k]) delta = D[k];
+    return delta;
+}
+
+/* D[k] := min(D[k] - delta, cap) */
+template <class T> inline void VecSubtractTruncate(T* D, T delta, T cap, int K)
+{
+    int k = 0;
+#ifdef __AVX2__
+    typedef VecTraits<T> S;
+    typename S::V d = S::set1(delta), c = S::set1(cap);
+    for ( ; k+S::W<=K; k+=S::W) S::store(D+k, S::min(S::sub(S::load(D+k), d), c));
+#endif
+    for ( ; k<K; k++) { D[k] -= delta; if (D[k] > cap) D[k] = cap; }
+}
+
+/* D[k] := D[k] - delta */
+template <class T> inline void VecSubtract(T* D, T delta, int K)
+{
+    int k = 0;
+#ifdef __AVX2__
+    typedef VecTraits<T> S;
+    typename S::V d = S::set1(delta);
+    for ( ; k+S::W<=K; k+=S::W) S::store(D+k, S::sub(S::load(D+k), d));
+#endif
+    for ( ; k<K; k++) D[k] -= delta;
+}
+
+/* to[k] := gamma*Di_hat[k] - M[k], returns min_k to[k]; to may be M */
+template <class T> inline T VecDiffMin(T* to, const T* Di_hat, const T* M, T gamma, int K)
+{
+    int k = 0;
+    T delta;
+#ifdef __AVX2__
+    typedef VecTraits<T> S;
+    if (K >= S::W)
+    {
+        typename S::V g = S::set1(gamma), v, m;
+        m = S::sub(S::mul(g, S::load(Di_hat)), S::load(M));
+        S::store(to, m);
+        for (k=S::W; k+S::W<=K; k+=S::W)
+        {
+            v = S::sub(S::mul(g, S::load(Di_hat+k)), S::load(M+k));
+            S::store(to+k, v);
+            m = S::min(m, v);
+        }
+        delta = S::hmin(m);
+    }
+    else
+#endif
+    {
+        delta = to[0] = gamma*Di_hat[0] - M[0];
+        k = 1;
+    }
+    for ( ; k<K; k++)
+    {
+        to[k] = gamma*Di_hat[k] - M[k];
+        if (delta > to[k]) delta = to[k];
+    }
+    return delta;
+}
+
+/* min_k D[k] + lambda*V[k] */
+template <class T> inline T VecMinSum(const T* D, const int* V, T lambda, int K)
+{
+    int k = 1;
+    T m = D[0] + lambda*V[0], t;
+#ifdef __AVX2__
+    typedef VecTraits<T> S;
+    if (K >= S::W)
+    {
+        typename S::V l = S::set1(lambda);
+        typename S::V v = S::add(S::load(D), S::mul(l, S::loadInt(V)));
+        for (k=S::W; k+S::W<=K; k+=S::W) v = S::min(v, S::add(S::load(D+k), S::mul(l, S::loadInt(V+k))));
+        m = S::hmin(v);
+    }
+#endif
+    for ( ; k<K; k++) { t = D[k] + lambda*V[k]; if (m > t) m = t; }
+    return m;
+}
+
+/* Same, for 64-bit costs */
+template <class T> inline T VecMinSum(const T* D, const long long* V, T lambda, int K)
+{
+    T m = D[0] + lambda*(T)V[0], t;
+    for (int k=1; k<K; k++) { t = D[k] + lambda*(T)V[k]; if (m > t) m = t; }
+    return m;
+}
+
+/* M[k] := min(min_j M[j] + lambda*|k-j| - delta, cap). The plain loop is  */
+/* the original two passes of BP-S and TRW-S; the vectors need lambda >= 0 */
+template <class T> inline void VecDistanceL1(T* M, T lambda, T delta, T cap, int K)
+{
+    int k = 0, kb = 0;
+    T t;
+#ifdef __AVX2__
+    typedef VecTraits<T> S;
+    // lane i of step s going up is s*[i >= s], going down s*[i+s < W];
+    // the ramps are (i+1) and (W-i). Vectors of 4 take the first 4 of
+    // the up tables and the last 4 of the down tables
+    static const int upTable[4][8]   = { {0,1,1,1,1,1,1,1}, {0,0,2,2,2,2,2,2}, {0,0,0,0,4,4,4,4}, {1,2,3,4,5,6,7,8} };
+    static const int downTable[4][8] = { {1,1,1,1,1,1,1,0}, {2,2,2,2,2,2,0,0}, {4,4,4,4,0,0,0,0}, {8,7,6,5,4,3,2,1} };
+    typename S::V l = S::set1(lambda), d = S::set1(delta), c = S::set1(cap), v, step[3];
+    int j, s;
+
+    if (lambda >= 0 && K >= S::W)
+    {
+        // forward pass over whole vectors
+        for (j=0, s=1; s<S::W; j++, s*=2) step[j] = S::mul(l, S::loadInt(upTable[j]));
+        typename S::V ramp = S::mul(l, S::loadInt(upTable[3]));
+        for ( ; k+S::W<=K; k+=S::W)
+        {
+            v = S::load(M+k);
+            for (j=0, s=1; s<S::W; j++, s*=2) v = S::min(v, S::add(S::up(v, s), step[j]));
+            if (k > 0) v = S::min(v, S::add(S::set1(M[k-1]), ramp));
+            S::store(M+k, v);
+        }
+        kb = k;
+    }
+#endif
+    // forward pass over the rest
+    for (k = (k > 0) ? k : 1; k<K; k++)
+    {
+        t = M[k-1] + lambda;
+        if (M[k] > t) M[k] = t;
+    }
+
+    // backward pass over the rest
+    for (k=K-1; k>=kb; k--)
+    {
+        M[k] -= delta;
+        if (k < K-1 && M[k] > M[k+1] + lambda) M[k] = M[k+1] + lambda;
+        if (M[k] > cap) M[k] = cap;
+    }
+#ifdef __AVX2__
+    // backward pass over whole vectors; M[k+W] is already final, and
+    // carrying it instead of the untruncated value is the same for lambda >= 0
+    if (kb > 0)
+    {
+        for (j=0, s=1; s<S::W; j++, s*=2) step[j] = S::mul(l, S::loadInt(downTable[j]+8-S::W));
+        typename S::V ramp = S::mul(l, S::loadInt(downTable[3]+8-S::W));
+        for (k=kb-S::W; k>=0; k-=S::W)
+        {
+            v = S::load(M+k);
+            for (j=0, s=1; s<S::W; j++, s*=2) v = S::min(v, S::add(S::down(v, s), step[j]));
+            v = S::sub(v, d);
+            if (k+S::W < K) v = S::min(v, S::add(S::set1(M[k+S::W]), ramp));
+            S::store(M+k, S::min(v, c));
+        }
+    }
+#endif
+}
+
+#endif
@@ -1,17 +1,43 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include "opencv2/highgui.hpp"
 #include "opencv2/imgproc.hpp"
 
 #include "MRF/mrf.h"
 #include "MRF/GCoptimization.h"
+#include "MRF/TiledExpansion.h"
+#include "parallel.h"
 
 #define LABEL_COST 20
 #define EDGE_COST 50
- 
+
+// edges lose cost with the wall evidence of their pixels, down to
+// WALL_EDGE_COST across a wall, so smoothing keeps thin walls and doorways.
+// Density counts fully as a wall from WALL_DENSITY (out of 255, 0.25 of the
+// densest pixel like the wall threshold of image)
+#define WALL_EDGE_COST 5
+#define WALL_DENSITY 64
+
+// expansion stops once an iteration lowers the energy by less than this
+// fraction, or after MAX_ITERATIONS or MAX_SECONDS (rounds of tiles for
+// tiled floors, whose windows share the MAX_SECONDS)
+#define MAX_ITERATIONS 20
+#define RELATIVE_DECREASE 1e-4
+#define MAX_SECONDS 60
+
+// floors of more than TILED_PIXELS pixels are solved in tiles of TILE_SIZE
+// pixels with TILE_HALO pixels of context, in parallel and with the graph
+// of one tile per thread (the costs and cues of the whole floor are still
+// built), for up to MAX_ITERATIONS rounds over the tiles
+#define TILED_PIXELS (4096L * 4096L)
+#define TILE_SIZE 1024
+#define TILE_HALO 32
+
 int main(int argc, char** argv) {
   using namespace cv;
 
@@ -30,47 +56,130 @@ int main(int argc, char** argv) {
 
 
   int numLabels = 2;
-  int rows = rot_freespace.cols, cols = rot_freespace.cols;
-  MRF::CostVal D[rows*cols*numLabels];
-  MRF::CostVal V[numLabels * numLabels];
-  MRF::CostVal* ptr;
-
-  for(int j=0; j<cols; ++j) {
-    for(int i=0; i<rows; ++i) {
-      int pix = i*cols + j;
+  int rows = rot_freespace.rows, cols = rot_freespace.cols;
+
+  // wall evidence of every pixel, 255 on walls and rising with the density
+  // up to WALL_DENSITY; images that are missing count as no evidence
+  Mat walls = imread(name + "walls_rotated.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Mat density = imread(name + "density_rotated.png", CV_LOAD_IMAGE_GRAYSCALE);
+  bool haveWalls = walls.rows == rows && walls.cols == cols;
+  bool haveDensity = density.rows == rows && density.cols == cols;
+  if (!haveWalls && !haveDensity) {
+    printf("No walls or density image, edges cost %d everywhere\n", EDGE_COST);
+  }
+  Mat evidence = Mat::zeros(rows, cols, CV_8U);
+
+  // each edge takes the larger evidence of its two pixels, and its weight
+  // falls linearly from EDGE_COST to WALL_EDGE_COST. Rows are split across
+  // the pool, and the loops over a row have no branches so they vectorize
+  // (n is a local copy of cols, which the uchar stores could alias)
+  std::vector<MRF::CostVal> hCue((size_t) rows * cols), vCue((size_t) rows * cols);
+  parallel_for(0, rows, 0, [&](long first, long last) {
+    const int n = cols;
+    for(int i=first; i<last; ++i) {
+      uchar* e = evidence.ptr<uchar>(i);
+      if (haveWalls) {
+	const uchar* w = walls.ptr<uchar>(i);
+	for(int j=0; j<n; ++j) {
+	  e[j] = w[j] > 0 ? 255 : 0;
+	}
+      }
+      if (haveDensity) {
+	const uchar* d = density.ptr<uchar>(i);
+	for(int j=0; j<n; ++j) {
+	  e[j] = std::max((int) e[j], std::min(255, d[j] * 255 / WALL_DENSITY));
+	}
+      }
+    }
+  });
+  parallel_for(0, rows, 0, [&](long first, long last) {
+    const int n = cols;
+    for(int i=first; i<last; ++i) {
+      const uchar* e = evidence.ptr<uchar>(i);
+      const uchar* below = evidence.ptr<uchar>(i < rows-1 ? i+1 : i);
+      MRF::CostVal* h = &hCue[(size_t) i * n];
+      MRF::CostVal* v = &vCue[(size_t) i * n];
+      for(int j=0; j<n-1; ++j) {
+	h[j] = (MRF::CostVal) (EDGE_COST - std::max(e[j], e[j+1]) * (EDGE_COST - WALL_EDGE_COST) / 255);
+      }
+      h[n-1] = EDGE_COST;
+      for(int j=0; j<n; ++j) {
+	v[j] = (MRF::CostVal) (EDGE_COST - std::max(e[j], below[j]) * (EDGE_COST - WALL_EDGE_COST) / 255);
+      }
+    }
+  });
+
+  // data costs live on the heap and are filled in one pass in the same
+  // row-major order as the image and the MRF's pixel indices
+  std::vector<MRF::CostVal> D((size_t) rows * cols * numLabels);
+  MRF::CostVal* ptr = &D[0];
+  for(int i=0; i<rows; ++i) {
+    const uchar* label = rot_freespace.ptr<uchar>(i);
+    for(int j=0; j<cols; ++j) {
       for(int l=0; l<numLabels; ++l) {
-	D[pix*numLabels + l] = (MRF::CostVal) (l == rot_freespace.at<uchar>(i, j) ? 0 : LABEL_COST);
+	*ptr++ = (MRF::CostVal) (l == label[j] ? 0 : LABEL_COST);
       }
     }
   }
 
+  // the cost of an edge is all in its weight
+  std::vector<MRF::CostVal> V(numLabels * numLabels);
   for(int i=0; i<numLabels; ++i) {
     for(int j=i; j<numLabels; ++j) {
-      V[i*numLabels+j] = V[j*numLabels+i] = (i == j) ? 0 : (MRF::CostVal) EDGE_COST; 
+      V[i*numLabels+j] = V[j*numLabels+i] = (i == j) ? 0 : 1;
     }
   }
 
-  DataCost *data = new DataCost(D);
-  SmoothnessCost *smooth = new SmoothnessCost(V);
+  DataCost *data = new DataCost(&D[0]);
+  SmoothnessCost *smooth = new SmoothnessCost(&V[0], &hCue[0], &vCue[0]);
   EnergyFunction *energy = new EnergyFunction(data, smooth);
 
-  MRF* mrf = new Expansion(rows, cols, numLabels, energy);
+  // two labels with a Potts penalty is submodular, so a single cut is exact;
+  // expansion stays for multi-label energies. Large floors are tiled
+  MRF* mrf;
+  GCoptimization* gc = NULL;
+  TiledExpansion* tiled = NULL;
+  if ((long) rows * cols > TILED_PIXELS) {
+    tiled = new TiledExpansion(cols, rows, numLabels, energy);
+    tiled->setTiles(TILE_SIZE, TILE_HALO);
+    tiled->setConvergence(RELATIVE_DECREASE, MAX_SECONDS);
+    mrf = tiled;
+  } else {
+    if (numLabels == 2) {
+      gc = new BinaryCut(cols, rows, numLabels, energy);
+    } else {
+      Expansion* expansion = new Expansion(cols, rows, numLabels, energy);
+      expansion->setParallel(true);
+      gc = expansion;
+    }
+    gc->setConvergence(RELATIVE_DECREASE, MAX_SECONDS);
+    gc->setActiveLabels(true);
+    mrf = gc;
+  }
   mrf->initialize();
   mrf->clearAnswer();
 
-  printf("Energy at the Start= %g (%g,%g)\n", (float)mrf->totalEnergy(),
-	 (float)mrf->smoothnessEnergy(), (float)mrf->dataEnergy());
+  printf("Energy at the Start= %.0f (%.0f,%.0f)\n", (double)mrf->totalEnergy(),
+	 (double)mrf->smoothnessEnergy(), (double)mrf->dataEnergy());
 
-  float tot_t = 0, t;
-  for (int iter=0; iter<6; iter++) {
-    mrf->optimize(1, t);
-    
-    tot_t = tot_t + t ;
-    printf("energy = %g (%f secs)\n", (float)mrf->totalEnergy(), tot_t);
+  float t;
+  mrf->optimize(MAX_ITERATIONS, t);
+  bool converged = tiled ? tiled->converged() : gc->converged();
+  printf("energy = %.0f (%d %s, %f secs%s)\n", (double)mrf->totalEnergy(),
+	 mrf->getStats().iterations, tiled ? "rounds" : "iterations", t, converged ? "" : ", not converged");
+  if (tiled) {
+    printf("%ld halo pixels disagree with their tiles\n", tiled->seamDisagreements());
   }
-  
+
+  // timings and counters of the solve, for comparing runs
+  FILE *stats = fopen((name + "mrf_stats.json").c_str(), "w");
+  if (stats) {
+    mrf->printStats(stats);
+    fclose(stats);
+  }
+
   FILE *fp = fopen((name + "freespace_mrf.ppm").c_str(), "wb");
-  fprintf(fp, "P6\n%d %d\n255\n", rows, cols);
+  fprintf(fp, "P6\n%d %d\n255\n", cols, rows);
   for(int pix=0; pix<rows*cols; ++pix) {
     static unsigned char color[3];
     color[0] = mrf->getLabel(pix) == 1 ? 255 : 0;
@@ -0,0 +1,369 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Work-stealing thread pool shared by the pipeline stages. Header only; a
+// stage adds this directory to its include path and links with -pthread.
+//
+// There is one pool per process, started on first use with
+// parallel_threads() threads in total (the calling thread counts as one).
+// Set the count with parallel_init() before the first parallel call or
+// with the PARALLEL_THREADS environment variable.
+//
+//   parallel_for(begin, end, grain, body)  calls body(b, e) on disjoint
+//     subranges of [begin, end) no longer than grain
+//   parallel_reduce(begin, end, grain, identity, body, combine)  combines
+//     body(b, e) of consecutive grain-sized chunks in order, so the result
+//     does not depend on the schedule
+//   parallel_invoke(f, g)  runs f() and g() concurrently
+//
+// A grain of 0 or less picks one giving about 8 tasks per thread. Ranges
+// are split in half recursively; the halves go on the running thread's
+// deque where idle threads steal them, so nested calls are fine.
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define PARALLEL_DEQUE_SIZE 1024 // tasks per deque; a full deque runs tasks inline
+#define PARALLEL_EXTERNAL_SLOTS 16 // deques for threads outside the pool
+#define PARALLEL_SPIN 256 // failed steal rounds before a worker sleeps
+
+struct ParallelJob {
+  void (*fn)(void *, long, long);
+  void *ctx;
+  long grain;
+  std::atomic<long> pending; // unfinished tasks
+};
+
+struct ParallelTask {
+  ParallelJob *job;
+  long begin, end;
+};
+
+// Chase-Lev deque with a fixed ring. The owner pushes and pops at the
+// bottom, thieves take from the top. Slots are atomics so a thief can read
+// one racing with a push; the CAS on top decides who owns it. Pushing into
+// a full ring fails instead of growing, so a slot is never overwritten
+// while it can still be stolen.
+class ParallelDeque {
+ public:
+  ParallelDeque() : top(0), bottom(0) {}
+
+  bool push(const ParallelTask &task) {
+    long b = bottom.load(std::memory_order_relaxed);
+    long t = top.load(std::memory_order_acquire);
+    if (b - t >= PARALLEL_DEQUE_SIZE) {
+      return false;
+    }
+    Slot &s = slots[b % PARALLEL_DEQUE_SIZE];
+    s.job.store(task.job, std::memory_order_relaxed);
+    s.begin.store(task.begin, std::memory_order_relaxed);
+    s.end.store(task.end, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(ParallelTask &task) {
+    long b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    read(b, task);
+    if (t == b) {
+      // last task, race the thieves for it
+      bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  bool steal(ParallelTask &task) {
+    long t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    read(t, task);
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  bool empty() {
+    return top.load(std::memory_order_relaxed) >= bottom.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slot {
+    std::atomic<ParallelJob *> job;
+    std::atomic<long> begin, end;
+  };
+
+  std::atomic<long> top, bottom;
+  Slot slots[PARALLEL_DEQUE_SIZE];
+
+  void read(long i, ParallelTask &task) {
+    Slot &s = slots[i % PARALLEL_DEQUE_SIZE];
+    task.job = s.job.load(std::memory_order_relaxed);
+    task.begin = s.begin.load(std::memory_order_relaxed);
+    task.end = s.end.load(std::memory_order_relaxed);
+  }
+};
+
+class ParallelPool {
+ public:
+  static ParallelPool &instance() {
+    static ParallelPool pool(requestedThreads());
+    return pool;
+  }
+
+  static int &requestedThreads() {
+    static int threads = defaultThreads();
+    return threads;
+  }
+
+  int threads() { return numWorkers + 1; }
+
+  // run [begin, end) through fn(ctx, b, e) and return once every piece is done
+  void run(void (*fn)(void *, long, long), void *ctx, long begin, long end, long grain) {
+    if (end <= begin) {
+      return;
+    }
+    ParallelDeque *own = localDeque();
+    if (numWorkers == 0 || own == NULL) {
+      fn(ctx, begin, end);
+      return;
+    }
+
+    ParallelJob job;
+    job.fn = fn;
+    job.ctx = ctx;
+    job.grain = grain > 0 ? grain : std::max(1L, (end - begin) / (8 * threads()));
+    job.pending.store(1, std::memory_order_relaxed);
+
+    ParallelTask root = { &job, begin, end };
+    execute(own, root);
+
+    // help with whatever is queued until the job's last piece finishes
+    ParallelTask task;
+    while (job.pending.load(std::memory_order_acquire) > 0) {
+      if (own->pop(task) || stealAny(task)) {
+	execute(own, task);
+      } else {
+	std::this_thread::yield();
+      }
+    }
+  }
+
+ private:
+  int numWorkers;
+  std::vector<ParallelDeque *> deques; // workers first, then external slots
+  std::vector<std::thread> workers;
+  std::atomic<int> nextExternal;
+  std::atomic<bool> stopping;
+
+  // sleeping workers wait for the epoch to move; pushes bump it
+  std::mutex sleepMutex;
+  std::condition_variable sleepCond;
+  std::atomic<long> epoch;
+  std::atomic<int> sleepers;
+
+  explicit ParallelPool(int threads) : nextExternal(0), stopping(false), epoch(0), sleepers(0) {
+    numWorkers = std::max(0, threads - 1);
+    for(int i=0; i<numWorkers + PARALLEL_EXTERNAL_SLOTS; ++i) {
+      deques.push_back(new ParallelDeque());
+    }
+    for(int i=0; i<numWorkers; ++i) {
+      workers.push_back(std::thread(&ParallelPool::workerLoop, this, i));
+    }
+  }
+
+  ~ParallelPool() {
+    stopping.store(true);
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      epoch++;
+    }
+    sleepCond.notify_all();
+    for(unsigned int i=0; i<workers.size(); ++i) {
+      workers[i].join();
+    }
+    for(unsigned int i=0; i<deques.size(); ++i) {
+      delete deques[i];
+    }
+  }
+
+  static int defaultThreads() {
+    const char *env = getenv("PARALLEL_THREADS");
+    if (env != NULL && atoi(env) > 0) {
+      return atoi(env);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // deque index of the current thread, -1 before first use, -2 for none
+  static int &threadSlot() {
+    static thread_local int slot = -1;
+    return slot;
+  }
+
+  // workers own a deque from the start; other threads claim one on first
+  // use, and run their loops serially once the external slots run out
+  ParallelDeque *localDeque() {
+    int &slot = threadSlot();
+    if (slot == -1) {
+      int external = nextExternal++;
+      slot = external < PARALLEL_EXTERNAL_SLOTS ? numWorkers + external : -2;
+    }
+    return slot >= 0 ? deques[slot] : NULL;
+  }
+
+  void execute(ParallelDeque *own, ParallelTask task) {
+    ParallelJob *job = task.job;
+    // keep the first half, offer the second half to thieves
+    while (task.end - task.begin > job->grain) {
+      long mid = task.begin + (task.end - task.begin) / 2;
+      ParallelTask half = { job, mid, task.end };
+      job->pending.fetch_add(1, std::memory_order_relaxed);
+      if (!own->push(half)) {
+	job->pending.fetch_sub(1, std::memory_order_relaxed);
+	break;
+      }
+      wake();
+      task.end = mid;
+    }
+    job->fn(job->ctx, task.begin, task.end);
+    job->pending.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  void wake() {
+    epoch.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_seq_cst) > 0) {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      sleepCond.notify_one();
+    }
+  }
+
+  bool stealAny(ParallelTask &task) {
+    int n = deques.size();
+    int start = rand_r(&stealSeed()) % n;
+    for(int i=0; i<n; ++i) {
+      if (deques[(start + i) % n]->steal(task)) {
+	return true;
+      }
+    }
+    return false;
+  }
+
+  static unsigned int &stealSeed() {
+    static thread_local unsigned int seed = std::hash<std::thread::id>()(std::this_thread::get_id());
+    return seed;
+  }
+
+  void workerLoop(int index) {
+    threadSlot() = index;
+    ParallelDeque *own = deques[index];
+    ParallelTask task;
+    int idle = 0;
+
+    while (!stopping.load(std::memory_order_relaxed)) {
+      if (own->pop(task) || stealAny(task)) {
+	execute(own, task);
+	idle = 0;
+	continue;
+      }
+      if (++idle < PARALLEL_SPIN) {
+	std::this_thread::yield();
+	continue;
+      }
+
+      // recheck after announcing ourselves so a push in between is not missed
+      long seen = epoch.load(std::memory_order_seq_cst);
+      sleepers.fetch_add(1, std::memory_order_seq_cst);
+      if (stealAny(task)) {
+	sleepers.fetch_sub(1, std::memory_order_seq_cst);
+	execute(own, task);
+	idle = 0;
+	continue;
+      }
+      {
+	std::unique_lock<std::mutex> lock(sleepMutex);
+	while (epoch.load(std::memory_order_seq_cst) == seen && !stopping.load()) {
+	  sleepCond.wait(lock);
+	}
+      }
+      sleepers.fetch_sub(1, std::memory_order_seq_cst);
+      idle = 0;
+    }
+  }
+};
+
+// must be called before the first parallel call to take effect
+inline void parallel_init(int threads) {
+  if (threads > 0) {
+    ParallelPool::requestedThreads() = threads;
+  }
+}
+
+inline int parallel_threads() {
+  return ParallelPool::instance().threads();
+}
+
+template <typename Body>
+void parallel_body(void *ctx, long begin, long end) {
+  (*(Body *) ctx)(begin, end);
+}
+
+template <typename Body>
+void parallel_for(long begin, long end, long grain, Body body) {
+  ParallelPool::instance().run(&parallel_body<Body>, &body, begin, end, grain);
+}
+
+template <typename T, typename Body, typename Combine>
+T parallel_reduce(long begin, long end, long grain, T identity, Body body, Combine combine) {
+  if (end <= begin) {
+    return identity;
+  }
+  if (grain <= 0) {
+    grain = std::max(1L, (end - begin) / (8 * parallel_threads()));
+  }
+
+  long chunks = (end - begin + grain - 1) / grain;
+  std::vector<T> partials(chunks, identity);
+  parallel_for(0, chunks, 1, [&](long first, long last) {
+    for(long c=first; c<last; ++c) {
+      partials[c] = body(begin + c * grain, std::min(end, begin + (c + 1) * grain));
+    }
+  });
+
+  T result = identity;
+  for(long c=0; c<chunks; ++c) {
+    result = combine(result, partials[c]);
+  }
+  return result;
+}
+
+template <typename F, typename G>
+void parallel_invoke(F f, G g) {
+  parallel_for(0, 2, 1, [&](long first, long last) {
+    for(long i=first; i<last; ++i) {
+      if (i == 0) {
+	f();
+      } else {
+	g();
+      }
+    }
+  });
+}
+
+#endif
@@ -0,0 +1,129 @@
+// Checks that segmenting an extended scan from saved state gives a newly
+// scanned room a label of its own. Writes a synthetic floor of two rooms,
+// segments it, then extends the scan by a third room behind a doorway and
+// segments again from the saved state, as the pipeline does when rerun.
+// Run as `extend_check [threads]` in a scratch directory; exits 1 on failure.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "opencv2/highgui.hpp"
+#include "opencv2/imgproc.hpp"
+#include "parallel.h"
+#include "segment.h"
+
+#define CHECK_NAME "extend_check_"
+#define CHECK_WIDTH 300
+#define CHECK_HEIGHT 200
+#define CHECK_WALL 4 // outer wall thickness
+#define CHECK_SPLIT 120 // wall between the two old rooms
+#define CHECK_NEW_ROOM 200 // wall between the old rooms and the new one
+#define CHECK_DOOR 20 // doorway width
+#define CHECK_OWN_LABEL 0.9 // fraction of the new room that must get a label of its own
+
+// 0 old rooms, 1 new room, -1 wall or outside
+static int roomOf(int i, int j, bool extended) {
+  if (i < CHECK_WALL || i >= CHECK_HEIGHT - CHECK_WALL || j < CHECK_WALL) {
+    return -1;
+  }
+  bool door = abs(i - CHECK_HEIGHT/2) < CHECK_DOOR/2;
+  if (abs(j - CHECK_SPLIT) < 2 && !door) {
+    return -1;
+  }
+  if (abs(j - CHECK_NEW_ROOM) < 2 && !door) {
+    return -1;
+  }
+  if (j < CHECK_NEW_ROOM) {
+    return 0;
+  }
+  if (!extended || j >= CHECK_WIDTH - CHECK_WALL) {
+    return -1;
+  }
+  return 1;
+}
+
+// the scan before the extension sees the walls of the old rooms and the
+// doorway to the new one, but none of its free space or far walls
+static void writeFloor(bool extended) {
+  cv::Mat freeSpace = cv::Mat::zeros(CHECK_HEIGHT, CHECK_WIDTH, CV_8U);
+  cv::Mat walls = cv::Mat::zeros(CHECK_HEIGHT, CHECK_WIDTH, CV_8U);
+  for(int i=0; i<CHECK_HEIGHT; ++i) {
+    for(int j=0; j<CHECK_WIDTH; ++j) {
+      bool seen = extended || j <= CHECK_NEW_ROOM + 1;
+      freeSpace.at<unsigned char>(i, j) = roomOf(i, j, extended) >= 0 ? 255 : 0;
+      walls.at<unsigned char>(i, j) = seen && roomOf(i, j, true) == -1 ? 255 : 0;
+    }
+  }
+  cv::imwrite(std::string(CHECK_NAME) + "freespace_rpca.png", freeSpace);
+  cv::imwrite(std::string(CHECK_NAME) + "walls_rotated.png", walls);
+}
+
+// the phases of segment's main(), one after the other
+static std::vector<int> segmentFloor() {
+  Segment segment(CHECK_NAME);
+  segment.loadState();
+  segment.subsample();
+  segment.seedClusters();
+  segment.computeFreeSpaceVisibility();
+  segment.clustering();
+  segment.labelRooms();
+  segment.saveState();
+  return segment.roomLabels;
+}
+
+// most common label of the pixels of a room, and how many pixels have it
+static int majority(std::vector<int> &labels, int room, int &count, int &total) {
+  std::map<int, int> votes;
+  total = 0;
+  for(int i=0; i<CHECK_HEIGHT; ++i) {
+    for(int j=0; j<CHECK_WIDTH; ++j) {
+      if (roomOf(i, j, true) == room && labels[i * CHECK_WIDTH + j] >= 0) {
+	votes[labels[i * CHECK_WIDTH + j]]++;
+	total++;
+      }
+    }
+  }
+  int best = -1;
+  count = 0;
+  for(std::map<int, int>::iterator it=votes.begin(); it!=votes.end(); ++it) {
+    if (it->second > count) {
+      best = it->first;
+      count = it->second;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    parallel_init(atoi(argv[1]));
+  }
+
+  remove((std::string(CHECK_NAME) + STATE_FILE).c_str());
+  writeFloor(false);
+  segmentFloor();
+  writeFloor(true);
+  std::vector<int> labels = segmentFloor();
+
+  // the new room's label must cover most of it and little of the old rooms
+  int count, total, oldCount, oldTotal;
+  int label = majority(labels, 1, count, total);
+  int outside = 0;
+  for(int i=0; i<CHECK_HEIGHT; ++i) {
+    for(int j=0; j<CHECK_WIDTH; ++j) {
+      if (roomOf(i, j, true) == 0 && labels[i * CHECK_WIDTH + j] == label) {
+	outside++;
+      }
+    }
+  }
+  majority(labels, 0, oldCount, oldTotal);
+
+  bool ok = label >= 0 && count >= CHECK_OWN_LABEL * total && outside < (1 - CHECK_OWN_LABEL) * oldTotal;
+  printf("New room: label %d on %d of %d pixels, %d pixels of the old rooms share it\n", label, count, total, outside);
+  printf("%s\n", ok ? "PASS: the new room has its own label" : "FAIL: the new room was absorbed into the old rooms");
+  return ok ? 0 : 1;
+}
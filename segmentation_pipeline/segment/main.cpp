@@ -1,23 +1,65 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <chrono>
 #include <string>
 
+#include "parallel.h"
 #include "segment.h"
 
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
 int main(int argc, char** argv) {
 
   std::string name = "";
   if (argc > 1) {
     name = std::string(argv[1]) + "_";
   }
-  
+
+  if (argc > 2) {
+    parallel_init(atoi(argv[2]));
+  }
+
+  Clock::time_point total = Clock::now();
   Segment segment(name);
 
-  segment.subsample();
+  // loading the previous state and subsampling touch disjoint members, so run them side by side
+  double loadTime = 0, subsampleTime = 0;
+  Clock::time_point start = Clock::now();
+  parallel_invoke([&]() {
+    segment.loadState();
+    loadTime = seconds(start);
+  }, [&]() {
+    segment.subsample();
+    subsampleTime = seconds(start);
+  });
+
+  // seeding needs the subsampled points and previous medoids; the initial
+  // assignment then runs as visibility tiles finish
+  start = Clock::now();
+  segment.seedClusters();
   segment.computeFreeSpaceVisibility();
+  double visibilityTime = seconds(start);
+
+  start = Clock::now();
   segment.clustering();
-  
+  double clusteringTime = seconds(start);
+
+  // full resolution room labels from the medoids, without clustering every pixel
+  start = Clock::now();
+  segment.labelRooms();
+  double roomsTime = seconds(start);
+
+  start = Clock::now();
+  segment.saveState();
+  double saveTime = seconds(start);
+
+  printf("Phase times (s): loadState %.3f, subsample %.3f, visibility+seeding %.3f, clustering %.3f, rooms %.3f, saveState %.3f, total %.3f on %d threads\n",
+	 loadTime, subsampleTime, visibilityTime, clusteringTime, roomsTime, saveTime, seconds(total), parallel_threads());
   printf("Finished running segmentation\n");
-  
+
 }
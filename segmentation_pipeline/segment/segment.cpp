@@ -3,17 +3,27 @@
 
 #include <algorithm>
 #include <fstream>
+#include <functional>
 #include <map>
 #include <math.h>
 #include <sstream>
 
 #include "opencv2/highgui.hpp"
 #include "opencv2/imgproc.hpp"
+#include "parallel.h"
+
+#include "mrf.h"
+#include "GCoptimization.h"
+#include "regiongraph.h"
 
 Segment::Segment(std::string name) {
   using namespace cv;
 
   this->name = name;
+  hasPrevState = false;
+  sampleStep = SUBSAMPLE_STEP;
+  sampleScale = 0;
+  seedTarget = 0;
   
   std::vector<bool> top, mid, bot;
   top.push_back(0); top.push_back(1); top.push_back(0);
@@ -105,44 +115,284 @@ void Segment::binaryMap(std::vector< std::vector<bool> > &map, std::string outpu
 }
 
 void Segment::clusterMap(std::map< int, std::vector<int> > &clusters, std::string outputName) {
+  std::vector<int> labels;
+  labelImage(clusters, labels);
+  labelMap(labels, outputName);
+}
+
+// one color per label, labels in row-major order
+void Segment::labelMap(std::vector<int> &labels, std::string outputName) {
 
   outputName += ".ppm";
 
-  std::vector< std::vector<int> > colors;
+  FILE *fp = fopen(outputName.c_str(), "wb");
+  fprintf(fp, "P6\n%d %d\n255\n", width, height);
+  for(unsigned int i=0; i<height; ++i) {
+    for(unsigned int j=0; j<width; ++j) {
+      static unsigned char color[3];
+      int c = labels[i*width + j] + 1;
+      color[0] = c * 317421 % 255;
+      color[1] = c * 941827 % 255;
+      color[2] = c * 893053 % 255;
+      fwrite(color, 1, 3, fp);
+    }
+  }
 
-  colors.resize(height);
-  for(unsigned int i=0; i<colors.size(); ++i) {
-    colors[i].resize(width);
+  fclose(fp);
+
+  if (DEBUG) {
+    printf("Wrote label map %s\n", outputName.c_str());
   }
+}
+  
+// cluster of every pixel in row-major order, -1 outside the clusters. Each
+// sample stands for the free pixels of its quadtree cell, or of its lattice
+// step when sampled on the lattice
+void Segment::labelImage(std::map< int, std::vector<int> > &clusters, std::vector<int> &labels) {
+  labels.assign(width * height, -1);
 
   std::map< int, std::vector<int> >::iterator it;
   for(it=clusters.begin(); it!=clusters.end(); ++it) {
-    std::vector<int> members = it->second;
+    std::vector<int> &members = it->second;
     for(unsigned int i=0; i<members.size(); ++i) {
       std::pair<int, int> coords = freeIndices[members[i]];
-      colors[coords.first][coords.second] = it->first+1;
+      FreeCell cell = freeCells.size() == freeIndices.size() ? freeCells[members[i]] : FreeCell(coords.first, coords.second, sampleStep);
+      labels[coords.first*width + coords.second] = it->first;
+      for(unsigned int x=cell.x; x<std::min(cell.x + cell.size, height); ++x) {
+	for(unsigned int y=cell.y; y<std::min(cell.y + cell.size, width); ++y) {
+	  if (freeSpace[x][y]) {
+	    labels[x*width + y] = it->first;
+	  }
+	}
+      }
+    }
+  }
+}
+
+// Absorb slivers and specks of rooms into the rooms around them. The pieces
+// of the cluster map become the nodes of a region adjacency graph, and an
+// alpha-expansion over it relabels a piece when its boundary with other rooms
+// (ROOM_SMOOTH_WEIGHT per pixel) costs more than its area (1 per pixel). The
+// graph has one node per piece instead of per pixel, so this is cheap. Moves
+// the free space points of relabeled pieces and returns how many moved.
+int Segment::smoothRooms(std::map<int, std::vector<int> > &clusterMembers) {
+  std::vector<int> labels;
+  labelImage(clusterMembers, labels);
+  RegionGraph regions(width, height, &labels[0]);
+
+  // MRF labels are the non-empty clusters
+  std::vector<int> clusterOf;
+  std::map<int, int> labelOf;
+  std::map<int, std::vector<int> >::iterator it;
+  for(it=clusterMembers.begin(); it!=clusterMembers.end(); ++it) {
+    if (it->second.size() > 0) {
+      labelOf[it->first] = clusterOf.size();
+      clusterOf.push_back(it->first);
     }
   }
 
-  FILE *fp = fopen(outputName.c_str(), "wb");
-  fprintf(fp, "P6\n%d %d\n255\n", width, height);
-  for(unsigned int i=0; i<height; ++i) {
-    for(unsigned int j=0; j<width; ++j) {
-      static unsigned char color[3];
-      color[0] = colors[i][j] * 317421 % 255;
-      color[1] = colors[i][j] * 941827 % 255;
-      color[2] = colors[i][j] * 893053 % 255;
-      fwrite(color, 1, 3, fp);
+  int numRegions = regions.numRegions(), numLabels = clusterOf.size();
+  if (numRegions < 2 || numLabels < 2) {
+    return 0;
+  }
+
+  std::vector<MRF::CostVal> D((size_t) numRegions * numLabels), V(numLabels * numLabels);
+  for(int r=0; r<numRegions; ++r) {
+    int own = labelOf[regions.regionLabel(r)];
+    for(int l=0; l<numLabels; ++l) {
+      D[r*numLabels + l] = l == own ? 0 : regions.regionSize(r);
+    }
+  }
+  for(int l1=0; l1<numLabels; ++l1) {
+    for(int l2=0; l2<numLabels; ++l2) {
+      V[l1*numLabels + l2] = l1 == l2 ? 0 : ROOM_SMOOTH_WEIGHT;
     }
   }
 
-  fclose(fp);
+  DataCost data(&D[0]);
+  SmoothnessCost smooth(&V[0]);
+  EnergyFunction energy(&data, &smooth);
+  MRF* mrf = new Expansion(numRegions, numLabels, &energy);
+  regions.setNeighbors(mrf);
+  mrf->initialize();
+  for(int r=0; r<numRegions; ++r) {
+    mrf->setLabel(r, labelOf[regions.regionLabel(r)]);
+  }
+
+  MRF::EnergyVal before = mrf->totalEnergy();
+  float t;
+  mrf->optimize(ROOM_SMOOTH_ITERATIONS, t);
+
+  std::map<int, std::vector<int> > smoothed;
+  for(it=clusterMembers.begin(); it!=clusterMembers.end(); ++it) {
+    smoothed[it->first];
+  }
+  int moved = 0;
+  for(it=clusterMembers.begin(); it!=clusterMembers.end(); ++it) {
+    for(unsigned int i=0; i<it->second.size(); ++i) {
+      std::pair<int, int> coords = freeIndices[it->second[i]];
+      int r = regions.region(coords.first*width + coords.second);
+      int target = r >= 0 ? clusterOf[mrf->getLabel(r)] : it->first;
+      smoothed[target].push_back(it->second[i]);
+      if (target != it->first) {
+	moved++;
+      }
+    }
+  }
+  clusterMembers.swap(smoothed);
 
   if (DEBUG) {
-    printf("Wrote cluster map %s\n", outputName.c_str());
+    printf("Room smoothing over %d regions, %d edges: energy %.0f -> %.0f, moved %d points in %.3f s\n",
+	   numRegions, regions.numEdges(), (double) before, (double) mrf->totalEnergy(), moved, t);
   }
+
+  delete mrf;
+  return moved;
 }
-  
+
+// MRF data costs given as a function take no context, so labelRooms() points
+// these at its tables for the duration of the solve
+static const int *roomSampleOf; // free space sample covering each pixel, -1 if none
+static const MRF::CostVal *roomSampleCost; // cost of each sample and room
+static int roomCount;
+
+static MRF::CostVal roomDataCost(int pix, MRF::Label room) {
+  int sample = roomSampleOf[pix];
+  return sample < 0 ? 0 : roomSampleCost[sample*roomCount + room];
+}
+
+// Label every free pixel with a room, the rooms being the final medoids.
+// The data cost of a pixel is the visibility distance from the sample
+// covering it to each medoid, so only a samples x rooms table is computed,
+// not pixels x rooms. A boundary between rooms costs ROOM_EDGE_COST per
+// pixel away from walls and falls towards 0 next to them, so alpha-expansion
+// over the pixel grid puts boundaries along walls and across doorways and
+// removes the ragged edges and specks of the cluster map.
+void Segment::labelRooms() {
+  int numRooms = medoids.size(), numPixels = width * height;
+  roomLabels.assign(numPixels, -1);
+  if (numRooms == 0) {
+    return;
+  }
+
+  // keep the medoids in memory and stream every free space row past them, as in assignClusters()
+  unsigned int words = visibility.words();
+  std::vector<uint64_t> centers(numRooms * words);
+  for(int l=0; l<numRooms; ++l) {
+    visibility.copyRow(medoids[l], &centers[l * words]);
+  }
+  std::vector<MRF::CostVal> sampleCost(freeIndices.size() * numRooms);
+  std::vector<int> sampleRoom(freeIndices.size());
+  for(unsigned int i=0; i<freeIndices.size(); ++i) {
+    const uint64_t *row = visibility.row(i);
+    unsigned int count = visibility.count(i);
+    for(int l=0; l<numRooms; ++l) {
+      float score = visibility.distance(row, count, &centers[l * words], visibility.count(medoids[l]));
+      sampleCost[i*numRooms + l] = (MRF::CostVal) (score * ROOM_DATA_COST + 0.5f);
+      if (l == 0 || sampleCost[i*numRooms + l] < sampleCost[i*numRooms + sampleRoom[i]]) {
+	sampleRoom[i] = l;
+      }
+    }
+  }
+
+  // sample of every free pixel, as in labelImage()
+  std::vector<int> sampleOf(numPixels, -1);
+  for(unsigned int i=0; i<freeIndices.size(); ++i) {
+    std::pair<int, int> coords = freeIndices[i];
+    FreeCell cell = freeCells.size() == freeIndices.size() ? freeCells[i] : FreeCell(coords.first, coords.second, sampleStep);
+    sampleOf[coords.first*width + coords.second] = i;
+    for(unsigned int x=cell.x; x<std::min(cell.x + cell.size, height); ++x) {
+      for(unsigned int y=cell.y; y<std::min(cell.y + cell.size, width); ++y) {
+	if (freeSpace[x][y]) {
+	  sampleOf[x*width + y] = i;
+	}
+      }
+    }
+  }
+
+  // boundary weight of neighbors from their distance to the nearest wall;
+  // walls and pixels outside free space are cut off from everything
+  std::vector< std::vector<int> > dist;
+  wallDistance(dist);
+  std::vector<MRF::CostVal> weightAt(width + height + 1);
+  for(unsigned int d=0; d<weightAt.size(); ++d) {
+    float ratio = d / ROOM_WALL_SIGMA;
+    weightAt[d] = (MRF::CostVal) (ROOM_EDGE_COST * (1 - exp(-0.5f * ratio * ratio)) + 0.5f);
+  }
+  std::vector<MRF::CostVal> hCue(numPixels, 0), vCue(numPixels, 0);
+  parallel_for(0, height, 0, [&](long first, long last) {
+    for(unsigned int i=first; i<last; ++i) {
+      for(unsigned int j=0; j<width; ++j) {
+	if (!freeSpace[i][j] || walls[i][j]) {
+	  continue;
+	}
+	if (j+1 < width && freeSpace[i][j+1] && !walls[i][j+1]) {
+	  hCue[i*width + j] = weightAt[std::min(dist[i][j], dist[i][j+1])];
+	}
+	if (i+1 < height && freeSpace[i+1][j] && !walls[i+1][j]) {
+	  vCue[i*width + j] = weightAt[std::min(dist[i][j], dist[i+1][j])];
+	}
+      }
+    }
+  });
+
+  if (numRooms == 1) {
+    for(int p=0; p<numPixels; ++p) {
+      roomLabels[p] = freeSpace[p / width][p % width] ? 0 : -1;
+    }
+  } else {
+    std::vector<MRF::CostVal> V(numRooms * numRooms);
+    for(int l1=0; l1<numRooms; ++l1) {
+      for(int l2=0; l2<numRooms; ++l2) {
+	V[l1*numRooms + l2] = l1 == l2 ? 0 : 1;
+      }
+    }
+
+    roomSampleOf = &sampleOf[0];
+    roomSampleCost = &sampleCost[0];
+    roomCount = numRooms;
+    DataCost data(roomDataCost);
+    SmoothnessCost smooth(&V[0], &hCue[0], &vCue[0]);
+    EnergyFunction energy(&data, &smooth);
+    Expansion* mrf = new Expansion(width, height, numRooms, &energy);
+    mrf->setParallel(true);
+    mrf->setActiveLabels(true);
+    mrf->initialize();
+
+    // start from the nearest medoid of every sample
+    for(int p=0; p<numPixels; ++p) {
+      mrf->setLabel(p, sampleOf[p] < 0 ? 0 : sampleRoom[sampleOf[p]]);
+    }
+
+    MRF::EnergyVal before = mrf->totalEnergy();
+    float t;
+    mrf->optimize(ROOM_LABEL_ITERATIONS, t);
+
+    for(int p=0; p<numPixels; ++p) {
+      if (freeSpace[p / width][p % width]) {
+	roomLabels[p] = mrf->getLabel(p);
+      }
+    }
+
+    if (DEBUG) {
+      printf("Room labeling of %dx%d pixels, %d rooms: energy %.0f -> %.0f in %.3f s\n",
+	     width, height, numRooms, (double) before, (double) mrf->totalEnergy(), t);
+    }
+    delete mrf;
+  }
+
+  // room + 1 per pixel, 0 outside free space
+  cv::Mat output(height, width, CV_16U);
+  for(int p=0; p<numPixels; ++p) {
+    output.at<unsigned short>(p / width, p % width) = roomLabels[p] + 1;
+  }
+  cv::imwrite(name + ROOM_LABELS_FILE, output);
+
+  if (DEBUG) {
+    labelMap(roomLabels, name + "room_map");
+  }
+}
+
 void Segment::coord2index(float x, float y, int &xindex, int &yindex) {
   xindex = std::min((int) ((x - xmin) / (xmax - xmin) * width), (int) width-1);
   yindex = std::min((int) ((y - ymin) / (ymax - ymin) * height), (int) height-1);
@@ -153,7 +403,9 @@ void Segment::index2coord(int xindex, int yindex, float &x, float &y) {
   y = ymin + yindex * (ymax - ymin) / height;
 }
   
-void Segment::subsample(int stepsize) {
+void Segment::subsample(int stepsize, int budget) {
+  sampleStep = stepsize;
+  sampleScale = 0;
   freeIndices.clear();
   wallIndices.clear();
   /*
@@ -181,13 +433,14 @@ void Segment::subsample(int stepsize) {
   }
   */
 
+  freeCells.clear();
   for(unsigned int i=0; i<walls.size(); i+=stepsize) {
     for(unsigned int j=0; j<walls[i].size(); j+=stepsize) {
       std::pair<int, int> indices(i, j);
       if (walls[i][j]) {
 	wallIndices.push_back(indices);
       }
-      if (freeSpace[i][j]) {
+      if (freeSpace[i][j] && budget <= 0) {
 
 	// filter points close to wall?
 	
@@ -196,70 +449,232 @@ void Segment::subsample(int stepsize) {
     }
   }
 
+  if (budget > 0) {
+    adaptiveSample(budget);
+  }
+
   if (DEBUG) {
     printf("Subsampled %d free space points and %d wall points\n", (int) freeIndices.size(), (int) wallIndices.size());
   }
 }
+
+// Sample free space on a quadtree whose cells may be as large as scale
+// times their center's distance to the nearest wall: open interiors get a
+// few big cells, while cells near walls and in doorways split down to
+// SAMPLE_MIN_CELL. scale is binary searched so the number of cells holding
+// free space comes as close to budget as possible without going over, and
+// each such cell contributes the free pixel closest to its center.
+// A rerun on an extended scan keeps the scale saved with the state while it
+// gives at most SAMPLE_BUDGET_SLACK times the budget: the quadtree splits on
+// local walls and free space only, so cells away from the changes, and the
+// points sampled in them, stay exactly where they were and keep their
+// visibility from the previous run.
+void Segment::adaptiveSample(int budget) {
+  std::vector< std::vector<int> > dist, integral;
+  wallDistance(dist);
+
+  // integral[i][j] is the number of free pixels above and left of (i, j)
+  integral.assign(height + 1, std::vector<int>(width + 1, 0));
+  for(unsigned int i=0; i<height; ++i) {
+    for(unsigned int j=0; j<width; ++j) {
+      integral[i+1][j+1] = integral[i][j+1] + integral[i+1][j] - integral[i][j] + (freeSpace[i][j] ? 1 : 0);
+    }
+  }
+
+  int root = 1;
+  while (root < (int) std::max(width, height)) {
+    root *= 2;
+  }
+
+  float low = 0, high = SAMPLE_MAX_SCALE, saved;
+  bool reuse = savedSampleScale(saved) && countCells(saved, root, dist, integral, 0, 0, NULL) <= budget * SAMPLE_BUDGET_SLACK;
+  if (reuse) {
+    high = saved;
+  } else if (countCells(high, root, dist, integral, 0, 0, NULL) > budget) {
+    low = high;
+  }
+  for(int k=0; !reuse && k<SAMPLE_SEARCH_STEPS && low < high; ++k) {
+    float mid = (low + high) / 2;
+    if (countCells(mid, root, dist, integral, 0, 0, NULL) > budget) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  sampleScale = high;
+
+  std::vector<int> cells;
+  countCells(high, root, dist, integral, 0, 0, &cells);
+  for(unsigned int c=0; c<cells.size(); c+=3) {
+    int x = cells[c], y = cells[c+1], size = cells[c+2];
+    int xend = std::min(x + size, (int) height), yend = std::min(y + size, (int) width);
+    int cx = x + size/2, cy = y + size/2;
+    int best = -1, bestDist = 0;
+    for(int i=x; i<xend; ++i) {
+      for(int j=y; j<yend; ++j) {
+	int d = (i-cx)*(i-cx) + (j-cy)*(j-cy);
+	if (freeSpace[i][j] && (best == -1 || d < bestDist)) {
+	  best = i * width + j;
+	  bestDist = d;
+	}
+      }
+    }
+    freeIndices.push_back(std::pair<int, int>(best / width, best % width));
+    freeCells.push_back(FreeCell(x, y, size));
+  }
+
+  if (DEBUG) {
+    printf("Adaptive sampling at %s scale %.3f for a budget of %d points\n", reuse ? "the saved" : "a searched", high, budget);
+  }
+}
+
+// read the quadtree scale from the header of the state file, without the
+// rest of it, since subsample() runs alongside loadState()
+bool Segment::savedSampleScale(float &scale) {
+  FILE *fp = fopen((name + STATE_FILE).c_str(), "rb");
+  if (!fp) {
+    return false;
+  }
+  unsigned int w, h;
+  bool ok = fread(&w, sizeof(w), 1, fp) == 1 && fread(&h, sizeof(h), 1, fp) == 1 && fread(&scale, sizeof(scale), 1, fp) == 1;
+  fclose(fp);
+  return ok && w == width && h == height && scale > 0;
+}
+
+// count the quadtree leaves under the cell at (x, y) that hold free space,
+// appending x, y, size of each one to cells if given
+int Segment::countCells(float scale, int size, std::vector< std::vector<int> > &dist, std::vector< std::vector<int> > &integral, int x, int y, std::vector<int> *cells) {
+  if (x >= (int) height || y >= (int) width) {
+    return 0;
+  }
+  int xend = std::min(x + size, (int) height), yend = std::min(y + size, (int) width);
+  if (integral[xend][yend] - integral[x][yend] - integral[xend][y] + integral[x][y] == 0) {
+    return 0;
+  }
+
+  int cx = std::min(x + size/2, xend - 1), cy = std::min(y + size/2, yend - 1);
+  if (size <= SAMPLE_MIN_CELL || size <= scale * dist[cx][cy]) {
+    if (cells) {
+      cells->push_back(x); cells->push_back(y); cells->push_back(size);
+    }
+    return 1;
+  }
+
+  int half = size / 2;
+  return countCells(scale, half, dist, integral, x, y, cells) + countCells(scale, half, dist, integral, x, y + half, cells)
+    + countCells(scale, half, dist, integral, x + half, y, cells) + countCells(scale, half, dist, integral, x + half, y + half, cells);
+}
+
+// chessboard distance from every pixel to the nearest wall pixel
+void Segment::wallDistance(std::vector< std::vector<int> > &dist) {
+  const int far = width + height;
+  dist.assign(height, std::vector<int>(width, far));
+
+  for(unsigned int i=0; i<height; ++i) {
+    for(unsigned int j=0; j<width; ++j) {
+      if (walls[i][j]) {
+	dist[i][j] = 0;
+	continue;
+      }
+      int d = dist[i][j];
+      if (i > 0) {
+	d = std::min(d, dist[i-1][j] + 1);
+	if (j > 0) {
+	  d = std::min(d, dist[i-1][j-1] + 1);
+	}
+	if (j+1 < width) {
+	  d = std::min(d, dist[i-1][j+1] + 1);
+	}
+      }
+      if (j > 0) {
+	d = std::min(d, dist[i][j-1] + 1);
+      }
+      dist[i][j] = d;
+    }
+  }
+  for(int i=height-1; i>=0; --i) {
+    for(int j=width-1; j>=0; --j) {
+      int d = dist[i][j];
+      if (i+1 < (int) height) {
+	d = std::min(d, dist[i+1][j] + 1);
+	if (j > 0) {
+	  d = std::min(d, dist[i+1][j-1] + 1);
+	}
+	if (j+1 < (int) width) {
+	  d = std::min(d, dist[i+1][j+1] + 1);
+	}
+      }
+      if (j+1 < (int) width) {
+	d = std::min(d, dist[i][j+1] + 1);
+      }
+      dist[i][j] = d;
+    }
+  }
+}
   
 void Segment::dilate(std::vector< std::vector<bool> > &mask) {
   
-  std::vector< std::vector<bool> > copy;
-  copy.resize(mask.size());
-  for(unsigned int i=0; i<mask.size(); ++i) {
-    copy[i].resize(mask[i].size());
-    for(unsigned int j=0; j<mask[i].size(); ++j) {
-      copy[i][j] = mask[i][j];
-      if (mask[i][j]) {
-	continue;
-      }
-      int count = 0;
-      for(unsigned int x=0; x<kernel.size(); ++x) {
-	for(unsigned int y=0; y<kernel[x].size(); ++y) {
-	  if (!kernel[x][y]) {
-	    continue;
-	  }
+  // rows are independent, so split them across the pool
+  std::vector< std::vector<bool> > copy(mask.size());
+  parallel_for(0, mask.size(), 0, [&](long first, long last) {
+    for(unsigned int i=first; i<last; ++i) {
+      copy[i].resize(mask[i].size());
+      for(unsigned int j=0; j<mask[i].size(); ++j) {
+	copy[i][j] = mask[i][j];
+	if (mask[i][j]) {
+	  continue;
+	}
+	int count = 0;
+	for(unsigned int x=0; x<kernel.size(); ++x) {
+	  for(unsigned int y=0; y<kernel[x].size(); ++y) {
+	    if (!kernel[x][y]) {
+	      continue;
+	    }
 	  
-	  int xindex = std::max(0, std::min((int) mask.size()-1, (int) (i+x-kernel.size()/2)));
-	  int yindex = std::max(0, std::min((int) mask[i].size()-1, (int) (j+y-kernel.size()/2)));
-	  if (mask[xindex][yindex]) {
-	    count++;
+	    int xindex = std::max(0, std::min((int) mask.size()-1, (int) (i+x-kernel.size()/2)));
+	    int yindex = std::max(0, std::min((int) mask[i].size()-1, (int) (j+y-kernel.size()/2)));
+	    if (mask[xindex][yindex]) {
+	      count++;
+	    }
 	  }
 	}
+	copy[i][j] = count >= kernelSum/2;
       }
-      copy[i][j] = count >= kernelSum/2;
     }
-  }
+  });
   mask = copy;
 }
 
 void Segment::erode(std::vector< std::vector<bool> > &mask) {
   
-  std::vector< std::vector<bool> > copy;
-  copy.resize(mask.size());
-  for(unsigned int i=0; i<mask.size(); ++i) {
-    copy[i].resize(mask[i].size());
-    for(unsigned int j=0; j<mask[i].size(); ++j) {
-      copy[i][j] = mask[i][j];
-      if (!mask[i][j]) {
-	continue;
-      }
-      int count = 0;
-      for(unsigned int x=0; x<kernel.size(); ++x) {
-	for(unsigned int y=0; y<kernel[x].size(); ++y) {
-	  if (!kernel[x][y]) {
-	    continue;
-	  }
+  // rows are independent, so split them across the pool
+  std::vector< std::vector<bool> > copy(mask.size());
+  parallel_for(0, mask.size(), 0, [&](long first, long last) {
+    for(unsigned int i=first; i<last; ++i) {
+      copy[i].resize(mask[i].size());
+      for(unsigned int j=0; j<mask[i].size(); ++j) {
+	copy[i][j] = mask[i][j];
+	if (!mask[i][j]) {
+	  continue;
+	}
+	int count = 0;
+	for(unsigned int x=0; x<kernel.size(); ++x) {
+	  for(unsigned int y=0; y<kernel[x].size(); ++y) {
+	    if (!kernel[x][y]) {
+	      continue;
+	    }
 	  
-	  int xindex = std::max(0, std::min((int) mask.size()-1, (int) (i+x-kernel.size()/2)));
-	  int yindex = std::max(0, std::min((int) mask[i].size()-1, (int) (j+y-kernel.size()/2)));
-	  if (!mask[xindex][yindex]) {
-	    count++;
+	    int xindex = std::max(0, std::min((int) mask.size()-1, (int) (i+x-kernel.size()/2)));
+	    int yindex = std::max(0, std::min((int) mask[i].size()-1, (int) (j+y-kernel.size()/2)));
+	    if (!mask[xindex][yindex]) {
+	      count++;
+	    }
 	  }
 	}
+	copy[i][j] = !(count >= kernelSum/2);
       }
-      copy[i][j] = !(count >= kernelSum/2);
     }
-  }
+  });
   mask = copy;
 }
 
@@ -284,17 +699,59 @@ void Segment::setKernel(std::vector< std::vector<bool> > &kernel) {
 }
 
 void Segment::computeFreeSpaceVisibility() {
+  if (hasPrevState) {
+    prepareUpdate();
+  }
+
   if (DEBUG) {
-    printf("Computing %d-dimension visibility vectors for %d free space points...\n", (int) wallIndices.size(), (int) freeIndices.size());
+    printf("%s %d-dimension visibility vectors for %d free space points on %d threads...\n", hasPrevState ? "Updating" : "Computing", (int) wallIndices.size(), (int) freeIndices.size(), parallel_threads());
   }
   
-  visibilityVectors.clear();
-  visibilityVectors.resize(freeIndices.size());
-  for(unsigned int i=0; i<freeIndices.size(); ++i) {
-    int fx = freeIndices[i].first;
-    int fy = freeIndices[i].second;
+  visibility.resize(freeIndices.size(), wallIndices.size(), name + VISIBILITY_FILE);
+  unsigned int words = visibility.words();
+  unsigned int tiles = visibility.tiles();
+
+  // seed rows are computed up front so every tile can be assigned to its
+  // nearest seed as soon as it is computed
+  std::vector<uint64_t> seedRows(seeds.size() * words, 0);
+  std::vector<unsigned int> seedCounts(seeds.size(), 0);
+  for(unsigned int k=0; k<seeds.size(); ++k) {
+    computeVisibility(freeIndices[seeds[k]].first, freeIndices[seeds[k]].second, &seedRows[k * words]);
+    for(unsigned int w=0; w<words; ++w) {
+      seedCounts[k] += __builtin_popcountll(seedRows[k * words + w]);
+    }
+  }
+  seedAssignment.assign(seeds.size() > 0 ? freeIndices.size() : 0, -1);
+  seedDistance.assign(seedAssignment.size(), 1);
+
+  // each task computes a tile, stores it and assigns its rows to the seeds
+  // straight from the tile buffer, so seeding keeps pace with the tiles
+  long recomputed = parallel_reduce(0, tiles, 1, 0L, [&](long first, long last) {
+    std::vector<uint64_t> buffer;
+    long count = 0;
+    for(long t=first; t<last; ++t) {
+      buffer.assign((size_t) (visibility.tileEnd(t) - visibility.tileStart(t)) * words, 0);
+      count += computeTile(t, buffer);
+      visibility.writeTile(t, buffer);
+      if (seeds.size() > 0) {
+	assignTile(t, buffer, seedRows, seedCounts);
+      }
+    }
+    return count;
+  }, std::plus<long>());
+
+  // a warm start has a seed per previous room at most; prevFreeAt is
+  // still needed to tell the points of newly scanned free space
+  if (seeds.size() > 0 && (int) seeds.size() < seedTarget) {
+    topUpSeeds();
+  }
 
-    computeVisibility(fx, fy, visibilityVectors[i]);
+  if (hasPrevState) {
+    prevVisibility.clear();
+    prevWallAt.clear(); prevFreeAt.clear(); changedBlocks.clear();
+    if (DEBUG) {
+      printf("Recomputed %ld of %ld visibility entries\n", recomputed, (long) freeIndices.size() * wallIndices.size());
+    }
   }
 
   if (DEBUG) {
@@ -302,14 +759,245 @@ void Segment::computeFreeSpaceVisibility() {
   }
 }
 
-void Segment::computeVisibility(int fx, int fy, std::vector<float> &out) {
-  out.resize(wallIndices.size());
+void Segment::computeVisibility(int fx, int fy, uint64_t *out) {
   for(unsigned int i=0; i<wallIndices.size(); ++i) {
     int wx = wallIndices[i].first;
     int wy = wallIndices[i].second;
-    out[i] = visible(fx, fy, wx, wy) ? 1 : 0;
+    if (visible(fx, fy, wx, wy)) {
+      out[i >> 6] |= (uint64_t) 1 << (i & 63);
+    }
+  }
+}
+
+// fill one tile of visibility rows, returning the number of entries recomputed;
+// called concurrently from the pool's threads
+long Segment::computeTile(unsigned int tile, std::vector<uint64_t> &buffer) {
+  unsigned int start = visibility.tileStart(tile), end = visibility.tileEnd(tile);
+  long recomputed = 0;
+  std::vector<uint64_t> bits(hasPrevState ? prevVisibility.words() : 0);
+
+  // rows that reuse the previous run are visited in the order of their
+  // previous rows, so each previous tile is mapped once per tile instead of
+  // once per row when the previous matrix is out of core
+  std::vector< std::pair<int, unsigned int> > order;
+  for(unsigned int i=start; i<end; ++i) {
+    int prevRow = hasPrevState ? prevFreeAt[freeIndices[i].first][freeIndices[i].second] : -1;
+    order.push_back(std::pair<int, unsigned int>(prevRow, i));
+  }
+  std::sort(order.begin(), order.end());
+
+  for(unsigned int k=0; k<order.size(); ++k) {
+    int prevRow = order[k].first;
+    unsigned int i = order[k].second;
+    int fx = freeIndices[i].first;
+    int fy = freeIndices[i].second;
+    uint64_t *out = &buffer[(size_t) (i - start) * visibility.words()];
+
+    if (prevRow == -1) {
+      computeVisibility(fx, fy, out);
+      recomputed += wallIndices.size();
+      continue;
+    }
+
+    // recompute only the entries that a change in the walls could affect,
+    // copying everything else over from the previous run
+    prevVisibility.copyRow(prevRow, &bits[0]);
+    for(unsigned int j=0; j<wallIndices.size(); ++j) {
+      int wx = wallIndices[j].first;
+      int wy = wallIndices[j].second;
+      int prevCol = prevWallAt[wx][wy];
+      bool vis;
+
+      if (prevCol == -1 || crossesChange(fx, fy, wx, wy)) {
+	vis = visible(fx, fy, wx, wy);
+	recomputed++;
+      } else {
+	vis = (bits[prevCol >> 6] >> (prevCol & 63)) & 1;
+      }
+      if (vis) {
+	out[j >> 6] |= (uint64_t) 1 << (j & 63);
+      }
+    }
+  }
+  return recomputed;
+}
+
+// assign the rows of a finished tile to their nearest seed, same as assignClusters()
+void Segment::assignTile(unsigned int tile, std::vector<uint64_t> &buffer, std::vector<uint64_t> &seedRows, std::vector<unsigned int> &seedCounts) {
+  unsigned int start = visibility.tileStart(tile), words = visibility.words();
+  for(unsigned int i=start; i<visibility.tileEnd(tile); ++i) {
+    const uint64_t *row = &buffer[(size_t) (i - start) * words];
+    unsigned int count = visibility.count(i);
+    float bestScore = 1;
+    int bestCenter = -1;
+    for(unsigned int k=0; k<seeds.size(); ++k) {
+      float score = visibility.distance(row, count, &seedRows[k * words], seedCounts[k]);
+      if (score < bestScore || bestCenter == -1) {
+	bestScore = score;
+	bestCenter = k;
+      }
+    }
+    seedAssignment[i] = bestCenter;
+    seedDistance[i] = bestScore;
+  }
+}
+
+// add seeds until there are seedTarget of them, each time the point
+// farthest in visibility from every seed so far. Points of newly scanned
+// free space go first as long as they are at least MERGE_THRESH away, so
+// a room added by an extended scan gets a seed of its own instead of being
+// absorbed into the old rooms. The points closer to a new seed than to
+// their current one are moved over to it
+void Segment::topUpSeeds() {
+  unsigned int words = visibility.words(), added = 0;
+  std::vector<bool> isNew(freeIndices.size(), !hasPrevState);
+  for(unsigned int i=0; hasPrevState && i<freeIndices.size(); ++i) {
+    isNew[i] = prevFreeAt[freeIndices[i].first][freeIndices[i].second] == -1;
+  }
+
+  std::vector<uint64_t> seedRow(words);
+  while ((int) seeds.size() < seedTarget) {
+    int best = -1;
+    bool bestFirst = false;
+    for(unsigned int i=0; i<freeIndices.size(); ++i) {
+      if (seedDistance[i] <= 0) {
+	continue;
+      }
+      bool first = isNew[i] && seedDistance[i] >= MERGE_THRESH;
+      if (best == -1 || (first && !bestFirst) || (first == bestFirst && seedDistance[i] > seedDistance[best])) {
+	best = i;
+	bestFirst = first;
+      }
+    }
+    if (best == -1) {
+      break;
+    }
+
+    int k = seeds.size();
+    seeds.push_back(best);
+    added++;
+    visibility.copyRow(best, &seedRow[0]);
+    unsigned int seedCount = visibility.count(best);
+    parallel_for(0, visibility.tiles(), 1, [&](long first, long last) {
+      std::vector<uint64_t> tile;
+      for(long t=first; t<last; ++t) {
+	unsigned int start = visibility.tileStart(t);
+	visibility.readTile(t, tile);
+	for(unsigned int i=start; i<visibility.tileEnd(t); ++i) {
+	  const uint64_t *row = &tile[(size_t) (i - start) * words];
+	  float score = visibility.distance(row, visibility.count(i), &seedRow[0], seedCount);
+	  if (score < seedDistance[i]) {
+	    seedDistance[i] = score;
+	    seedAssignment[i] = k;
+	  }
+	}
+      }
+    });
+  }
+
+  if (DEBUG) {
+    printf("Added %d seeds farthest from the warm start\n", added);
+  }
+}
+
+// index the previous run's points and mark the blocks where the walls changed
+void Segment::prepareUpdate() {
+  prevWallAt.assign(height, std::vector<int>(width, -1));
+  prevFreeAt.assign(height, std::vector<int>(width, -1));
+  for(unsigned int i=0; i<prevWallIndices.size(); ++i) {
+    prevWallAt[prevWallIndices[i].first][prevWallIndices[i].second] = i;
+  }
+  for(unsigned int i=0; i<prevFreeIndices.size(); ++i) {
+    prevFreeAt[prevFreeIndices[i].first][prevFreeIndices[i].second] = i;
+  }
+
+  // mark blocks containing a changed wall cell, dilated by one block so that
+  // crossesChange() only has to sample each line every half block
+  int blockRows = (height + CHANGE_BLOCK - 1) / CHANGE_BLOCK;
+  int blockCols = (width + CHANGE_BLOCK - 1) / CHANGE_BLOCK;
+  changedBlocks.assign(blockRows, std::vector<bool>(blockCols, false));
+  int changedCells = 0;
+  for(unsigned int i=0; i<height; ++i) {
+    for(unsigned int j=0; j<width; ++j) {
+      if (walls[i][j] == prevWalls[i][j]) {
+	continue;
+      }
+      changedCells++;
+      int bi = i / CHANGE_BLOCK, bj = j / CHANGE_BLOCK;
+      for(int x=std::max(0, bi-1); x<=std::min(blockRows-1, bi+1); ++x) {
+	for(int y=std::max(0, bj-1); y<=std::min(blockCols-1, bj+1); ++y) {
+	  changedBlocks[x][y] = true;
+	}
+      }
+    }
+  }
+
+  if (DEBUG) {
+    printf("%d wall cells changed since the previous run\n", changedCells);
+  }
+}
+
+// conservative test for whether the line of sight between two cells passes
+// through a changed block; samples every half block along the major axis
+bool Segment::crossesChange(int xstart, int ystart, int xend, int yend) {
+  int steps = std::max(abs(xend - xstart), abs(yend - ystart)) / (CHANGE_BLOCK / 2) + 1;
+  for(int k=0; k<=steps; ++k) {
+    int x = xstart + (xend - xstart) * k / steps;
+    int y = ystart + (yend - ystart) * k / steps;
+    if (changedBlocks[x / CHANGE_BLOCK][y / CHANGE_BLOCK]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int Segment::nearestFreeIndex(int x, int y) {
+  int best = -1;
+  int bestDist = 0;
+  for(unsigned int i=0; i<freeIndices.size(); ++i) {
+    int dx = freeIndices[i].first - x;
+    int dy = freeIndices[i].second - y;
+    if (best == -1 || dx*dx + dy*dy < bestDist) {
+      best = i;
+      bestDist = dx*dx + dy*dy;
+    }
+  }
+  return best;
+}
+
+// pick the initial cluster centers; this only needs the subsampled points,
+// so it can run before the visibility vectors exist
+void Segment::seedClusters(int clusters) {
+  seeds.clear();
+  seedAssignment.clear();
+  clusters = std::min(clusters, (int) freeIndices.size());
+  seedTarget = clusters;
+
+  if (hasPrevState && prevMedoids.size() > 0) {
+    // warm start from the medoids of the previous run; the seeds are topped
+    // back up to clusters once the visibility vectors exist (topUpSeeds())
+    std::vector<bool> used(freeIndices.size(), false);
+    for(unsigned int i=0; i<prevMedoids.size(); ++i) {
+      int index = nearestFreeIndex(prevMedoids[i].first, prevMedoids[i].second);
+      if (index != -1 && !used[index]) {
+	used[index] = true;
+	seeds.push_back(index);
+      }
+    }
+
+    if (DEBUG) {
+      printf("Warm starting from %d previous medoids\n", (int) seeds.size());
+    }
+  } else {
+    // pick random vertices to be initial cluster centers
+    seeds.resize(freeIndices.size());
+    for(unsigned int i=0; i<freeIndices.size(); ++i) {
+      seeds[i] = i;
+    }
+    std::srand(unsigned(time(NULL)));
+    std::random_shuffle(seeds.begin(), seeds.end());
+    seeds.resize(clusters);
   }
-  normalize(out);
 }
 
 void Segment::clustering(int clusters) {
@@ -317,17 +1005,12 @@ void Segment::clustering(int clusters) {
   if (DEBUG) {
     printf("Beginning clustering...\n");
   }
-  
-  clusters = std::min(clusters, (int) freeIndices.size());
 
-  // pick random vertices to be initial cluster centers
-  std::vector<int> indices(freeIndices.size());
-  for(unsigned int i=0; i<freeIndices.size(); ++i) {
-    indices[i] = i;
+  if (seeds.empty()) {
+    seedClusters(clusters);
   }
-  std::srand(unsigned(time(NULL)));
-  std::random_shuffle(indices.begin(), indices.end());
-  indices.resize(clusters);
+  std::vector<int> indices = seeds;
+  clusters = indices.size();
 
   // map of cluster center to vector of cluster's members 
   std::map<int, std::vector<int> > clusterMembers;
@@ -336,7 +1019,14 @@ void Segment::clustering(int clusters) {
     clusterMembers[i] = v;
   }
 
-  assignClusters(clusterMembers, indices);
+  if (seedAssignment.size() == freeIndices.size() && seedAssignment.size() > 0) {
+    // already assigned tile by tile while the visibility vectors were computed
+    for(unsigned int i=0; i<seedAssignment.size(); ++i) {
+      clusterMembers[seedAssignment[i]].push_back(i);
+    }
+  } else {
+    assignClusters(clusterMembers, indices);
+  }
 
   int rounds = 0;
   bool merged = true;
@@ -349,6 +1039,24 @@ void Segment::clustering(int clusters) {
   }
   while(merged && rounds < KMEDOIDS_LIMIT && clusters > 1);
 
+  if (smoothRooms(clusterMembers) > 0) {
+    recenter(clusterMembers, indices);
+    clusters = 0;
+    std::map<int, std::vector<int> >::iterator it;
+    for(it=clusterMembers.begin(); it!=clusterMembers.end(); ++it) {
+      if (it->second.size() > 0) {
+	clusters++;
+      }
+    }
+  }
+
+  medoids.clear();
+  for(unsigned int i=0; i<indices.size(); ++i) {
+    if (indices[i] != -1 && clusterMembers.count(i) > 0 && clusterMembers[i].size() > 0) {
+      medoids.push_back(indices[i]);
+    }
+  }
+
   if (DEBUG) {
     printf("Num clusters: %d\n", clusters);
     int sum = 0;
@@ -365,27 +1073,157 @@ void Segment::clustering(int clusters) {
   }
 }
 
-// find the best center within a cluster
+bool Segment::loadState() {
+  std::string fname = name + STATE_FILE;
+  FILE *fp = fopen(fname.c_str(), "rb");
+  if (!fp) {
+    return false;
+  }
+
+  // image fits every run to the bounding box of the scan, so a scan that
+  // grew past the old box gives a floor of another size: start over
+  unsigned int w = 0, h = 0, n;
+  float scale;
+  bool ok = fread(&w, sizeof(w), 1, fp) == 1 && fread(&h, sizeof(h), 1, fp) == 1;
+  if (ok && (w != width || h != height)) {
+    printf("State file %s is for a %ux%u floor, not %ux%u\n", fname.c_str(), w, h, width, height);
+    ok = false;
+  }
+  ok = ok && fread(&scale, sizeof(scale), 1, fp) == 1; // read by savedSampleScale()
+
+  prevWalls.assign(height, std::vector<bool>(width, false));
+  std::vector<unsigned char> row(width);
+  for(unsigned int i=0; ok && i<height; ++i) {
+    ok = fread(&row[0], 1, width, fp) == width;
+    for(unsigned int j=0; ok && j<width; ++j) {
+      prevWalls[i][j] = row[j];
+    }
+  }
+
+  std::vector< std::pair<int, int> > *lists[3] = { &prevWallIndices, &prevFreeIndices, &prevMedoids };
+  for(int l=0; ok && l<3; ++l) {
+    ok = fread(&n, sizeof(n), 1, fp) == 1;
+    lists[l]->resize(ok ? n : 0);
+    for(unsigned int i=0; ok && i<n; ++i) {
+      int coords[2];
+      ok = fread(coords, sizeof(int), 2, fp) == 2 && coords[0] >= 0 && coords[0] < (int) height && coords[1] >= 0 && coords[1] < (int) width;
+      (*lists[l])[i] = std::pair<int, int>(coords[0], coords[1]);
+    }
+  }
+
+  if (ok) {
+    prevVisibility.resize(prevFreeIndices.size(), prevWallIndices.size(), name + PREV_VISIBILITY_FILE);
+  }
+  std::vector<uint64_t> buffer;
+  for(unsigned int t=0; ok && t<prevVisibility.tiles(); ++t) {
+    size_t words = (size_t) (prevVisibility.tileEnd(t) - prevVisibility.tileStart(t)) * prevVisibility.words();
+    buffer.resize(words);
+    ok = fread(&buffer[0], sizeof(uint64_t), words, fp) == words;
+    if (ok) {
+      prevVisibility.writeTile(t, buffer);
+    }
+  }
+  fclose(fp);
+
+  if (!ok) {
+    printf("Ignoring incompatible state file %s\n", fname.c_str());
+    prevWalls.clear(); prevWallIndices.clear(); prevFreeIndices.clear(); prevMedoids.clear();
+    prevVisibility.clear();
+    return false;
+  }
+
+  hasPrevState = true;
+  if (DEBUG) {
+    printf("Loaded state %s: %d free space points, %d wall points, %d medoids\n", fname.c_str(), (int) prevFreeIndices.size(), (int) prevWallIndices.size(), (int) prevMedoids.size());
+  }
+  return true;
+}
+
+void Segment::saveState() {
+  std::string fname = name + STATE_FILE;
+  FILE *fp = fopen(fname.c_str(), "wb");
+  if (!fp) {
+    printf("Could not write state file %s\n", fname.c_str());
+    return;
+  }
+
+  fwrite(&width, sizeof(width), 1, fp);
+  fwrite(&height, sizeof(height), 1, fp);
+  fwrite(&sampleScale, sizeof(sampleScale), 1, fp);
+
+  std::vector<unsigned char> row(width);
+  for(unsigned int i=0; i<height; ++i) {
+    for(unsigned int j=0; j<width; ++j) {
+      row[j] = walls[i][j] ? 1 : 0;
+    }
+    fwrite(&row[0], 1, width, fp);
+  }
+
+  std::vector< std::pair<int, int> > medoidCoords;
+  for(unsigned int i=0; i<medoids.size(); ++i) {
+    medoidCoords.push_back(freeIndices[medoids[i]]);
+  }
+
+  std::vector< std::pair<int, int> > *lists[3] = { &wallIndices, &freeIndices, &medoidCoords };
+  for(int l=0; l<3; ++l) {
+    unsigned int n = lists[l]->size();
+    fwrite(&n, sizeof(n), 1, fp);
+    for(unsigned int i=0; i<n; ++i) {
+      int coords[2] = { (*lists[l])[i].first, (*lists[l])[i].second };
+      fwrite(coords, sizeof(int), 2, fp);
+    }
+  }
+
+  // visibility rows are written in the same bit-packed layout as VisibilityMatrix
+  for(unsigned int i=0; i<visibility.rows(); ++i) {
+    fwrite(visibility.row(i), sizeof(uint64_t), visibility.words(), fp);
+  }
+  fclose(fp);
+
+  if (DEBUG) {
+    printf("Saved state %s\n", fname.c_str());
+  }
+}
+
+// find the best center within a cluster: the member with the least summed
+// distance to the others. The members are taken in row order in blocks of up
+// to a tile's worth of rows; the rows of a block are copied out and those of
+// the members after it streamed past them, so out of core the tiles are
+// mapped once per block rather than once per member
 void Segment::recenter(std::map<int, std::vector<int> > &clusterMembers, std::vector<int> &indices) {
 
   printf("Recentering...\n");
   
+  unsigned int words = visibility.words();
+  std::vector<uint64_t> block;
   std::map<int, std::vector<int> >::iterator it;
   for(it=clusterMembers.begin(); it!=clusterMembers.end(); ++it) {
     std::vector<int> members = it->second;
-    float bestScore = members.size();
-    int bestIndex = 0;
-
-    for(unsigned int i=0; i<members.size(); ++i) {
-      float score = 0;
-      for(unsigned int j=0; j<members.size(); ++j) {
-	if (i == j) {
-	  continue;
+    std::sort(members.begin(), members.end());
+    std::vector<double> scores(members.size(), 0);
+
+    for(unsigned int first=0; first<members.size(); first+=VISIBILITY_TILE_ROWS) {
+      unsigned int last = std::min((unsigned int) members.size(), first + VISIBILITY_TILE_ROWS);
+      block.resize((size_t) (last - first) * words);
+      for(unsigned int i=first; i<last; ++i) {
+	visibility.copyRow(members[i], &block[(size_t) (i - first) * words]);
+      }
+      for(unsigned int j=first; j<members.size(); ++j) {
+	const uint64_t *row = visibility.row(members[j]);
+	unsigned int count = visibility.count(members[j]);
+	for(unsigned int i=first; i<last && i<j; ++i) {
+	  float score = visibility.distance(&block[(size_t) (i - first) * words], visibility.count(members[i]), row, count);
+	  scores[i] += score;
+	  scores[j] += score;
 	}
-	score += distance(visibilityVectors[members[i]], visibilityVectors[members[j]]);
       }
-      if (score < bestScore) {
-	bestScore = score;
+    }
+
+    double bestScore = members.size();
+    int bestIndex = 0;
+    for(unsigned int i=0; i<members.size(); ++i) {
+      if (scores[i] < bestScore) {
+	bestScore = scores[i];
 	bestIndex = members[i];
       }
     }
@@ -404,18 +1242,30 @@ void Segment::assignClusters(std::map<int, std::vector<int> > &clusterMembers, s
   for(it=clusterMembers.begin(); it!=clusterMembers.end(); ++it) {
     it->second.clear();
   }
+
+  // keep the cluster centers in memory and stream every free space row past them
+  unsigned int words = visibility.words();
+  std::vector<uint64_t> centers(indices.size() * words);
+  for(unsigned int j=0; j<indices.size(); ++j) {
+    if (indices[j] != -1) {
+      visibility.copyRow(indices[j], &centers[j * words]);
+    }
+  }
   
   // add free space points to clusters
   for(unsigned int i=0; i<freeIndices.size(); ++i) {
+    const uint64_t *row = visibility.row(i);
+    unsigned int count = visibility.count(i);
     float bestScore = 1;
-    int bestCenter = 0;
+    int bestCenter = -1;
     for(unsigned int j=0; j<indices.size(); ++j) {
       if (indices[j] == -1) {
 	continue;
       }
       
-      float score = distance(visibilityVectors[i], visibilityVectors[indices[j]]);
-      if (score < bestScore) {
+      // points that see nothing in common with any center still go to a live cluster
+      float score = visibility.distance(row, count, &centers[j * words], visibility.count(indices[j]));
+      if (score < bestScore || bestCenter == -1) {
 	bestScore = score;
 	bestCenter = j;
       }
@@ -457,7 +1307,7 @@ bool Segment::merge(std::map<int, std::vector<int> > &clusterMembers, std::vecto
 	continue;
       }
 
-      float curDist = distance(visibilityVectors[indices[i->first]], visibilityVectors[indices[j->first]]);
+      float curDist = visibility.distance(indices[i->first], indices[j->first]);
       if (curDist < minDist) {
 	minDist = curDist;
 	curMerge = j->first;
@@ -471,6 +1321,11 @@ bool Segment::merge(std::map<int, std::vector<int> > &clusterMembers, std::vecto
 
   for(unsigned int k=0; k<bestMerge.size(); ++k) {
 
+    // empty or already deleted clusters have nothing to merge
+    if (bestMerge[k] == -1) {
+      continue;
+    }
+
     // prevents merging into self
     if (mergeTo[bestMerge[k]] == k) {
       continue;
@@ -535,34 +1390,3 @@ void Segment::swap(int &one, int &two) {
   two = one ^ two;
   one = one ^ two;
 }
-
-void Segment::normalize(std::vector<float> &v) {
-  float sum = 0;
-  for(unsigned int i=0; i<v.size(); ++i) {
-    sum += v[i];
-  }
-
-  if (sum == 0 || sum == 1) {
-    return;
-  }
-
-  for(unsigned int i=0; i<v.size(); ++i) {
-    v[i] = v[i] / sum;
-  }
-}
-
-// returns normalized distance from 0 to 1 (assuming vectors are normalized)
-float Segment::distance(std::vector<float> &one, std::vector<float> &two) {
-  if (one.size() != two.size()) {
-    return -1;
-  }
-
-  // assuming both vectors are normalized
-  float score = 0;
-  for(unsigned int i=0; i<one.size(); ++i) {
-    if (one[i] == 0 && two[i] != 0 || one[i] != 0 && two[i] == 0) {
-      score += one[i] + two[i];
-    }
-  }
-  return score/2;
-}
@@ -5,24 +5,51 @@
 #include <string>
 #include <vector>
 
+#include "visibility.h"
+
 #define END_HEADER "end_header"
 #define MASK_WIDTH 300
 #define WALL_THRESH 0.25
 #define SUBSAMPLE_STEP 3
+#define SAMPLE_BUDGET 2000 // free space samples, 0 samples on the SUBSAMPLE_STEP lattice instead
+#define SAMPLE_MIN_CELL 4
+#define SAMPLE_MAX_SCALE 64.0f
+#define SAMPLE_SEARCH_STEPS 20
+#define SAMPLE_BUDGET_SLACK 1.5f // a rerun keeps the saved quadtree scale up to this many times the budget
 #define VISIBILITY_BUFFER 2
 #define MERGE_THRESH 0.6
 #define NUM_CLUSTERS 50
 #define KMEDOIDS_LIMIT 20
+#define STATE_FILE "segment_state.dat"
+#define VISIBILITY_FILE "visibility.tmp"
+#define PREV_VISIBILITY_FILE "prev_visibility.tmp"
+#define CHANGE_BLOCK 16
+#define ROOM_SMOOTH_WEIGHT 2 // cost per pixel of boundary between rooms, against 1 per relabeled pixel
+#define ROOM_SMOOTH_ITERATIONS 3
+#define ROOM_DATA_COST 20 // cost of labeling a pixel with a room whose medoid sees none of the same walls
+#define ROOM_EDGE_COST 10 // cost per pixel of boundary between rooms away from walls
+#define ROOM_WALL_SIGMA 4.0f // distance from a wall, in pixels, over which the boundary cost rises to ROOM_EDGE_COST
+#define ROOM_LABEL_ITERATIONS 5
+#define ROOM_LABELS_FILE "room_labels.png"
 
 #define DEBUG 1
 
+// square quadtree cell of the mask represented by one adaptive free space sample
+struct FreeCell {
+  unsigned int x, y, size;
+  FreeCell(unsigned int x, unsigned int y, unsigned int size) : x(x), y(y), size(size) {}
+};
+
 class Segment {
  public:
   std::vector< std::pair<int, int> > wallIndices, freeIndices; // subsampled indices of walls/free space
+  std::vector<FreeCell> freeCells; // cell of each free space sample when sampled adaptively
   std::vector< std::vector<int> > density;
   std::vector< std::vector<float> > freeSpaceProb;
   std::vector< std::vector<bool> > walls, freeSpace;
-  std::vector< std::vector<float> > visibilityVectors;
+  VisibilityMatrix visibility; // free space x wall bits, see visibility.h
+  std::vector<int> medoids; // free space indices of the final cluster centers
+  std::vector<int> roomLabels; // room (index into medoids) of every pixel in row-major order, -1 outside free space
   std::vector<float> vx, vy, vz;
   unsigned int vertices, faces, edges;
   unsigned int width, height; // mask width, height
@@ -33,11 +60,12 @@ class Segment {
   void densityMap(std::vector< std::vector<int> > &map, std::string outputName);
   void binaryMap(std::vector< std::vector<bool> > &map, std::string outputName);
   void clusterMap(std::map< int, std::vector<int> > &clusters, std::string outputName);
+  void labelMap(std::vector<int> &labels, std::string outputName);
   
   void coord2index(float x, float y, int &xindex, int &yindex);
   void index2coord(int xindex, int yindex, float &x, float &y);
   
-  void subsample(int stepsize = SUBSAMPLE_STEP);
+  void subsample(int stepsize = SUBSAMPLE_STEP, int budget = SAMPLE_BUDGET);
   
   void dilate(std::vector< std::vector<bool> > &mask);
   void erode(std::vector< std::vector<bool> > &mask);
@@ -47,22 +75,52 @@ class Segment {
 
   void computeFreeSpaceVisibility();
 
+  void seedClusters(int clusters = NUM_CLUSTERS);
   void clustering(int clusters = NUM_CLUSTERS);
+  void labelRooms();
+
+  // state from a previous run, used to segment an extended scan incrementally
+  bool loadState();
+  void saveState();
   
  private:
   std::string name;
   float xmax, xmin, ymax, ymin, zmax, zmin;
   int maxDensity, kernelSum;
   std::vector< std::vector<bool> > kernel;
+
+  bool hasPrevState;
+  std::vector< std::vector<bool> > prevWalls;
+  std::vector< std::pair<int, int> > prevWallIndices, prevFreeIndices, prevMedoids;
+  VisibilityMatrix prevVisibility;
+  std::vector< std::vector<int> > prevWallAt, prevFreeAt; // previous index of each cell, or -1
+  std::vector< std::vector<bool> > changedBlocks;
+
+  std::vector<int> seeds; // initial cluster centers
+  std::vector<int> seedAssignment; // nearest seed of each free space point
+  std::vector<float> seedDistance; // visibility distance of each free space point to its nearest seed
+  int seedTarget; // number of seeds asked of seedClusters()
+  int sampleStep; // lattice step of the last subsample()
+  float sampleScale; // quadtree scale of the last adaptiveSample(), 0 on the lattice
   
+  void adaptiveSample(int budget);
+  bool savedSampleScale(float &scale);
+  int countCells(float scale, int size, std::vector< std::vector<int> > &dist, std::vector< std::vector<int> > &integral, int x, int y, std::vector<int> *cells);
+  void wallDistance(std::vector< std::vector<int> > &dist);
   bool visible(int xstart, int ystart, int xend, int yend, int buffer=VISIBILITY_BUFFER);
   void swap(int &one, int &two);
-  void normalize(std::vector<float> &v);
-  float distance(std::vector<float> &one, std::vector<float> &two);
-  void computeVisibility(int fx, int fy, std::vector<float> &out);
+  void computeVisibility(int fx, int fy, uint64_t *out);
+  long computeTile(unsigned int tile, std::vector<uint64_t> &buffer);
+  void assignTile(unsigned int tile, std::vector<uint64_t> &buffer, std::vector<uint64_t> &seedRows, std::vector<unsigned int> &seedCounts);
+  void topUpSeeds();
+  void prepareUpdate();
+  bool crossesChange(int xstart, int ystart, int xend, int yend);
+  int nearestFreeIndex(int x, int y);
   void recenter(std::map<int, std::vector<int> > &clusterMembers, std::vector<int> &indices);
   void assignClusters(std::map<int, std::vector<int> > &clusterMembers, std::vector<int> &indices);
   bool merge(std::map<int, std::vector<int> > &clusterMembers, std::vector<int> &indices, int &clusters);
+  void labelImage(std::map<int, std::vector<int> > &clusters, std::vector<int> &labels);
+  int smoothRooms(std::map<int, std::vector<int> > &clusterMembers);
 
 };
 
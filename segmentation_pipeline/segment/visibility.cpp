@@ -0,0 +1,192 @@
+#include "visibility.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+VisibilityMatrix::VisibilityMatrix() {
+  numRows = 0; numCols = 0; rowWords = 0; numTiles = 0;
+  fd = -1;
+  tileStride = 0;
+}
+
+VisibilityMatrix::~VisibilityMatrix() {
+  clear();
+}
+
+void VisibilityMatrix::clear() {
+  unmapAll();
+  if (fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+  data.clear();
+  counts.clear();
+  numRows = 0; numCols = 0; rowWords = 0; numTiles = 0;
+}
+
+void VisibilityMatrix::resize(unsigned int rows, unsigned int cols, std::string backingFile) {
+  clear();
+
+  numRows = rows;
+  numCols = cols;
+  rowWords = std::max(1u, (cols + 63) / 64);
+  numTiles = (rows + VISIBILITY_TILE_ROWS - 1) / VISIBILITY_TILE_ROWS;
+  counts.assign(rows, 0);
+  scratch.resize(rowWords);
+
+  size_t tileBytes = (size_t) VISIBILITY_TILE_ROWS * rowWords * sizeof(uint64_t);
+  if ((size_t) numTiles * tileBytes <= VISIBILITY_MEMORY_LIMIT) {
+    data.assign((size_t) rows * rowWords, 0);
+    return;
+  }
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  tileStride = (tileBytes + page - 1) / page * page;
+
+  fd = open(backingFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1 || ftruncate(fd, (off_t) numTiles * tileStride) != 0) {
+    fprintf(stderr, "Could not create visibility file %s\n", backingFile.c_str());
+    exit(1);
+  }
+  // the file only needs to live as long as the descriptor
+  unlink(backingFile.c_str());
+
+  printf("Visibility matrix is %.1f MB, storing out of core in %d tiles\n", (double) numTiles * tileStride / (1 << 20), numTiles);
+}
+
+unsigned int VisibilityMatrix::tileEnd(unsigned int tile) {
+  return std::min(numRows, (tile + 1) * VISIBILITY_TILE_ROWS);
+}
+
+void VisibilityMatrix::writeTile(unsigned int tile, std::vector<uint64_t> &buffer) {
+  unsigned int start = tileStart(tile), end = tileEnd(tile);
+
+  for(unsigned int i=start; i<end; ++i) {
+    const uint64_t *bits = &buffer[(size_t) (i - start) * rowWords];
+    unsigned int count = 0;
+    for(unsigned int w=0; w<rowWords; ++w) {
+      count += __builtin_popcountll(bits[w]);
+    }
+    counts[i] = count;
+  }
+
+  size_t bytes = (size_t) (end - start) * rowWords * sizeof(uint64_t);
+  if (fd == -1) {
+    memcpy(&data[(size_t) start * rowWords], &buffer[0], bytes);
+    return;
+  }
+
+  // pwrite goes through the page cache, so tiles that are already mapped stay coherent
+  const char *src = (const char *) &buffer[0];
+  off_t offset = (off_t) tile * tileStride;
+  while (bytes > 0) {
+    ssize_t written = pwrite(fd, src, bytes, offset);
+    if (written <= 0) {
+      fprintf(stderr, "Could not write visibility tile %d\n", tile);
+      exit(1);
+    }
+    src += written; offset += written; bytes -= written;
+  }
+}
+
+void VisibilityMatrix::readTile(unsigned int tile, std::vector<uint64_t> &buffer) {
+  unsigned int start = tileStart(tile), end = tileEnd(tile);
+  size_t bytes = (size_t) (end - start) * rowWords * sizeof(uint64_t);
+  buffer.resize((size_t) (end - start) * rowWords);
+  if (fd == -1) {
+    memcpy(&buffer[0], &data[(size_t) start * rowWords], bytes);
+    return;
+  }
+
+  char *dst = (char *) &buffer[0];
+  off_t offset = (off_t) tile * tileStride;
+  while (bytes > 0) {
+    ssize_t got = pread(fd, dst, bytes, offset);
+    if (got <= 0) {
+      fprintf(stderr, "Could not read visibility tile %d\n", tile);
+      exit(1);
+    }
+    dst += got; offset += got; bytes -= got;
+  }
+}
+
+uint64_t *VisibilityMatrix::mapTile(unsigned int tile) {
+  std::list< std::pair<unsigned int, uint64_t *> >::iterator it;
+  for(it=mapped.begin(); it!=mapped.end(); ++it) {
+    if (it->first == tile) {
+      if (it != mapped.begin()) {
+	mapped.splice(mapped.begin(), mapped, it);
+      }
+      return it->second;
+    }
+  }
+
+  if (mapped.size() >= VISIBILITY_RESIDENT_TILES) {
+    munmap(mapped.back().second, tileStride);
+    mapped.pop_back();
+  }
+
+  void *ptr = mmap(NULL, tileStride, PROT_READ, MAP_SHARED, fd, (off_t) tile * tileStride);
+  if (ptr == MAP_FAILED) {
+    fprintf(stderr, "Could not map visibility tile %d\n", tile);
+    exit(1);
+  }
+  madvise(ptr, tileStride, MADV_SEQUENTIAL);
+
+  mapped.push_front(std::pair<unsigned int, uint64_t *>(tile, (uint64_t *) ptr));
+  return (uint64_t *) ptr;
+}
+
+void VisibilityMatrix::unmapAll() {
+  std::list< std::pair<unsigned int, uint64_t *> >::iterator it;
+  for(it=mapped.begin(); it!=mapped.end(); ++it) {
+    munmap(it->second, tileStride);
+  }
+  mapped.clear();
+}
+
+const uint64_t *VisibilityMatrix::row(unsigned int i) {
+  if (fd == -1) {
+    return &data[(size_t) i * rowWords];
+  }
+  unsigned int tile = i / VISIBILITY_TILE_ROWS;
+  return mapTile(tile) + (size_t) (i - tileStart(tile)) * rowWords;
+}
+
+void VisibilityMatrix::copyRow(unsigned int i, uint64_t *out) {
+  if (fd == -1) {
+    memcpy(out, &data[(size_t) i * rowWords], rowWords * sizeof(uint64_t));
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mappedMutex);
+  memcpy(out, row(i), rowWords * sizeof(uint64_t));
+}
+
+// Same value as the L1 distance between the two rows normalized to sum to 1,
+// halved: only the walls seen by exactly one of the points contribute.
+float VisibilityMatrix::distance(const uint64_t *one, unsigned int countOne, const uint64_t *two, unsigned int countTwo) {
+  unsigned int shared = 0;
+  for(unsigned int w=0; w<rowWords; ++w) {
+    shared += __builtin_popcountll(one[w] & two[w]);
+  }
+
+  float score = 0;
+  if (countOne > 0) {
+    score += (float) (countOne - shared) / countOne;
+  }
+  if (countTwo > 0) {
+    score += (float) (countTwo - shared) / countTwo;
+  }
+  return score/2;
+}
+
+float VisibilityMatrix::distance(unsigned int one, unsigned int two) {
+  copyRow(one, &scratch[0]);
+  return distance(&scratch[0], counts[one], row(two), counts[two]);
+}
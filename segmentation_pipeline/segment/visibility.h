@@ -0,0 +1,73 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <stdint.h>
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define VISIBILITY_TILE_ROWS 256
+#define VISIBILITY_RESIDENT_TILES 8
+#define VISIBILITY_MEMORY_LIMIT (64 << 20) // bytes kept in RAM before switching to a file
+
+// Bit-packed free space x wall visibility matrix, stored in tiles of
+// VISIBILITY_TILE_ROWS rows. Small matrices live in RAM; larger ones are
+// written to an unlinked temporary file and read back through a small LRU
+// of memory-mapped tiles, so memory use stays fixed regardless of floor size.
+// Rows are filled a whole tile at a time and should be read in tile order.
+// Different tiles may be written concurrently.
+class VisibilityMatrix {
+ public:
+  VisibilityMatrix();
+  ~VisibilityMatrix();
+
+  void resize(unsigned int rows, unsigned int cols, std::string backingFile);
+  void clear();
+
+  unsigned int rows() { return numRows; }
+  unsigned int cols() { return numCols; }
+  unsigned int words() { return rowWords; }
+  unsigned int tiles() { return numTiles; }
+  unsigned int tileStart(unsigned int tile) { return tile * VISIBILITY_TILE_ROWS; }
+  unsigned int tileEnd(unsigned int tile);
+  bool outOfCore() { return fd != -1; }
+
+  // tile buffer holds (tileEnd - tileStart) rows of words() words each;
+  // readTile() may be called from several threads at once and does not
+  // disturb the mapped tiles
+  void writeTile(unsigned int tile, std::vector<uint64_t> &buffer);
+  void readTile(unsigned int tile, std::vector<uint64_t> &buffer);
+
+  // returned pointer is only valid until the next row()/copyRow() call;
+  // copyRow() may be called from several threads at once, row() may not
+  const uint64_t *row(unsigned int i);
+  void copyRow(unsigned int i, uint64_t *out);
+  unsigned int count(unsigned int i) { return counts[i]; }
+  bool get(unsigned int i, unsigned int j) { return (row(i)[j >> 6] >> (j & 63)) & 1; }
+
+  // normalized visibility distance from 0 to 1 between two rows with the given bit counts
+  float distance(const uint64_t *one, unsigned int countOne, const uint64_t *two, unsigned int countTwo);
+  float distance(unsigned int one, unsigned int two);
+
+ private:
+  unsigned int numRows, numCols, rowWords, numTiles;
+  std::vector<unsigned int> counts;
+
+  // in-memory storage
+  std::vector<uint64_t> data;
+
+  // out-of-core storage
+  int fd;
+  size_t tileStride; // bytes per tile in the file, rounded up to the page size
+  std::list< std::pair<unsigned int, uint64_t *> > mapped; // most recently used first
+  std::mutex mappedMutex;
+  std::vector<uint64_t> scratch;
+
+  uint64_t *mapTile(unsigned int tile);
+  void unmapAll();
+};
+
+#endif